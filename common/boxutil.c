@@ -13,3 +13,31 @@ int box_intersect_line_rough(const BoxRec *b, const xSegment *seg)
 
 	return TRUE;
 }
+
+/* Find the first box in the region which ends below y */
+const BoxRec *region_find_band(RegionPtr region, int y, const BoxRec *hint)
+{
+	const BoxRec *base = RegionRects(region);
+	int lo = 0, hi = RegionNumRects(region);
+
+	if (hint && hint >= base && hint < base + hi) {
+		int i, n;
+
+		/* Walk forward a few boxes from the hint before searching */
+		for (i = hint - base, n = 8; i < hi && n; i++, n--)
+			if (base[i].y2 > y &&
+			    (i == 0 || base[i - 1].y2 <= y))
+				return &base[i];
+	}
+
+	while (lo < hi) {
+		int mid = (lo + hi) / 2;
+
+		if (base[mid].y2 <= y)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	return &base[lo];
+}
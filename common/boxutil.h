@@ -4,6 +4,7 @@
 #include "config.h"
 #include <X11/Xprotostr.h>
 #include "miscstruct.h"
+#include "regionstr.h"
 #include "utils.h"
 
 static inline void box_init(BoxPtr out, int x, int y, int w, int h)
@@ -46,4 +47,56 @@ static inline int box_area(BoxPtr box)
 
 int box_intersect_line_rough(const BoxRec *b, const xSegment *seg);
 
+/*
+ * Clip boxes against a region.  The region's boxes are sorted into
+ * y-bands, so we binary search for the first band which can intersect,
+ * skip the rest of a band once we are to the right of the box, and stop
+ * at the first band below it.  Callers producing boxes in y order can
+ * pass the previous starting point as a hint, which is then walked
+ * forward rather than searched for.
+ */
+struct region_clip_iter {
+	const BoxRec *box;
+	const BoxRec *end;
+	BoxRec rect;
+};
+
+const BoxRec *region_find_band(RegionPtr region, int y, const BoxRec *hint);
+
+static inline const BoxRec *region_clip_iter_init(struct region_clip_iter *it,
+	RegionPtr region, const BoxRec *rect, const BoxRec *hint)
+{
+	it->box = region_find_band(region, rect->y1, hint);
+	it->end = RegionRects(region) + RegionNumRects(region);
+	it->rect = *rect;
+
+	return it->box;
+}
+
+static inline Bool region_clip_iter_next(struct region_clip_iter *it,
+	BoxPtr out)
+{
+	const BoxRec *box = it->box, *end = it->end;
+
+	while (box < end && box->y1 < it->rect.y2) {
+		if (box->x2 <= it->rect.x1) {
+			box++;
+		} else if (box->x1 >= it->rect.x2) {
+			/* Nothing more in this band */
+			int y1 = box->y1;
+
+			do
+				box++;
+			while (box < end && box->y1 == y1);
+		} else {
+			it->box = box + 1;
+			return !__box_intersect(out, box, &it->rect);
+		}
+	}
+
+	it->box = end;
+
+	return FALSE;
+}
+
 #endif
@@ -245,3 +245,15 @@ void unaccel_CopyNtoN(DrawablePtr pSrc, DrawablePtr pDst, GCPtr pGC,
 		finish_cpu_drawable(pSrc, CPU_ACCESS_RO);
 	finish_cpu_drawable(pDst, CPU_ACCESS_RW);
 }
+
+void unaccel_Copy1toN(DrawablePtr pSrc, DrawablePtr pDst, GCPtr pGC,
+	BoxPtr pBox, int nBox, int dx, int dy, Bool reverse, Bool upsidedown,
+	Pixel bitPlane, void *closure)
+{
+	prepare_cpu_drawable(pDst, CPU_ACCESS_RW);
+	prepare_cpu_drawable(pSrc, CPU_ACCESS_RO);
+	fbCopy1toN(pSrc, pDst, pGC, pBox, nBox, dx, dy, reverse, upsidedown,
+		   bitPlane, closure);
+	finish_cpu_drawable(pSrc, CPU_ACCESS_RO);
+	finish_cpu_drawable(pDst, CPU_ACCESS_RW);
+}
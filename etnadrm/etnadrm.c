@@ -310,6 +310,7 @@ struct etna_bo {
 	struct xorg_list node;
 	struct bo_entry cache;
 	uint8_t is_usermem;
+	uint8_t cpu_op;
 };
 
 static int etna_bo_gem_wait(struct etna_bo *bo, uint32_t timeout)
@@ -391,13 +392,29 @@ static struct etna_bo *etna_bo_alloc(struct viv_conn *conn)
 	return mem;
 }
 
+/*
+ * Translate the libetnaviv cache flags to etnaviv DRM flags.  Only
+ * write-back mappings are made cacheable; everything else is mapped
+ * write-combining.
+ */
+static uint32_t etna_bo_cache_flags(uint32_t flags)
+{
+	switch (flags & DRM_ETNA_GEM_CACHE_MASK) {
+	case DRM_ETNA_GEM_CACHE_WBACK:
+	case DRM_ETNA_GEM_CACHE_WBACKWA:
+		return ETNA_BO_CACHED;
+	default:
+		return ETNA_BO_WC;
+	}
+}
+
 static struct etna_bo *etna_bo_get(struct viv_conn *conn, size_t bytes,
 	uint32_t flags)
 {
 	struct etna_bo *mem;
 	struct drm_etnaviv_gem_new req = {
 		.size = bytes,
-		.flags = ETNA_BO_WC,
+		.flags = etna_bo_cache_flags(flags),
 	};
 	int ret;
 
@@ -431,6 +448,10 @@ struct etna_bo *etna_bo_new(struct viv_conn *conn, size_t bytes, uint32_t flags)
 		if ((flags & DRM_ETNA_GEM_TYPE_MASK) == DRM_ETNA_GEM_TYPE_CMD)
 			break;
 
+		/* The bo cache only holds write-combining buffers */
+		if (etna_bo_cache_flags(flags) != ETNA_BO_WC)
+			break;
+
 		bucket = bo_cache_bucket_find(&ec->cache, bytes);
 		if (!bucket)
 			break;
@@ -578,13 +599,56 @@ struct etna_bo *etna_bo_from_usermem(struct viv_conn *conn, void *memory, size_t
 					 PROT_READ | PROT_WRITE);
 }
 
+/*
+ * Prepare a bo for CPU access.  This waits for the GPU to finish with
+ * the buffer (for the access type requested), and for cached buffers,
+ * performs the necessary cache maintenance.  If DRM_ETNA_PREP_NOSYNC
+ * is passed, this does not wait, but returns -EBUSY if the GPU is
+ * still using the buffer.
+ */
 int etna_bo_cpu_prep(struct etna_bo *bo, struct etna_ctx *pipe, uint32_t op)
 {
+	struct drm_etnaviv_gem_cpu_prep req;
+	int ret;
+
+	memset(&req, 0, sizeof(req));
+	req.handle = bo->handle;
+	if (op & DRM_ETNA_PREP_READ)
+		req.op |= ETNA_PREP_READ;
+	if (op & DRM_ETNA_PREP_WRITE)
+		req.op |= ETNA_PREP_WRITE;
+	if (op & DRM_ETNA_PREP_NOSYNC)
+		req.op |= ETNA_PREP_NOSYNC;
+	etnadrm_convert_timeout(&req.timeout, VIV_WAIT_INDEFINITE);
+
+	ret = drmCommandWrite(bo->conn->fd, DRM_ETNAVIV_GEM_CPU_PREP,
+			      &req, sizeof(req));
+	if (ret)
+		return ret;
+
+	bo->cpu_op |= req.op & (ETNA_PREP_READ | ETNA_PREP_WRITE);
+
 	return ETNA_OK;
 }
 
+/*
+ * Finish CPU access to a bo, handing it back to the GPU.  This is a
+ * no-op if the bo was not prepared for CPU access.
+ */
 void etna_bo_cpu_fini(struct etna_bo *bo)
 {
+	struct drm_etnaviv_gem_cpu_fini req;
+
+	if (!bo->cpu_op)
+		return;
+
+	memset(&req, 0, sizeof(req));
+	req.handle = bo->handle;
+
+	drmCommandWrite(bo->conn->fd, DRM_ETNAVIV_GEM_CPU_FINI,
+			&req, sizeof(req));
+
+	bo->cpu_op = 0;
 }
 
 uint32_t etna_bo_gpu_address(struct etna_bo *bo)
@@ -15,12 +15,14 @@
 #include <assert.h>
 #include <errno.h>
 #include <stdint.h>
+#include <string.h>
 #include <sys/mman.h>
 #include <unistd.h>
 
 #include <armada_bufmgr.h>
 
 #include "armada_accel.h"
+#include "common_drm.h"
 #include "common_drm_dri2.h"
 
 #include "fb.h"
@@ -122,10 +124,19 @@ static void etnaviv_put_vpix(struct etnaviv *etnaviv,
 	struct etnaviv_pixmap *vPix)
 {
 	if (--vPix->refcnt == 0) {
+		if (vPix->strip_bo)
+			etna_bo_del(etnaviv->conn, vPix->strip_bo, NULL);
+		if (vPix->linear_bo) {
+			if (vPix->state & ST_CPU_RW)
+				etna_bo_cpu_fini(vPix->linear_bo);
+			etna_bo_del(etnaviv->conn, vPix->linear_bo, NULL);
+			free(vPix->linear_mem);
+		}
 		if (vPix->etna_bo) {
 			struct etna_bo *etna_bo = vPix->etna_bo;
 
-			if (!vPix->bo && vPix->state & ST_CPU_RW)
+			if (!vPix->bo && !vPix->format.tile &&
+			    vPix->state & ST_CPU_RW)
 				etna_bo_cpu_fini(etna_bo);
 			etna_bo_del(etnaviv->conn, etna_bo, NULL);
 		}
@@ -169,6 +180,7 @@ static void etnaviv_free_pixmap(PixmapPtr pixmap)
 	if (vPix) {
 		struct etnaviv *etnaviv;
 
+		etnaviv_pixmap_free_sys(pixmap, FALSE);
 		etnaviv_set_pixmap_priv(pixmap, NULL);
 
 		etnaviv = etnaviv_get_screen_priv(pixmap->drawable.pScreen);
@@ -183,14 +195,14 @@ static void etnaviv_free_pixmap(PixmapPtr pixmap)
 }
 
 
-/* Determine whether this GC and target Drawable can be accelerated */
+/*
+ * Determine whether this GC and target Drawable can be accelerated.
+ * GCs with a partial planemask use etnaviv_planemask_GCOps, which only
+ * accelerates the operations which handle the planemask.
+ */
 static Bool etnaviv_GC_can_accel(GCPtr pGC, DrawablePtr pDrawable)
 {
-	if (!etnaviv_drawable(pDrawable))
-		return FALSE;
-
-	/* Must be full-planes */
-	return !pGC || fb_full_planemask(pDrawable, pGC->planemask);
+	return etnaviv_drawable(pDrawable) != NULL;
 }
 
 static Bool etnaviv_GCfill_can_accel(GCPtr pGC, DrawablePtr pDrawable)
@@ -268,6 +280,25 @@ etnaviv_CopyArea(DrawablePtr pSrc, DrawablePtr pDst, GCPtr pGC,
 			etnaviv_accel_CopyNtoN, 0, NULL);
 }
 
+static RegionPtr
+etnaviv_CopyPlane(DrawablePtr pSrc, DrawablePtr pDst, GCPtr pGC,
+	int srcx, int srcy, int w, int h, int dstx, int dsty,
+	unsigned long bitPlane)
+{
+	struct etnaviv *etnaviv = etnaviv_get_screen_priv(pDst->pScreen);
+
+	assert(etnaviv_GC_can_accel(pGC, pDst));
+
+	/* Only expansion from depth-1 pixmaps is accelerated */
+	if (etnaviv->force_fallback || pSrc->bitsPerPixel != 1 ||
+	    !(bitPlane & 1))
+		return unaccel_CopyPlane(pSrc, pDst, pGC, srcx, srcy, w, h,
+					 dstx, dsty, bitPlane);
+
+	return miDoCopy(pSrc, pDst, pGC, srcx, srcy, w, h, dstx, dsty,
+			etnaviv_accel_Copy1toN, bitPlane, NULL);
+}
+
 static void
 etnaviv_PolyPoint(DrawablePtr pDrawable, GCPtr pGC, int mode, int npt,
 	DDXPointPtr ppt)
@@ -293,8 +324,12 @@ etnaviv_PolyLines(DrawablePtr pDrawable, GCPtr pGC, int mode, int npt,
 	if (etnaviv->force_fallback ||
 	    pGC->lineWidth != 0 || pGC->lineStyle != LineSolid ||
 	    pGC->fillStyle != FillSolid ||
-	    !etnaviv_accel_PolyLines(pDrawable, pGC, mode, npt, ppt))
+	    !etnaviv_accel_PolyLines(pDrawable, pGC, mode, npt, ppt)) {
+		/* Wide lines are drawn by mi as spans */
+		etnaviv_span_begin(etnaviv);
 		unaccel_PolyLines(pDrawable, pGC, mode, npt, ppt);
+		etnaviv_span_end(etnaviv);
+	}
 }
 
 static void
@@ -307,8 +342,56 @@ etnaviv_PolySegment(DrawablePtr pDrawable, GCPtr pGC, int nseg, xSegment *pSeg)
 	if (etnaviv->force_fallback ||
 	    pGC->lineWidth != 0 || pGC->lineStyle != LineSolid ||
 	    pGC->fillStyle != FillSolid ||
-	    !etnaviv_accel_PolySegment(pDrawable, pGC, nseg, pSeg))
+	    !etnaviv_accel_PolySegment(pDrawable, pGC, nseg, pSeg)) {
+		/* Wide lines are drawn by mi as spans */
+		etnaviv_span_begin(etnaviv);
 		unaccel_PolySegment(pDrawable, pGC, nseg, pSeg);
+		etnaviv_span_end(etnaviv);
+	}
+}
+
+static void
+etnaviv_PolyArc(DrawablePtr pDrawable, GCPtr pGC, int narcs, xArc *parcs)
+{
+	struct etnaviv *etnaviv = etnaviv_get_screen_priv(pDrawable->pScreen);
+
+	etnaviv_span_begin(etnaviv);
+	miPolyArc(pDrawable, pGC, narcs, parcs);
+	etnaviv_span_end(etnaviv);
+}
+
+static void
+etnaviv_FillPolygon(DrawablePtr pDrawable, GCPtr pGC, int shape, int mode,
+	int count, DDXPointPtr pPts)
+{
+	struct etnaviv *etnaviv = etnaviv_get_screen_priv(pDrawable->pScreen);
+
+	assert(etnaviv_GC_can_accel(pGC, pDrawable));
+
+	if (etnaviv->force_fallback ||
+	    !etnaviv_GCfill_can_accel(pGC, pDrawable) ||
+	    !etnaviv_accel_FillPolygon(pDrawable, pGC, shape, mode, count,
+				       pPts)) {
+		etnaviv_span_begin(etnaviv);
+		miFillPolygon(pDrawable, pGC, shape, mode, count, pPts);
+		etnaviv_span_end(etnaviv);
+	}
+}
+
+static void
+etnaviv_PolyFillArc(DrawablePtr pDrawable, GCPtr pGC, int narcs, xArc *parcs)
+{
+	struct etnaviv *etnaviv = etnaviv_get_screen_priv(pDrawable->pScreen);
+
+	assert(etnaviv_GC_can_accel(pGC, pDrawable));
+
+	if (etnaviv->force_fallback ||
+	    !etnaviv_GCfill_can_accel(pGC, pDrawable) ||
+	    !etnaviv_accel_PolyFillArc(pDrawable, pGC, narcs, parcs)) {
+		etnaviv_span_begin(etnaviv);
+		miPolyFillArc(pDrawable, pGC, narcs, parcs);
+		etnaviv_span_end(etnaviv);
+	}
 }
 
 static void
@@ -327,29 +410,103 @@ etnaviv_PolyFillRect(DrawablePtr pDrawable, GCPtr pGC, int nrect,
 	if (etnaviv_GCfill_can_accel(pGC, pDrawable)) {
 		if (etnaviv_accel_PolyFillRectSolid(pDrawable, pGC, nrect, prect))
 			return;
-	} else if (pGC->fillStyle == FillTiled) {
+	} else if (pGC->fillStyle == FillTiled &&
+		   fb_full_planemask(pDrawable, pGC->planemask)) {
 		if (etnaviv_accel_PolyFillRectTiled(pDrawable, pGC, nrect, prect))
 			return;
+	} else if ((pGC->fillStyle == FillStippled ||
+		    pGC->fillStyle == FillOpaqueStippled) &&
+		   fb_full_planemask(pDrawable, pGC->planemask)) {
+		if (etnaviv_accel_PolyFillRectStippled(pDrawable, pGC, nrect,
+						       prect))
+			return;
 	}
 
  fallback:
 	unaccel_PolyFillRect(pDrawable, pGC, nrect, prect);
 }
 
+static void
+etnaviv_PushPixels(GCPtr pGC, PixmapPtr pBitmap, DrawablePtr pDrawable,
+	int w, int h, int x, int y)
+{
+	struct etnaviv *etnaviv = etnaviv_get_screen_priv(pDrawable->pScreen);
+
+	assert(etnaviv_GC_can_accel(pGC, pDrawable));
+
+	if (etnaviv->force_fallback || pGC->fillStyle != FillSolid ||
+	    !etnaviv_accel_PushPixels(pGC, pBitmap, pDrawable, w, h, x, y))
+		unaccel_PushPixels(pGC, pBitmap, pDrawable, w, h, x, y);
+}
+
+static void
+etnaviv_ImageGlyphBlt(DrawablePtr pDrawable, GCPtr pGC, int x, int y,
+	unsigned int nglyph, CharInfoPtr *ppci, pointer pglyphBase)
+{
+	struct etnaviv *etnaviv = etnaviv_get_screen_priv(pDrawable->pScreen);
+
+	assert(etnaviv_GC_can_accel(pGC, pDrawable));
+
+	if (etnaviv->force_fallback ||
+	    !etnaviv_accel_GlyphBlt(pDrawable, pGC, x, y, nglyph, ppci,
+				    pglyphBase, TRUE))
+		unaccel_ImageGlyphBlt(pDrawable, pGC, x, y, nglyph, ppci,
+				      pglyphBase);
+}
+
+static void
+etnaviv_PolyGlyphBlt(DrawablePtr pDrawable, GCPtr pGC, int x, int y,
+	unsigned int nglyph, CharInfoPtr *ppci, pointer pglyphBase)
+{
+	struct etnaviv *etnaviv = etnaviv_get_screen_priv(pDrawable->pScreen);
+
+	assert(etnaviv_GC_can_accel(pGC, pDrawable));
+
+	if (etnaviv->force_fallback || pGC->fillStyle != FillSolid ||
+	    !etnaviv_accel_GlyphBlt(pDrawable, pGC, x, y, nglyph, ppci,
+				    pglyphBase, FALSE))
+		unaccel_PolyGlyphBlt(pDrawable, pGC, x, y, nglyph, ppci,
+				     pglyphBase);
+}
+
 static GCOps etnaviv_GCOps = {
 	etnaviv_FillSpans,
 	unaccel_SetSpans,
 	etnaviv_PutImage,
 	etnaviv_CopyArea,
+	etnaviv_CopyPlane,
+	etnaviv_PolyPoint,
+	etnaviv_PolyLines,
+	etnaviv_PolySegment,
+	miPolyRectangle,
+	etnaviv_PolyArc,
+	etnaviv_FillPolygon,
+	etnaviv_PolyFillRect,
+	etnaviv_PolyFillArc,
+	miPolyText8,
+	miPolyText16,
+	miImageText8,
+	miImageText16,
+	etnaviv_ImageGlyphBlt,
+	etnaviv_PolyGlyphBlt,
+	etnaviv_PushPixels
+};
+
+/* Operations which handle a partial planemask */
+static GCOps etnaviv_planemask_GCOps = {
+	etnaviv_FillSpans,
+	unaccel_SetSpans,
+	unaccel_PutImage,
+	etnaviv_CopyArea,
 	unaccel_CopyPlane,
 	etnaviv_PolyPoint,
 	etnaviv_PolyLines,
 	etnaviv_PolySegment,
 	miPolyRectangle,
-	miPolyArc,
-	miFillPolygon,
+	etnaviv_PolyArc,
+	etnaviv_FillPolygon,
 	etnaviv_PolyFillRect,
-	miPolyFillArc,
+	etnaviv_PolyFillArc,
 	miPolyText8,
 	miPolyText16,
 	miImageText8,
@@ -436,10 +593,12 @@ etnaviv_ValidateGC(GCPtr pGC, unsigned long changes, DrawablePtr pDrawable)
 	 * Select the GC ops depending on whether we have any
 	 * chance to accelerate with this GC.
 	 */
-	if (!etnaviv->force_fallback && etnaviv_GC_can_accel(pGC, pDrawable))
+	if (etnaviv->force_fallback || !etnaviv_GC_can_accel(pGC, pDrawable))
+		pGC->ops = &etnaviv_unaccel_GCOps;
+	else if (fb_full_planemask(pDrawable, pGC->planemask))
 		pGC->ops = &etnaviv_GCOps;
 	else
-		pGC->ops = &etnaviv_unaccel_GCOps;
+		pGC->ops = &etnaviv_planemask_GCOps;
 }
 
 static GCFuncs etnaviv_GCFuncs = {
@@ -453,6 +612,15 @@ static GCFuncs etnaviv_GCFuncs = {
 };
 
 
+static Bool etnaviv_UnrealizeFont(ScreenPtr pScreen, FontPtr pFont)
+{
+	struct etnaviv *etnaviv = etnaviv_get_screen_priv(pScreen);
+
+	etnaviv_accel_UnrealizeFont(etnaviv, pFont);
+
+	return etnaviv->UnrealizeFont(pScreen, pFont);
+}
+
 static Bool etnaviv_CloseScreen(CLOSE_SCREEN_ARGS_DECL)
 {
 	ScrnInfoPtr pScrn = xf86ScreenToScrn(pScreen);
@@ -473,6 +641,7 @@ static Bool etnaviv_CloseScreen(CLOSE_SCREEN_ARGS_DECL)
 	pScreen->CreateGC = etnaviv->CreateGC;
 	pScreen->BitmapToRegion = etnaviv->BitmapToRegion;
 	pScreen->BlockHandler = etnaviv->BlockHandler;
+	pScreen->UnrealizeFont = etnaviv->UnrealizeFont;
 
 #ifdef HAVE_DRI2
 	etnaviv_dri2_CloseScreen(CLOSE_SCREEN_ARGS);
@@ -529,16 +698,33 @@ etnaviv_CopyWindow(WindowPtr pWin, DDXPointRec ptOldOrg, RegionPtr prgnSrc)
 #ifdef HAVE_DRI2
 Bool etnaviv_pixmap_flink(PixmapPtr pixmap, uint32_t *name)
 {
+	struct etnaviv *etnaviv = etnaviv_get_screen_priv(pixmap->drawable.pScreen);
 	struct etnaviv_pixmap *vpix = etnaviv_get_pixmap_priv(pixmap);
 	Bool ret = FALSE;
 
 	if (!vpix)
 		return FALSE;
 
+	/* Other users will read the pixel data, and may write it */
+	etnaviv_pixmap_realise(etnaviv, vpix);
+	vpix->content = 0;
+
+	/* Other users expect a linear buffer */
+	if (!etnaviv_pixmap_linearise(etnaviv, pixmap))
+		return FALSE;
+
+	/*
+	 * Shared pixmaps must keep their bo, and other users will
+	 * not see a system memory copy.
+	 */
+	etnaviv_pixmap_free_sys(pixmap, TRUE);
+	vpix->shared = TRUE;
+
 	if (vpix->name) {
 		*name = vpix->name;
 		ret = TRUE;
-	} else if (vpix->bo && !drm_armada_bo_flink(vpix->bo, name)) {
+	} else if (etnaviv->dri2_armada && vpix->bo &&
+		   !drm_armada_bo_flink(vpix->bo, name)) {
 		vpix->name = *name;
 		ret = TRUE;
 	} else if (!etna_bo_flink(vpix->etna_bo, name)) {
@@ -550,13 +736,109 @@ Bool etnaviv_pixmap_flink(PixmapPtr pixmap, uint32_t *name)
 }
 #endif
 
+/*
+ * Allocate a pixmap from the KMS driver, so that it can be scanned out
+ * without first having to be copied.  The buffer is imported into the
+ * GPU once here, and that mapping is retained for the buffer's lifetime.
+ */
 static Bool etnaviv_alloc_armada_bo(ScreenPtr pScreen, struct etnaviv *etnaviv,
 	PixmapPtr pixmap, int w, int h, struct etnaviv_format fmt,
 	unsigned usage_hint)
 {
+	struct etnaviv_pixmap *vpix;
+	struct drm_armada_bo *bo;
+	unsigned bpp = pixmap->drawable.bitsPerPixel;
+	int aw = w, ah = h;
+
+	if (usage_hint & CREATE_PIXMAP_USAGE_3D) {
+		/*
+		 * The Vivante 3D resolve engine requires the
+		 * width and height to be appropriately aligned.
+		 */
+		aw = ALIGN(aw, ETNAVIV_3D_WIDTH_ALIGN);
+		ah = ALIGN(ah, ETNAVIV_3D_HEIGHT_ALIGN);
+	}
+
+	/* Ensure that the pitch meets the GPU's alignment requirements */
+	aw = etnaviv_pitch(aw, bpp) * 8 / bpp;
+
+	bo = drm_armada_bo_dumb_create(etnaviv->bufmgr, aw, ah, bpp);
+	if (!bo) {
+		xf86DrvMsg(etnaviv->scrnIndex, X_ERROR,
+			   "etnaviv: failed to allocate armada bo for %dx%d %dbpp: %s\n",
+			   w, h, bpp, strerror(errno));
+		return FALSE;
+	}
+
+	if (drm_armada_bo_map(bo)) {
+		xf86DrvMsg(etnaviv->scrnIndex, X_ERROR,
+			   "etnaviv: failed to map armada bo: %s\n",
+			   strerror(errno));
+		goto free_bo;
+	}
+
+	pScreen->ModifyPixmapHeader(pixmap, w, h, 0, 0, bo->pitch, NULL);
+
+	vpix = etnaviv_alloc_pixmap(pixmap, fmt);
+	if (!vpix)
+		goto free_bo;
+
+	vpix->bo = bo;
+	vpix->etna_bo = etnaviv_import_armada_bo(etnaviv, bo);
+	if (!vpix->etna_bo) {
+		free(vpix);
+		goto free_bo;
+	}
+
+	/*
+	 * Like pixmaps imported via dmabuf, the buffer is write-combining
+	 * so needs no CPU cache state tracking, and the CPU mapping stays
+	 * in place for the lifetime of the pixmap.
+	 */
+	vpix->state |= ST_DMABUF;
+	pixmap->devPrivate.ptr = bo->ptr;
+
+	etnaviv_set_pixmap_priv(pixmap, vpix);
+
+	/*
+	 * Let the KMS layer know about this bo so that it can be used
+	 * to create a framebuffer when flipping.  It holds its own
+	 * reference, which is dropped when the pixmap is destroyed.
+	 */
+	drm_armada_bo_get(bo);
+	common_drm_set_pixmap_data(pixmap, bo->handle, bo);
+
+#ifdef DEBUG_PIXMAP
+	dbg("Pixmap %p: vPix=%p bo=%p etna_bo=%p format=%u/%u/%u\n",
+	    pixmap, vpix, bo, vpix->etna_bo, fmt.format, fmt.swizzle, fmt.tile);
+#endif
+
+	return TRUE;
+
+ free_bo:
+	drm_armada_bo_put(bo);
 	return FALSE;
 }
 
+/*
+ * Decide whether a pixmap should be allocated as a scanout buffer.
+ * We do this for pixmaps explicitly requested for scanout, and for
+ * window backing pixmaps which cover the whole screen, since these
+ * are the ones which are likely to be flipped.
+ */
+static Bool etnaviv_want_scanout(ScreenPtr pScreen, struct etnaviv *etnaviv,
+	int w, int h, unsigned bpp, unsigned usage_hint)
+{
+	if (!etnaviv->bufmgr || bpp != xf86ScreenToScrn(pScreen)->bitsPerPixel)
+		return FALSE;
+
+	if (usage_hint & CREATE_PIXMAP_USAGE_SCANOUT)
+		return TRUE;
+
+	return usage_hint == CREATE_PIXMAP_USAGE_BACKING_PIXMAP &&
+	       w == pScreen->width && h == pScreen->height;
+}
+
 static Bool etnaviv_alloc_etna_bo(ScreenPtr pScreen, struct etnaviv *etnaviv,
 	PixmapPtr pixmap, int w, int h, struct etnaviv_format fmt,
 	unsigned usage_hint)
@@ -581,8 +863,12 @@ static Bool etnaviv_alloc_etna_bo(ScreenPtr pScreen, struct etnaviv *etnaviv,
 		size = pitch * h;
 	}
 
+	/*
+	 * Pixmaps start off write-combined; those which the CPU turns
+	 * out to read frequently are moved to cached memory later.
+	 */
 	etna_bo = etna_bo_new(etnaviv->conn, size,
-			DRM_ETNA_GEM_TYPE_BMP | DRM_ETNA_GEM_CACHE_WBACK);
+			DRM_ETNA_GEM_TYPE_BMP | DRM_ETNA_GEM_CACHE_WCOMBINE);
 	if (!etna_bo) {
 		xf86DrvMsg(etnaviv->scrnIndex, X_ERROR,
 			   "etnaviv: failed to allocate bo for %dx%d %dbpp\n",
@@ -596,14 +882,21 @@ static Bool etnaviv_alloc_etna_bo(ScreenPtr pScreen, struct etnaviv *etnaviv,
 	 * pixmap.  This provides us a way to validate that we do not have
 	 * any spurious unchecked accesses to the pixmap data while the GPU
 	 * has ownership of the pixmap.
+	 *
+	 * For tiled pixmaps, the pixmap header describes the linear
+	 * shadow rather than the tiled layout.
 	 */
-	pScreen->ModifyPixmapHeader(pixmap, w, h, 0, 0, pitch, NULL);
+	pScreen->ModifyPixmapHeader(pixmap, w, h, 0, 0,
+				    fmt.tile ? etnaviv_pitch(w, bpp) : pitch,
+				    NULL);
 
 	vpix = etnaviv_alloc_pixmap(pixmap, fmt);
 	if (!vpix)
 		goto free_bo;
 
 	vpix->etna_bo = etna_bo;
+	vpix->pitch = pitch;
+	vpix->linear_pitch = pixmap->devKind;
 
 	etnaviv_set_pixmap_priv(pixmap, vpix);
 
@@ -619,6 +912,31 @@ static Bool etnaviv_alloc_etna_bo(ScreenPtr pScreen, struct etnaviv *etnaviv,
 	return FALSE;
 }
 
+/*
+ * Decide whether an offscreen pixmap should use the tiled layout.  The
+ * GPU reads tiled pixmaps more efficiently in small rectangles or
+ * when rotating, but CPU access and sharing require the pixmap to be
+ * copied to a linear layout.  So only tile pixmaps which are expected
+ * to remain on the GPU: those explicitly requested, and glyph pictures
+ * which are only ever used as Render sources.
+ */
+static unsigned etnaviv_tile_hint(int w, int h, unsigned usage_hint)
+{
+	/* Pixmaps which may be shared or scanned out must be linear */
+	if (usage_hint & (CREATE_PIXMAP_USAGE_3D |
+			  CREATE_PIXMAP_USAGE_SCANOUT))
+		return usage_hint & ~CREATE_PIXMAP_USAGE_TILE;
+
+	/* Pixmaps smaller than a tile gain nothing */
+	if (w < ETNAVIV_TILE_WIDTH || h < ETNAVIV_TILE_HEIGHT)
+		return usage_hint & ~CREATE_PIXMAP_USAGE_TILE;
+
+	if (usage_hint == CREATE_PIXMAP_USAGE_GLYPH_PICTURE)
+		usage_hint |= CREATE_PIXMAP_USAGE_TILE;
+
+	return usage_hint;
+}
+
 static PixmapPtr etnaviv_CreatePixmap(ScreenPtr pScreen, int w, int h,
 	int depth, unsigned usage_hint)
 {
@@ -643,7 +961,16 @@ static PixmapPtr etnaviv_CreatePixmap(ScreenPtr pScreen, int w, int h,
 	/* Create the appropriate format for this pixmap */
 	switch (pixmap->drawable.bitsPerPixel) {
 	case 8:
-		if (usage_hint & CREATE_PIXMAP_USAGE_GPU) {
+		/*
+		 * Depth-8 pixmaps are mostly alpha masks.  Keep them on
+		 * the GPU if it can render to A8.  If it can not, Render
+		 * converts them to ARGB in a scratch pixmap when they are
+		 * used as a source.
+		 */
+		if (usage_hint & CREATE_PIXMAP_USAGE_GPU ||
+		    (depth == 8 &&
+		     VIV_FEATURE(etnaviv->conn, chipMinorFeatures0,
+				 2D_A8_TARGET))) {
 			fmt.format = DE_FORMAT_A8;
 			break;
 		}
@@ -664,15 +991,28 @@ static PixmapPtr etnaviv_CreatePixmap(ScreenPtr pScreen, int w, int h,
 		goto fallback_free_pix;
 	}
 
-	if (etnaviv->bufmgr) {
-		if (!etnaviv_alloc_armada_bo(pScreen, etnaviv, pixmap,
-					     w, h, fmt, usage_hint))
-			goto fallback_free_pix;
-	} else {
-		if (!etnaviv_alloc_etna_bo(pScreen, etnaviv, pixmap,
-					   w, h, fmt, usage_hint))
-			goto fallback_free_pix;
-	}
+	/*
+	 * Scanout-capable pixmaps are preferred where they may be
+	 * flipped, but if we fail to allocate one, a GPU pixmap will do.
+	 */
+	if (etnaviv_want_scanout(pScreen, etnaviv, w, h,
+				 pixmap->drawable.bitsPerPixel, usage_hint) &&
+	    etnaviv_alloc_armada_bo(pScreen, etnaviv, pixmap,
+				    w, h, fmt, usage_hint))
+		goto out;
+
+	if (!etnaviv_alloc_etna_bo(pScreen, etnaviv, pixmap, w, h, fmt,
+				   etnaviv_tile_hint(w, h, usage_hint)))
+		goto fallback_free_pix;
+
+	/*
+	 * Ordinary client pixmaps may acquire a system memory copy if
+	 * the CPU uses them heavily.  Our own GPU pixmaps are drawn
+	 * outside of the damage wrappers, and backing pixmaps receive
+	 * window damage, so these must stay GPU-only.
+	 */
+	if (usage_hint == 0 || usage_hint == CREATE_PIXMAP_USAGE_SCRATCH)
+		etnaviv_get_pixmap_priv(pixmap)->migratable = TRUE;
 	goto out;
 
  fallback_free_pix:
@@ -726,6 +1066,9 @@ static void etnaviv_BlockHandler(BLOCKHANDLER_ARGS_DECL)
 	if (etnaviv_fence_batch_pending(&etnaviv->fence_head))
 		etnaviv_commit(etnaviv, FALSE);
 
+	/* Clients may now write to shared memory bitmaps */
+	etnaviv->mono_gen++;
+
 	mark_flush();
 
 	pScreen->BlockHandler = etnaviv->BlockHandler;
@@ -883,6 +1226,8 @@ static Bool etnaviv_ScreenInit(ScreenPtr pScreen, struct drm_armada_bufmgr *mgr)
 	pScreen->BitmapToRegion = unaccel_BitmapToRegion;
 	etnaviv->BlockHandler = pScreen->BlockHandler;
 	pScreen->BlockHandler = etnaviv_BlockHandler;
+	etnaviv->UnrealizeFont = pScreen->UnrealizeFont;
+	pScreen->UnrealizeFont = etnaviv_UnrealizeFont;
 
 	etnaviv_render_screen_init(pScreen);
 
@@ -906,6 +1251,12 @@ static Bool etnaviv_format(struct etnaviv_format *fmt, unsigned int depth,
 		{ .swizzle = DE_SWIZZLE_ARGB, };
 	*fmt = template;
 	switch (bpp) {
+	case 8:
+		if (depth != 8)
+			return FALSE;
+		fmt->format = DE_FORMAT_A8;
+		return TRUE;
+
 	case 16:
 		if (depth == 15)
 			fmt->format = DE_FORMAT_A1R5G5B5;
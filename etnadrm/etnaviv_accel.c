@@ -14,6 +14,8 @@
 #endif
 
 #include <errno.h>
+#include <string.h>
+#include <sys/mman.h>
 #include <unistd.h>
 
 #ifdef HAVE_DIX_CONFIG_H
@@ -21,9 +23,14 @@
 #endif
 #include "fb.h"
 #include "gcstruct.h"
+#include "mifillarc.h"
+#include "miline.h"
+#include <X11/fonts/fontstruct.h>
+#include "dixfontstr.h"
 #include "xf86.h"
 
 #include "boxutil.h"
+#include "fbutil.h"
 #include "pixmaputil.h"
 #include "prefetch.h"
 #include "unaccel.h"
@@ -40,13 +47,14 @@
 #include <etnaviv/state_2d.xml.h>
 #include "etnaviv_compat.h"
 
-void etnaviv_batch_wait_commit(struct etnaviv *etnaviv,
-	struct etnaviv_pixmap *vPix)
+/* Wait for the GPU to finish with whatever the fence covers */
+static void etnaviv_fence_wait(struct etnaviv *etnaviv,
+	struct etnaviv_fence *f)
 {
 	uint32_t id;
 	int ret;
 
-	switch (vPix->fence.state) {
+	switch (f->state) {
 	case B_NONE:
 		return;
 
@@ -56,10 +64,10 @@ void etnaviv_batch_wait_commit(struct etnaviv *etnaviv,
 
 	case B_FENCED:
 		/*
-		 * The pixmap is part of a batch which has been submitted,
+		 * The object is part of a batch which has been submitted,
 		 * so we must wait for the batch to complete.
 		 */
-		id = vPix->fence.id;
+		id = f->id;
 
 		ret = viv_fence_finish(etnaviv->conn, id, VIV_WAIT_INDEFINITE);
 		if (ret != VIV_STATUS_OK)
@@ -70,6 +78,83 @@ void etnaviv_batch_wait_commit(struct etnaviv *etnaviv,
 	}
 }
 
+void etnaviv_batch_wait_commit(struct etnaviv *etnaviv,
+	struct etnaviv_pixmap *vPix)
+{
+	etnaviv_fence_wait(etnaviv, &vPix->fence);
+}
+
+static void etnaviv_ring_retire(struct etnaviv_fence_head *fh,
+	struct etnaviv_fence *f)
+{
+}
+
+static Bool etnaviv_ring_init(struct etnaviv *etnaviv,
+	struct etnaviv_ring *ring, size_t slot_size, uint32_t flags)
+{
+	unsigned int i;
+
+	ring->bo = etna_bo_new(etnaviv->conn, slot_size * ETNAVIV_RING_SLOTS,
+			       DRM_ETNA_GEM_TYPE_BMP | flags);
+	if (!ring->bo)
+		return FALSE;
+
+	ring->ptr = etna_bo_map(ring->bo);
+	if (!ring->ptr) {
+		etna_bo_del(etnaviv->conn, ring->bo, NULL);
+		ring->bo = NULL;
+		return FALSE;
+	}
+
+	ring->slot_size = slot_size;
+	ring->offset = 0;
+	ring->slot = 0;
+	for (i = 0; i < ETNAVIV_RING_SLOTS; i++)
+		ring->fence[i].retire = etnaviv_ring_retire;
+
+	return TRUE;
+}
+
+/*
+ * Allocate space from the ring for a transfer which the GPU is about
+ * to perform.  The offset is aligned to a multiple of 'align' bytes
+ * from the start of the buffer.  Returns the offset, or -1.
+ */
+static ssize_t etnaviv_ring_alloc(struct etnaviv *etnaviv,
+	struct etnaviv_ring *ring, size_t size, size_t align)
+{
+	size_t base, offset;
+
+	if (size > ring->slot_size)
+		return -1;
+
+	base = ring->slot * ring->slot_size;
+	offset = (base + ring->offset + align - 1) / align * align - base;
+	if (offset + size > ring->slot_size) {
+		ring->slot = (ring->slot + 1) % ETNAVIV_RING_SLOTS;
+		etnaviv_fence_wait(etnaviv, &ring->fence[ring->slot]);
+
+		base = ring->slot * ring->slot_size;
+		offset = (base + align - 1) / align * align - base;
+		if (offset + size > ring->slot_size)
+			return -1;
+	}
+
+	ring->offset = offset + size;
+	etnaviv_fence_add(&etnaviv->fence_head, &ring->fence[ring->slot]);
+
+	return base + offset;
+}
+
+static void etnaviv_ring_fini(struct etnaviv *etnaviv,
+	struct etnaviv_ring *ring)
+{
+	if (ring->bo) {
+		etna_bo_del(etnaviv->conn, ring->bo, NULL);
+		ring->bo = NULL;
+	}
+}
+
 static void etnaviv_batch_add(struct etnaviv *etnaviv,
 	struct etnaviv_pixmap *vPix)
 {
@@ -80,14 +165,37 @@ static void etnaviv_batch_add(struct etnaviv *etnaviv,
 void etnaviv_batch_start(struct etnaviv *etnaviv,
 	const struct etnaviv_de_op *op)
 {
+	/* Spans and composites collected earlier must be drawn first */
+	if (etnaviv->span.n)
+		etnaviv_span_flush(etnaviv);
+	if (etnaviv->composite.n)
+		etnaviv_composite_flush(etnaviv);
+
 	if (op->src.pixmap)
 		etnaviv_batch_add(etnaviv, op->src.pixmap);
 
-	etnaviv_batch_add(etnaviv, op->dst.pixmap);
+	if (op->dst.pixmap)
+		etnaviv_batch_add(etnaviv, op->dst.pixmap);
 
 	etnaviv_de_start(etnaviv, op);
 }
 
+/*
+ * Filter blits are emitted directly by etnaviv_vr_op() rather than being
+ * batched, but the pixmaps they use must still be fenced.
+ */
+void etnaviv_vr_start(struct etnaviv *etnaviv, struct etnaviv_pixmap *vSrc,
+	struct etnaviv_pixmap *vDst)
+{
+	if (etnaviv->span.n)
+		etnaviv_span_flush(etnaviv);
+	if (etnaviv->composite.n)
+		etnaviv_composite_flush(etnaviv);
+
+	etnaviv_batch_add(etnaviv, vSrc);
+	etnaviv_batch_add(etnaviv, vDst);
+}
+
 static void etnaviv_blit_clipped(struct etnaviv *etnaviv,
 	struct etnaviv_de_op *op, const BoxRec *pbox, size_t nbox)
 {
@@ -188,6 +296,9 @@ void etnaviv_commit(struct etnaviv *etnaviv, Bool stall)
 	uint32_t fence;
 	int ret;
 
+	if (etnaviv->composite.n)
+		etnaviv_composite_flush(etnaviv);
+
 	ret = etna_flush(ctx, &fence);
 	if (ret) {
 		etnaviv_error(etnaviv, "etna_flush", ret);
@@ -275,15 +386,10 @@ static const uint8_t etnaviv_fill_rop[] = {
 	/* GXset          */  0xff		// ROP_WHITE
 };
 
-static uint32_t etnaviv_fg_col(struct etnaviv *etnaviv, GCPtr pGC)
+static uint32_t etnaviv_pixel_col(struct etnaviv *etnaviv, unsigned depth,
+	uint32_t pixel)
 {
-	uint32_t pixel, colour;
-
-	if (pGC->fillStyle == FillTiled)
-		pixel = pGC->tileIsPixel ? pGC->tile.pixel :
-			get_first_pixel(&pGC->tile.pixmap->drawable);
-	else
-		pixel = pGC->fgPixel;
+	uint32_t colour;
 
 	/* With PE1.0, this is the pixel value, but PE2.0, it must be ARGB */
 	if (!VIV_FEATURE(etnaviv->conn, chipMinorFeatures0, 2DPE20))
@@ -294,7 +400,7 @@ static uint32_t etnaviv_fg_col(struct etnaviv *etnaviv, GCPtr pGC)
 	 * The aim here is to generate an A8R8G8B8 format colour which
 	 * results in a destination pixel value of 'pixel'.
 	 */
-	switch (pGC->depth) {
+	switch (depth) {
 	case 15: /* A1R5G5B5 */
 		colour = (pixel & 0x8000 ? 0xff000000 : 0) |
 			 scale16((pixel & 0x7c00) >> 10, 5) << 16 |
@@ -307,6 +413,9 @@ static uint32_t etnaviv_fg_col(struct etnaviv *etnaviv, GCPtr pGC)
 			 scale16((pixel & 0x07e0) >> 5, 6) << 8 |
 			 scale16((pixel & 0x001f), 5);
 		break;
+	case 8: /* A8 */
+		colour = pixel << 24;
+		break;
 	case 24: /* A8R8G8B8 */
 	default:
 		colour = pixel;
@@ -316,15 +425,118 @@ static uint32_t etnaviv_fg_col(struct etnaviv *etnaviv, GCPtr pGC)
 	return colour;
 }
 
+static uint32_t etnaviv_fg_pixel(GCPtr pGC)
+{
+	if (pGC->fillStyle == FillTiled) {
+		struct etnaviv_pixmap *vTile;
+
+		if (pGC->tileIsPixel)
+			return pGC->tile.pixel;
+
+		/* Avoid reading back a tile whose colour we know */
+		vTile = etnaviv_get_pixmap_priv(pGC->tile.pixmap);
+		if (vTile && vTile->content & CT_SOLID)
+			return vTile->solid_pixel;
+
+		return get_first_pixel(&pGC->tile.pixmap->drawable);
+	}
+
+	return pGC->fgPixel;
+}
+
+static uint32_t etnaviv_fg_col(struct etnaviv *etnaviv, GCPtr pGC)
+{
+	return etnaviv_pixel_col(etnaviv, pGC->depth, etnaviv_fg_pixel(pGC));
+}
+
+/*
+ * Set up a solid fill.  With a partial planemask, fb reduces the alu
+ * to dst = (dst & and) ^ xor.  We draw this as an AND pass, an OR pass
+ * for the bits which become constant ones, and an XOR pass for the
+ * bits which are inverted, skipping passes which change nothing.
+ * Where boxes overlap, each pass behaves as the alu itself does on
+ * those bits, so the result matches drawing the boxes one by one.
+ */
 static void etnaviv_init_fill(struct etnaviv *etnaviv,
-	struct etnaviv_de_op *op, GCPtr pGC)
+	struct etnaviv_de_op *op, struct etnaviv_fill_passes *passes,
+	GCPtr pGC)
 {
+	uint32_t full, pm, and, xor, pixel, val[3];
+	static const uint8_t alu[3] = { GXand, GXor, GXxor };
+	unsigned int i;
+
 	op->src = INIT_BLIT_NULL;
 	op->blend_op = NULL;
 	op->src_origin_mode = SRC_ORIGIN_NONE;
 	op->rop = etnaviv_fill_rop[pGC->alu];
-	op->brush = TRUE;
+	op->brush = BRUSH_SOLID;
 	op->fg_colour = etnaviv_fg_col(etnaviv, pGC);
+
+	passes->n = 0;
+
+	full = FbFullMask(pGC->depth);
+	pm = pGC->planemask & full;
+	if (pm == full)
+		return;
+
+	pixel = etnaviv_fg_pixel(pGC);
+	and = fbAnd(pGC->alu, pixel, pm) & full;
+	xor = fbXor(pGC->alu, pixel, pm) & full;
+
+	val[0] = and;
+	val[1] = ~and & xor & full;
+	val[2] = and & xor;
+
+	for (i = 0; i < ARRAY_SIZE(alu); i++) {
+		/* ANDing with all ones, or OR/XOR with zero, is a no-op */
+		if (val[i] == (i == 0 ? full : 0))
+			continue;
+
+		passes->rop[passes->n] = etnaviv_fill_rop[alu[i]];
+		passes->colour[passes->n] = etnaviv_pixel_col(etnaviv,
+							pGC->depth, val[i]);
+		passes->n++;
+	}
+
+	if (passes->n) {
+		op->rop = passes->rop[0];
+		op->fg_colour = passes->colour[0];
+	} else {
+		op->rop = etnaviv_fill_rop[GXnoop];
+	}
+}
+
+/*
+ * Draw boxes for a started fill, followed by any further planemask
+ * passes.  Each pass needs its own ROP and brush state, so the batch
+ * is ended between passes, and the state of the first pass restored
+ * for any boxes which follow.
+ */
+static void etnaviv_de_op_fill(struct etnaviv *etnaviv,
+	const struct etnaviv_de_op *op,
+	const struct etnaviv_fill_passes *passes, const BoxRec *pBox,
+	size_t nBox)
+{
+	struct etnaviv_de_op pass;
+	unsigned int i;
+
+	etnaviv_de_op(etnaviv, op, pBox, nBox);
+
+	if (passes->n < 2)
+		return;
+
+	pass = *op;
+	for (i = 1; i < passes->n; i++) {
+		pass.rop = passes->rop[i];
+		pass.fg_colour = passes->colour[i];
+
+		etnaviv_de_end(etnaviv);
+		etnaviv_de_start(etnaviv, &pass);
+		etnaviv_de_op(etnaviv, &pass, pBox, nBox);
+	}
+
+	etnaviv_de_end(etnaviv);
+	etnaviv_de_start(etnaviv, op);
 }
 
 static const uint8_t etnaviv_copy_rop[] = {
@@ -346,222 +558,2090 @@ static const uint8_t etnaviv_copy_rop[] = {
 	/* GXset          */  0xff		// ROP_WHITE
 };
 
-Bool etnaviv_accel_FillSpans(DrawablePtr pDrawable, GCPtr pGC, int n,
-	DDXPointPtr ppt, int *pwidth, int fSorted)
+/*
+ * Monochrome data is expanded to the foreground and background colours
+ * by the drawing engine.  Depth-1 pixmaps live in system memory, so
+ * their contents are uploaded to a GPU buffer, which is cached against
+ * the pixmap and its serial number, and kept until Damage reports a
+ * change to the pixmap.  Damage can not see clients writing shared
+ * memory pixmaps, so uploads of those only remain valid until we next
+ * wait for clients, which bumps mono_gen.
+ */
+static inline uint8_t etnaviv_bitrev8(uint8_t b)
 {
-	struct etnaviv *etnaviv = etnaviv_get_screen_priv(pDrawable->pScreen);
-	struct etnaviv_de_op op;
-	RegionPtr clip = fbGetCompositeClip(pGC);
-	int nclip;
-	BoxRec *boxes, *b;
-	size_t sz;
+	return ((b * 0x0802LU & 0x22110LU) | (b * 0x8020LU & 0x88440LU)) *
+		0x10101LU >> 16;
+}
 
-	assert(pGC->miTranslate);
+/* Copy rows of 1bpp data, converting to most significant bit first. */
+static void etnaviv_mono_copy(uint8_t *dst, unsigned pitch,
+	const uint8_t *bits, unsigned stride, unsigned bytes, unsigned h)
+{
+	unsigned x, y;
+
+	for (y = 0; y < h; y++, bits += stride, dst += pitch) {
+#if BITMAP_BIT_ORDER == LSBFirst
+		for (x = 0; x < bytes; x++)
+			dst[x] = etnaviv_bitrev8(bits[x]);
+#else
+		memcpy(dst, bits, bytes);
+#endif
+	}
+}
 
-	if (RegionNumRects(clip) == 0)
-		return TRUE;
+/* Copy 1bpp data into a new GPU buffer, most significant bit first. */
+static struct etna_bo *etnaviv_mono_alloc(struct etnaviv *etnaviv,
+	const uint8_t *bits, unsigned stride, unsigned w, unsigned h,
+	unsigned *pitch)
+{
+	unsigned bytes = (w + 7) / 8;
+	struct etna_bo *bo;
+	uint8_t *dst;
 
-	if (!etnaviv_init_dst_drawable(etnaviv, &op, pDrawable))
-		return FALSE;
+	*pitch = ALIGN(bytes, 16);
 
-	etnaviv_init_fill(etnaviv, &op, pGC);
-	op.clip = RegionExtents(clip);
-	op.cmd = VIVS_DE_DEST_CONFIG_COMMAND_LINE;
+	bo = etna_bo_new(etnaviv->conn, *pitch * h,
+			 DRM_ETNA_GEM_TYPE_BMP | DRM_ETNA_GEM_CACHE_WCOMBINE);
+	if (!bo)
+		return NULL;
 
-	nclip = RegionNumRects(clip);
-	sz = sizeof(BoxRec) * n * nclip;
+	dst = etna_bo_map(bo);
+	if (!dst) {
+		etna_bo_del(etnaviv->conn, bo, NULL);
+		return NULL;
+	}
 
-	/* If we overflow, fallback.  We could do better here. */
-	if (sz / nclip != sizeof(BoxRec) * n)
-		return FALSE;
+	etna_bo_cpu_prep(bo, NULL, DRM_ETNA_PREP_WRITE);
+	etnaviv_mono_copy(dst, *pitch, bits, stride, bytes, h);
+	etna_bo_cpu_fini(bo);
 
-	boxes = malloc(sz);
-	if (!boxes)
-		return FALSE;
+	return bo;
+}
 
-	prefetch(ppt);
-	prefetch(ppt + 8);
-	prefetch(pwidth);
-	prefetch(pwidth + 8);
+/* Free a mono buffer once the GPU has finished with it */
+static void etnaviv_mono_free(struct etnaviv *etnaviv, struct etna_bo *bo)
+{
+	struct etnaviv_usermem_node *unode;
 
-	b = boxes;
+	unode = calloc(1, sizeof(*unode));
+	if (!unode) {
+		etnaviv_commit(etnaviv, TRUE);
+		etna_bo_del(etnaviv->conn, bo, NULL);
+		return;
+	}
 
-	while (n--) {
-		BoxPtr pBox;
-		int nBox, x, y, w;
+	unode->bo = bo;
+	etnaviv_add_freemem(etnaviv, unode);
+}
 
-		prefetch(ppt + 16);
-		prefetch(pwidth + 16);
+static void etnaviv_mono_damage_destroy(DamagePtr damage, void *closure)
+{
+	struct etnaviv_mono_cache *mc = closure;
 
-		nBox = nclip;
-		pBox = RegionRects(clip);
-
-		y = ppt->y;
-		x = ppt->x;
-		w = *pwidth++;
-
-		do {
-			if (pBox->y1 <= y && pBox->y2 > y) {
-				int l, r;
-
-				l = x;
-				if (l < pBox->x1)
-					l = pBox->x1;
-				r = x + w;
-				if (r > pBox->x2)
-					r = pBox->x2;
-
-				if (l < r) {
-					b->x1 = l;
-					b->y1 = y;
-					b->x2 = r;
-					b->y2 = y;
-					b++;
-				}
-			}
-			pBox++;
-		} while (--nBox);
-		ppt++;
+	mc->damage = NULL;
+}
+
+static void etnaviv_mono_release(struct etnaviv *etnaviv,
+	struct etnaviv_mono_cache *mc)
+{
+	if (mc->damage) {
+		DamagePtr damage = mc->damage;
+
+		mc->damage = NULL;
+		etnaviv_DamageUnregister(&mc->pixmap->drawable, damage);
+		DamageDestroy(damage);
 	}
+	if (mc->bo)
+		etnaviv_mono_free(etnaviv, mc->bo);
+	memset(mc, 0, sizeof(*mc));
+}
 
-	if (b != boxes) {
-		etnaviv_batch_start(etnaviv, &op);
-		etnaviv_de_op(etnaviv, &op, boxes, b - boxes);
-		etnaviv_de_end(etnaviv);
+static struct etnaviv_mono_cache *etnaviv_mono_lookup(
+	struct etnaviv *etnaviv, PixmapPtr pix)
+{
+	struct etnaviv_mono_cache *mc, *victim = NULL;
+	DamagePtr damage;
+	unsigned i;
+
+	/*
+	 * An entry remains valid while its pixmap is undamaged.  Once
+	 * damaged, it is replaced by the new upload.
+	 */
+	for (i = 0; i < ARRAY_SIZE(etnaviv->mono_cache); i++) {
+		mc = &etnaviv->mono_cache[i];
+		if (!mc->bo || !mc->damage || mc->pixmap != pix ||
+		    mc->serial != pix->drawable.serialNumber)
+			continue;
+
+		if (!RegionNotEmpty(DamageRegion(mc->damage)) &&
+		    (!mc->external || mc->gen == etnaviv->mono_gen))
+			return mc;
+
+		victim = mc;
+		break;
 	}
 
-	free(boxes);
+	if (!victim) {
+		i = etnaviv->mono_cache_next++ %
+			ARRAY_SIZE(etnaviv->mono_cache);
+		victim = &etnaviv->mono_cache[i];
+	}
+	etnaviv_mono_release(etnaviv, victim);
+
+	damage = DamageCreate(NULL, etnaviv_mono_damage_destroy,
+			      DamageReportNone, TRUE, pix->drawable.pScreen,
+			      victim);
+	if (!damage)
+		return NULL;
+
+	DamageRegister(&pix->drawable, damage);
+
+	victim->pixmap = pix;
+	victim->damage = damage;
+
+	prepare_cpu_drawable(&pix->drawable, CPU_ACCESS_RO);
+	victim->bo = etnaviv_mono_alloc(etnaviv, pix->devPrivate.ptr,
+					pix->devKind, pix->drawable.width,
+					pix->drawable.height, &victim->pitch);
+	finish_cpu_drawable(&pix->drawable, CPU_ACCESS_RO);
+	if (!victim->bo) {
+		etnaviv_mono_release(etnaviv, victim);
+		return NULL;
+	}
 
-	return TRUE;
+	victim->serial = pix->drawable.serialNumber;
+	victim->external = etnaviv_pixmap_external(pix);
+	victim->gen = etnaviv->mono_gen;
+
+	return victim;
 }
 
-Bool etnaviv_accel_PutImage(DrawablePtr pDrawable, GCPtr pGC, int depth,
-	int x, int y, int w, int h, int leftPad, int format, char *bits)
+/*
+ * Set up an operation to expand a mono source.  Transparent expansion
+ * leaves the destination alone where the source is clear.
+ */
+static void etnaviv_init_mono(struct etnaviv *etnaviv,
+	struct etnaviv_de_op *op, GCPtr pGC, struct etna_bo *bo,
+	unsigned pitch, unsigned w, unsigned h, Bool opaque)
 {
-	ScreenPtr pScreen = pDrawable->pScreen;
-	struct etnaviv_pixmap *vPix;
-	PixmapPtr pPix, pTemp;
-	GCPtr gc;
+	struct etnaviv_format fmt = { .format = DE_FORMAT_MONOCHROME, };
 
-	if (format != ZPixmap)
-		return FALSE;
+	op->src = INIT_BLIT_BUF(fmt, NULL, bo, pitch, ZERO_OFFSET, w, h,
+				DE_ROT_MODE_ROT0);
+	op->blend_op = NULL;
+	op->rop = etnaviv_copy_rop[pGC->alu];
+	op->bg_rop = opaque ? op->rop : 0xaa;
+	op->cmd = VIVS_DE_DEST_CONFIG_COMMAND_BIT_BLT;
+	op->brush = BRUSH_NONE;
+	op->fg_colour = etnaviv_pixel_col(etnaviv, pGC->depth, pGC->fgPixel);
+	op->bg_colour = etnaviv_pixel_col(etnaviv, pGC->depth, pGC->bgPixel);
+}
 
-	pPix = drawable_pixmap(pDrawable);
-	vPix = etnaviv_get_pixmap_priv(pPix);
-	if (!(vPix->state & ST_GPU_RW))
-		return FALSE;
+/* Expand the mono source over the region, which is in screen coordinates */
+static void etnaviv_mono_region(struct etnaviv *etnaviv,
+	struct etnaviv_de_op *op, RegionPtr region)
+{
+	int nbox = RegionNumRects(region);
 
-	pTemp = pScreen->CreatePixmap(pScreen, w, h, pPix->drawable.depth,
-				      CREATE_PIXMAP_USAGE_GPU);
-	if (!pTemp)
-		return FALSE;
+	if (!nbox)
+		return;
 
-	gc = GetScratchGC(pTemp->drawable.depth, pScreen);
-	if (!gc) {
-		pScreen->DestroyPixmap(pTemp);
-		return FALSE;
+	op->clip = RegionExtents(region);
+	op->src_origin_mode = SRC_ORIGIN_RELATIVE;
+
+	etnaviv_batch_start(etnaviv, op);
+	etnaviv_de_op(etnaviv, op, RegionRects(region), nbox);
+	etnaviv_de_end(etnaviv);
+}
+
+/*
+ * Collect boxes for an operation which has been started, clipping them
+ * to the clip region, and emit them in as few draws as possible.
+ */
+struct etnaviv_box_batch {
+	struct etnaviv *etnaviv;
+	const struct etnaviv_de_op *op;
+	const struct etnaviv_fill_passes *passes;
+	RegionPtr clip;
+	const BoxRec *hint;
+	unsigned int n;
+	BoxRec box[VIVANTE_MAX_2D_RECTS];
+};
+
+static void etnaviv_box_batch_init(struct etnaviv_box_batch *bb,
+	struct etnaviv *etnaviv, const struct etnaviv_de_op *op,
+	const struct etnaviv_fill_passes *passes, RegionPtr clip)
+{
+	bb->etnaviv = etnaviv;
+	bb->op = op;
+	bb->passes = passes;
+	bb->clip = clip;
+	bb->hint = NULL;
+	bb->n = 0;
+}
+
+static void etnaviv_box_batch_flush(struct etnaviv_box_batch *bb)
+{
+	if (bb->n) {
+		etnaviv_de_op_fill(bb->etnaviv, bb->op, bb->passes, bb->box,
+				   bb->n);
+		bb->n = 0;
 	}
+}
 
-	ValidateGC(&pTemp->drawable, gc);
-	unaccel_PutImage(&pTemp->drawable, gc, depth, 0, 0, w, h, leftPad,
-			 format, bits);
-	FreeScratchGC(gc);
+static void etnaviv_box_batch_add(struct etnaviv_box_batch *bb,
+	int x1, int y1, int x2, int y2)
+{
+	const BoxRec *ext = RegionExtents(bb->clip);
+	struct region_clip_iter it;
+	BoxRec rect;
+
+	if (x1 < ext->x1)
+		x1 = ext->x1;
+	if (y1 < ext->y1)
+		y1 = ext->y1;
+	if (x2 > ext->x2)
+		x2 = ext->x2;
+	if (y2 > ext->y2)
+		y2 = ext->y2;
+	if (x1 >= x2 || y1 >= y2)
+		return;
 
-	pGC->ops->CopyArea(&pTemp->drawable, pDrawable, pGC,
-			   0, 0, w, h, x, y);
-	pScreen->DestroyPixmap(pTemp);
-	return TRUE;
+	rect.x1 = x1;
+	rect.y1 = y1;
+	rect.x2 = x2;
+	rect.y2 = y2;
+
+	if (RegionNumRects(bb->clip) == 1) {
+		bb->box[bb->n] = rect;
+		if (++bb->n >= ARRAY_SIZE(bb->box))
+			etnaviv_box_batch_flush(bb);
+		return;
+	}
+
+	bb->hint = region_clip_iter_init(&it, bb->clip, &rect, bb->hint);
+	while (region_clip_iter_next(&it, &bb->box[bb->n]))
+		if (++bb->n >= ARRAY_SIZE(bb->box))
+			etnaviv_box_batch_flush(bb);
 }
 
-Bool etnaviv_accel_GetImage(DrawablePtr pDrawable, int x, int y, int w, int h,
-	unsigned int format, unsigned long planeMask, char *d)
+/*
+ * Span accumulation.  mi draws arcs, polygons and wide lines by calling
+ * FillSpans many times with a few spans each.  Between span_begin() and
+ * span_end(), spans for the same drawable and fill are collected, and
+ * drawn together as one operation.  Any other drawing, whether by the
+ * GPU or the CPU, flushes the collected spans first to keep ordering.
+ */
+static Bool etnaviv_span_reserve(struct etnaviv_span_acc *acc,
+	unsigned int n)
 {
-	ScreenPtr pScreen = pDrawable->pScreen;
-	struct etnaviv_pixmap *vPix;
-	PixmapPtr pPix, pTemp;
-	GCPtr gc;
-	xPoint src_offset;
+	unsigned int size;
+	BoxPtr box;
 
-	pPix = drawable_pixmap_offset(pDrawable, &src_offset);
-	vPix = etnaviv_get_pixmap_priv(pPix);
-	if (!vPix || !(vPix->state & ST_GPU_R))
-		return FALSE;
+	if (acc->size - acc->n >= n)
+		return TRUE;
 
-	x += pDrawable->x + src_offset.x;
-	y += pDrawable->y + src_offset.y;
+	size = acc->size ? acc->size : VIVANTE_MAX_2D_RECTS;
+	while (size - acc->n < n)
+		size *= 2;
 
-	pTemp = pScreen->CreatePixmap(pScreen, w, h, pPix->drawable.depth,
-				      CREATE_PIXMAP_USAGE_GPU);
-	if (!pTemp)
+	box = realloc(acc->box, size * sizeof(*box));
+	if (!box)
 		return FALSE;
 
-	/*
-	 * Copy to the temporary pixmap first using the GPU so that the
-	 * source pixmap stays on the GPU.
-	 */
-	gc = GetScratchGC(pTemp->drawable.depth, pScreen);
-	if (!gc) {
-		pScreen->DestroyPixmap(pTemp);
-		return FALSE;
+	acc->box = box;
+	acc->size = size;
+
+	return TRUE;
+}
+
+/* Prepare to collect spans for this drawable and GC */
+static Bool etnaviv_span_init(struct etnaviv *etnaviv,
+	DrawablePtr pDrawable, GCPtr pGC)
+{
+	struct etnaviv_span_acc *acc = &etnaviv->span;
+	RegionPtr clip = fbGetCompositeClip(pGC);
+
+	if (acc->n) {
+		if (acc->drawable == pDrawable && acc->gc == pGC &&
+		    acc->clip == clip && acc->alu == pGC->alu &&
+		    acc->planemask == pGC->planemask &&
+		    acc->fg == etnaviv_fg_pixel(pGC))
+			return TRUE;
+
+		etnaviv_span_flush(etnaviv);
 	}
 
-	ValidateGC(&pTemp->drawable, gc);
-	gc->ops->CopyArea(&pPix->drawable, &pTemp->drawable, gc,
-			  x, y, w, h, 0, 0);
-	FreeScratchGC(gc);
+	if (!etnaviv_init_dst_drawable(etnaviv, &acc->op, pDrawable))
+		return FALSE;
 
-	unaccel_GetImage(&pTemp->drawable, 0, 0, w, h, format, planeMask, d);
+	etnaviv_init_fill(etnaviv, &acc->op, &acc->passes, pGC);
+	acc->op.cmd = VIVS_DE_DEST_CONFIG_COMMAND_BIT_BLT;
+	acc->drawable = pDrawable;
+	acc->gc = pGC;
+	acc->clip = clip;
+	acc->alu = pGC->alu;
+	acc->planemask = pGC->planemask;
+	acc->fg = etnaviv_fg_pixel(pGC);
 
-	pScreen->DestroyPixmap(pTemp);
 	return TRUE;
 }
 
-void etnaviv_accel_CopyNtoN(DrawablePtr pSrc, DrawablePtr pDst,
-	GCPtr pGC, BoxPtr pBox, int nBox, int dx, int dy, Bool reverse,
-	Bool upsidedown, Pixel bitPlane, void *closure)
+/*
+ * Add a box, clipped to the clip extents.  Boxes which continue the
+ * previous box downwards are merged with it, but not past 'first'.
+ */
+static void etnaviv_span_add(struct etnaviv *etnaviv, unsigned int first,
+	int x1, int y1, int x2, int y2)
 {
-	struct etnaviv *etnaviv = etnaviv_get_screen_priv(pDst->pScreen);
-	struct etnaviv_de_op op;
-	BoxRec extent, *clip;
-
-	if (!nBox)
+	struct etnaviv_span_acc *acc = &etnaviv->span;
+	const BoxRec *ext = RegionExtents(acc->clip);
+	BoxPtr box;
+
+	if (x1 < ext->x1)
+		x1 = ext->x1;
+	if (y1 < ext->y1)
+		y1 = ext->y1;
+	if (x2 > ext->x2)
+		x2 = ext->x2;
+	if (y2 > ext->y2)
+		y2 = ext->y2;
+	if (x1 >= x2 || y1 >= y2)
 		return;
 
-	if (etnaviv->force_fallback)
-		goto fallback;
+	if (acc->n > first) {
+		box = &acc->box[acc->n - 1];
+		if (box->x1 == x1 && box->x2 == x2 && box->y2 == y1) {
+			box->y2 = y2;
+			return;
+		}
+	}
+
+	if (!etnaviv_span_reserve(acc, 1)) {
+		etnaviv_span_flush(etnaviv);
+		if (!acc->size)
+			return;
+	}
+
+	box = &acc->box[acc->n++];
+	box->x1 = x1;
+	box->y1 = y1;
+	box->x2 = x2;
+	box->y2 = y2;
+}
+
+void etnaviv_span_flush(struct etnaviv *etnaviv)
+{
+	struct etnaviv_span_acc *acc = &etnaviv->span;
+	struct etnaviv_box_batch bb;
+	unsigned int i;
+
+	if (!acc->n || acc->flushing)
+		return;
+
+	acc->flushing = TRUE;
+	acc->op.clip = RegionExtents(acc->clip);
+
+	etnaviv_batch_start(etnaviv, &acc->op);
+
+	if (RegionNumRects(acc->clip) == 1) {
+		/* Already clipped to the extents */
+		etnaviv_de_op_fill(etnaviv, &acc->op, &acc->passes, acc->box,
+				   acc->n);
+	} else {
+		etnaviv_box_batch_init(&bb, etnaviv, &acc->op, &acc->passes,
+				       acc->clip);
+		for (i = 0; i < acc->n; i++)
+			etnaviv_box_batch_add(&bb, acc->box[i].x1,
+					      acc->box[i].y1, acc->box[i].x2,
+					      acc->box[i].y2);
+		etnaviv_box_batch_flush(&bb);
+	}
+
+	etnaviv_de_end(etnaviv);
+
+#ifdef DEBUG_SPANS
+	acc->draws += acc->n;
+	acc->submits++;
+#endif
+	acc->n = 0;
+	acc->flushing = FALSE;
+}
+
+void etnaviv_span_begin(struct etnaviv *etnaviv)
+{
+	etnaviv->span.depth++;
+}
+
+void etnaviv_span_end(struct etnaviv *etnaviv)
+{
+	struct etnaviv_span_acc *acc = &etnaviv->span;
+
+	if (--acc->depth)
+		return;
+
+	etnaviv_span_flush(etnaviv);
+
+#ifdef DEBUG_SPANS
+	if (acc->spans)
+		dbg("spans: %u spans, %u draws, %u submits\n",
+		    acc->spans, acc->draws, acc->submits);
+	acc->spans = acc->draws = acc->submits = 0;
+#endif
+}
+
+/*
+ * Composite queue.  Compositing managers and toolkits issue long runs of
+ * composites from one source to one destination with the same operator.
+ * Rather than drawing each with its own state setup and pipeline flush,
+ * the final blends are collected here and drawn together.  Boxes are
+ * held in destination pixmap coordinates, each with its source offset.
+ * If every box shares the same offset and none overlap, they are drawn
+ * with one relative-origin operation; otherwise each box is drawn with
+ * its own source origin.  A blend overlapping the queue draws the queue
+ * first, as it must read what that writes.  Any other GPU operation, CPU
+ * access or commit flushes the queue first.
+ */
+static Bool etnaviv_composite_reserve(struct etnaviv_composite_acc *acc,
+	unsigned int n)
+{
+	unsigned int size;
+	xPoint *origin;
+	BoxPtr box;
+
+	if (acc->size - acc->n >= n)
+		return TRUE;
+
+	size = acc->size ? acc->size : VIVANTE_MAX_2D_RECTS;
+	while (size - acc->n < n)
+		size *= 2;
+
+	box = realloc(acc->box, size * sizeof(*box));
+	if (!box)
+		return FALSE;
+	acc->box = box;
+
+	origin = realloc(acc->origin, size * sizeof(*origin));
+	if (!origin)
+		return FALSE;
+	acc->origin = origin;
+
+	acc->size = size;
+
+	return TRUE;
+}
+
+static Bool etnaviv_composite_compatible(struct etnaviv_composite_acc *acc,
+	const struct etnaviv_de_op *op)
+{
+	if (op->blend_op ? !acc->op.blend_op ||
+	    memcmp(&acc->blend, op->blend_op, sizeof(acc->blend)) :
+	    acc->op.blend_op != NULL)
+		return FALSE;
+
+	return acc->op.dst.pixmap == op->dst.pixmap &&
+	       acc->op.dst.bo == op->dst.bo &&
+	       acc->op.src.pixmap == op->src.pixmap &&
+	       acc->op.src.bo == op->src.bo &&
+	       acc->op.src.rotate == op->src.rotate &&
+	       acc->op.rop == op->rop &&
+	       acc->op.brush == op->brush &&
+	       (op->brush != BRUSH_SOLID ||
+		acc->op.fg_colour == op->fg_colour) &&
+	       memcmp(&acc->op.dst.format, &op->dst.format,
+		      sizeof(op->dst.format)) == 0 &&
+	       memcmp(&acc->op.src.format, &op->src.format,
+		      sizeof(op->src.format)) == 0;
+}
+
+void etnaviv_composite_queue(struct etnaviv *etnaviv,
+	const struct etnaviv_de_op *op, const BoxRec *pBox, unsigned int nBox)
+{
+	struct etnaviv_composite_acc *acc = &etnaviv->composite;
+	xPoint offset = op->dst.offset;
+	Bool relative;
+	BoxRec clip;
+	unsigned int i;
+
+	/* Reading the destination needs the earlier blends to complete */
+	if (op->src.pixmap == op->dst.pixmap) {
+		etnaviv_batch_start(etnaviv, op);
+		etnaviv_de_op(etnaviv, op, pBox, nBox);
+		etnaviv_de_end(etnaviv);
+		return;
+	}
+
+	clip.x1 = op->clip->x1 + offset.x;
+	clip.y1 = op->clip->y1 + offset.y;
+	clip.x2 = op->clip->x2 + offset.x;
+	clip.y2 = op->clip->y2 + offset.y;
+
+	if (acc->n && !etnaviv_composite_compatible(acc, op))
+		etnaviv_composite_flush(etnaviv);
+
+	/*
+	 * A blend reads the destination, so must not be drawn in the same
+	 * batch as queued composites it overlaps; draw those first.
+	 */
+	if (acc->n && op->blend_op) {
+		BoxRec overlap;
+
+		if (!__box_intersect(&overlap, &clip, &acc->clip))
+			etnaviv_composite_flush(etnaviv);
+	}
+
+	relative = TRUE;
+	if (acc->n) {
+		relative = acc->relative &&
+			   acc->origin[0].x == op->src.offset.x &&
+			   acc->origin[0].y == op->src.offset.y &&
+			   (clip.x1 >= acc->clip.x2 || clip.x2 <= acc->clip.x1 ||
+			    clip.y1 >= acc->clip.y2 || clip.y2 <= acc->clip.y1);
+
+		/*
+		 * Per-box source origins are only used without rotation,
+		 * and brush fills have no source origin to set.
+		 */
+		if (!relative && (!op->src.pixmap ||
+				  op->src.rotate != DE_ROT_MODE_ROT0)) {
+			etnaviv_composite_flush(etnaviv);
+			relative = TRUE;
+		}
+	}
+
+	if (!etnaviv_composite_reserve(acc, nBox)) {
+		etnaviv_composite_flush(etnaviv);
+		etnaviv_batch_start(etnaviv, op);
+		etnaviv_de_op(etnaviv, op, pBox, nBox);
+		etnaviv_de_end(etnaviv);
+		return;
+	}
+
+	if (acc->n == 0) {
+		acc->op = *op;
+		acc->op.dst.offset = ZERO_OFFSET;
+		if (op->blend_op) {
+			acc->blend = *op->blend_op;
+			acc->op.blend_op = &acc->blend;
+		}
+		acc->clip = clip;
+	} else {
+		acc->clip.x1 = min_t(int, acc->clip.x1, clip.x1);
+		acc->clip.y1 = min_t(int, acc->clip.y1, clip.y1);
+		acc->clip.x2 = max_t(int, acc->clip.x2, clip.x2);
+		acc->clip.y2 = max_t(int, acc->clip.y2, clip.y2);
+	}
+	acc->relative = relative;
+
+	/*
+	 * Fence the pixmaps now: their owners may destroy them before
+	 * the queue is drawn, and the fences keep them alive until then.
+	 */
+	if (op->src.pixmap)
+		etnaviv_batch_add(etnaviv, op->src.pixmap);
+	etnaviv_batch_add(etnaviv, op->dst.pixmap);
+
+	for (i = 0; i < nBox; i++) {
+		BoxPtr box = &acc->box[acc->n];
+
+		box->x1 = pBox[i].x1 + offset.x;
+		box->y1 = pBox[i].y1 + offset.y;
+		box->x2 = pBox[i].x2 + offset.x;
+		box->y2 = pBox[i].y2 + offset.y;
+		acc->origin[acc->n++] = op->src.offset;
+	}
+
+#ifdef DEBUG_COMPOSITE
+	acc->composites++;
+#endif
+}
+
+void etnaviv_composite_flush(struct etnaviv *etnaviv)
+{
+	struct etnaviv_composite_acc *acc = &etnaviv->composite;
+	struct etnaviv_de_op *op = &acc->op;
+	unsigned int i;
+
+	if (!acc->n || acc->flushing)
+		return;
+
+	acc->flushing = TRUE;
+	op->clip = &acc->clip;
+
+	if (acc->relative) {
+		op->src_origin_mode = SRC_ORIGIN_RELATIVE;
+		op->src.offset = acc->origin[0];
+
+		etnaviv_batch_start(etnaviv, op);
+		etnaviv_de_op(etnaviv, op, acc->box, acc->n);
+	} else {
+		op->src_origin_mode = SRC_ORIGIN_NONE;
+		op->src.offset = ZERO_OFFSET;
+
+		etnaviv_batch_start(etnaviv, op);
+		for (i = 0; i < acc->n; i++) {
+			xPoint origin;
+
+			origin.x = acc->box[i].x1 + acc->origin[i].x;
+			origin.y = acc->box[i].y1 + acc->origin[i].y;
+
+			etnaviv_de_op_src_origin(etnaviv, op, origin,
+						 &acc->box[i]);
+		}
+	}
+	etnaviv_de_end(etnaviv);
+
+#ifdef DEBUG_COMPOSITE
+	dbg("composite: %u composites, %u boxes, %u draws\n",
+	    acc->composites, acc->n, acc->relative ?
+	    (acc->n + VIVANTE_MAX_2D_RECTS - 1) / VIVANTE_MAX_2D_RECTS :
+	    acc->n);
+	acc->composites = 0;
+#endif
+	acc->n = 0;
+	acc->flushing = FALSE;
+}
+
+Bool etnaviv_accel_FillSpans(DrawablePtr pDrawable, GCPtr pGC, int n,
+	DDXPointPtr ppt, int *pwidth, int fSorted)
+{
+	struct etnaviv *etnaviv = etnaviv_get_screen_priv(pDrawable->pScreen);
+	RegionPtr clip = fbGetCompositeClip(pGC);
+	unsigned int first;
+
+	assert(pGC->miTranslate);
+
+	if (RegionNumRects(clip) == 0)
+		return TRUE;
+
+	if (!etnaviv_span_init(etnaviv, pDrawable, pGC))
+		return FALSE;
+
+	/* mi's spans for one call do not overlap, so may be merged */
+	first = etnaviv->span.n;
+	etnaviv_span_reserve(&etnaviv->span, n);
+
+	prefetch(ppt);
+	prefetch(pwidth);
+
+	while (n--) {
+		prefetch(ppt + 16);
+		prefetch(pwidth + 16);
+
+		if (*pwidth > 0)
+			etnaviv_span_add(etnaviv, first, ppt->x, ppt->y,
+					 ppt->x + *pwidth, ppt->y + 1);
+		ppt++;
+		pwidth++;
+	}
+
+#ifdef DEBUG_SPANS
+	etnaviv->span.spans += etnaviv->span.n - first;
+#endif
+
+	if (!etnaviv->span.depth)
+		etnaviv_span_flush(etnaviv);
+
+	return TRUE;
+}
+
+/* As mi's BRESINITPGON and BRESINCRPGON, for exactly the same edges */
+struct etnaviv_poly_edge {
+	int x, d, m, m1, incr1, incr2;
+};
+
+static void etnaviv_poly_edge_init(struct etnaviv_poly_edge *e, int dy,
+	int x1, int x2)
+{
+	int dx;
+
+	/* Horizontal edges are skipped */
+	if (dy == 0)
+		return;
+
+	e->x = x1;
+	dx = x2 - x1;
+	e->m = dx / dy;
+	if (dx < 0) {
+		e->m1 = e->m - 1;
+		e->incr1 = -2 * dx + 2 * dy * e->m1;
+		e->incr2 = -2 * dx + 2 * dy * e->m;
+		e->d = 2 * e->m * dy - 2 * dx - 2 * dy;
+	} else {
+		e->m1 = e->m + 1;
+		e->incr1 = 2 * dx - 2 * dy * e->m1;
+		e->incr2 = 2 * dx - 2 * dy * e->m;
+		e->d = -2 * e->m * dy + 2 * dx;
+	}
+}
+
+static void etnaviv_poly_edge_step(struct etnaviv_poly_edge *e)
+{
+	if (e->m1 > 0 ? e->d > 0 : e->d >= 0) {
+		e->x += e->m1;
+		e->d += e->incr1;
+	} else {
+		e->x += e->m;
+		e->d += e->incr2;
+	}
+}
+
+/*
+ * Convex polygons are rasterised directly into the span accumulator,
+ * stepping the left and right edges in the same way as mi so that the
+ * same pixels are filled.
+ */
+Bool etnaviv_accel_FillPolygon(DrawablePtr pDrawable, GCPtr pGC,
+	int shape, int mode, int count, DDXPointPtr pPts)
+{
+	struct etnaviv *etnaviv = etnaviv_get_screen_priv(pDrawable->pScreen);
+	struct etnaviv_poly_edge l = { 0 }, r = { 0 };
+	int i, imin, ymin, ymax, y, left, right;
+	unsigned int first;
+
+	assert(pGC->miTranslate);
+
+	if (shape != Convex)
+		return FALSE;
+
+	if (count < 3 || RegionNumRects(fbGetCompositeClip(pGC)) == 0)
+		return TRUE;
+
+	if (!etnaviv_span_init(etnaviv, pDrawable, pGC))
+		return FALSE;
+
+	/* Translate the points to screen coordinates as mi would */
+	pPts[0].x += pDrawable->x;
+	pPts[0].y += pDrawable->y;
+	for (i = 1; i < count; i++) {
+		if (mode == CoordModePrevious) {
+			pPts[i].x += pPts[i - 1].x;
+			pPts[i].y += pPts[i - 1].y;
+		} else {
+			pPts[i].x += pDrawable->x;
+			pPts[i].y += pDrawable->y;
+		}
+	}
+
+	imin = 0;
+	ymin = ymax = pPts[0].y;
+	for (i = 1; i < count; i++) {
+		if (pPts[i].y < ymin) {
+			ymin = pPts[i].y;
+			imin = i;
+		}
+		if (pPts[i].y > ymax)
+			ymax = pPts[i].y;
+	}
+
+	if (ymin == ymax)
+		return TRUE;
+
+	/* The whole polygon is discarded if it turns out not to be convex */
+	if (!etnaviv_span_reserve(&etnaviv->span, ymax - ymin + 1))
+		etnaviv_span_flush(etnaviv);
+	first = etnaviv->span.n;
+
+	left = right = imin;
+	y = ymin;
+	do {
+		int next;
+
+		while (pPts[left].y == y) {
+			next = left + 1 >= count ? 0 : left + 1;
+			etnaviv_poly_edge_init(&l, pPts[next].y - pPts[left].y,
+					       pPts[left].x, pPts[next].x);
+			left = next;
+		}
+
+		while (pPts[right].y == y) {
+			next = right - 1 < 0 ? count - 1 : right - 1;
+			etnaviv_poly_edge_init(&r, pPts[next].y - pPts[right].y,
+					       pPts[right].x, pPts[next].x);
+			right = next;
+		}
+
+		i = mint(pPts[left].y, pPts[right].y) - y;
+		if (i < 0) {
+			etnaviv->span.n = first;
+			return TRUE;
+		}
+
+		while (i-- > 0) {
+			etnaviv_span_add(etnaviv, first, mint(l.x, r.x), y,
+					 maxt(l.x, r.x), y + 1);
+			y++;
+			etnaviv_poly_edge_step(&l);
+			etnaviv_poly_edge_step(&r);
+		}
+	} while (y != ymax);
+
+	if (!etnaviv->span.depth)
+		etnaviv_span_flush(etnaviv);
+
+	return TRUE;
+}
+
+/* Full ellipses, with the same stepping as miFillEllipseI */
+static void etnaviv_fill_ellipse(struct etnaviv *etnaviv,
+	DrawablePtr pDrawable, xArc *arc)
+{
+	int x, y, e, yk, xk, ym, xm, dx, dy, xorg, yorg, slw;
+	unsigned int first = etnaviv->span.n;
+	miFillArcRec info;
+
+	miFillArcSetup(arc, &info);
+	MIFILLARCSETUP();
+	xorg += pDrawable->x;
+	yorg += pDrawable->y;
+
+	while (y > 0) {
+		MIFILLARCSTEP(slw);
+		etnaviv_span_add(etnaviv, first, xorg - x, yorg - y,
+				 xorg - x + slw, yorg - y + 1);
+		if (miFillArcLower(slw))
+			etnaviv_span_add(etnaviv, first, xorg - x,
+					 yorg + y + dy, xorg - x + slw,
+					 yorg + y + dy + 1);
+	}
+}
+
+Bool etnaviv_accel_PolyFillArc(DrawablePtr pDrawable, GCPtr pGC,
+	int narcs, xArc *parcs)
+{
+	struct etnaviv *etnaviv = etnaviv_get_screen_priv(pDrawable->pScreen);
+	int i;
+
+	assert(pGC->miTranslate);
+
+	if (RegionNumRects(fbGetCompositeClip(pGC)) == 0)
+		return TRUE;
+
+	etnaviv_span_begin(etnaviv);
+	for (i = 0; i < narcs; i++) {
+		xArc *arc = &parcs[i];
+
+		if (miFillArcEmpty(arc))
+			continue;
+
+		if ((arc->angle2 >= FULLCIRCLE || arc->angle2 <= -FULLCIRCLE) &&
+		    miCanFillArc(arc) &&
+		    etnaviv_span_init(etnaviv, pDrawable, pGC))
+			etnaviv_fill_ellipse(etnaviv, pDrawable, arc);
+		else
+			miPolyFillArc(pDrawable, pGC, 1, arc);
+	}
+	etnaviv_span_end(etnaviv);
+
+	return TRUE;
+}
+
+/* XYBitmap images are expanded to the GC foreground and background */
+static Bool etnaviv_accel_PutImageBitmap(DrawablePtr pDrawable, GCPtr pGC,
+	int x, int y, int w, int h, int leftPad, char *bits)
+{
+	struct etnaviv *etnaviv = etnaviv_get_screen_priv(pDrawable->pScreen);
+	struct etnaviv_de_op op;
+	struct etna_bo *bo;
+	RegionRec region;
+	unsigned pitch;
+	BoxRec box;
+
+	if (!etnaviv_init_dst_drawable(etnaviv, &op, pDrawable))
+		return FALSE;
+
+	bo = etnaviv_mono_alloc(etnaviv, (uint8_t *)bits,
+				BitmapBytePad(w + leftPad), w + leftPad, h,
+				&pitch);
+	if (!bo)
+		return FALSE;
+
+	x += pDrawable->x;
+	y += pDrawable->y;
+
+	etnaviv_init_mono(etnaviv, &op, pGC, bo, pitch, w + leftPad, h, TRUE);
+	op.src.offset.x = leftPad - x - op.dst.offset.x;
+	op.src.offset.y = -y - op.dst.offset.y;
+
+	box_init(&box, x, y, w, h);
+	RegionInit(&region, &box, 1);
+	RegionIntersect(&region, &region, fbGetCompositeClip(pGC));
+
+	etnaviv_mono_region(etnaviv, &op, &region);
+
+	RegionUninit(&region);
+
+	etnaviv_mono_free(etnaviv, bo);
+
+	return TRUE;
+}
+
+/*
+ * ZPixmap PutImage.  Large images whose rows are suitably aligned are
+ * blitted straight from the request buffer, mapped as a userptr buffer;
+ * we must wait for the blit before returning, as the request buffer is
+ * reused.  Small images are copied into the staging ring, which needs
+ * no new buffers and no wait.  Anything else is copied into a temporary
+ * GPU pixmap.  Below ETNAVIV_PUTIMAGE_USERPTR_MIN, the cost of setting
+ * up the mapping and waiting for the GPU outweighs the copy.
+ */
+#define ETNAVIV_PUTIMAGE_USERPTR_MIN	(64 * 1024)
+#define ETNAVIV_STAGING_SLOT_SIZE	(64 * 1024)
+
+static void etnaviv_putimage_blit(struct etnaviv *etnaviv,
+	struct etnaviv_de_op *op, GCPtr pGC, RegionPtr region,
+	struct etna_bo *bo, unsigned pitch, xPoint src)
+{
+	struct etnaviv_format fmt = op->dst.format;
+
+	fmt.tile = 0;
+
+	op->src = INIT_BLIT_BO(bo, pitch, fmt, src);
+	op->blend_op = NULL;
+	op->clip = RegionExtents(region);
+	op->src_origin_mode = SRC_ORIGIN_RELATIVE;
+	op->rop = etnaviv_copy_rop[pGC->alu];
+	op->cmd = VIVS_DE_DEST_CONFIG_COMMAND_BIT_BLT;
+	op->brush = BRUSH_NONE;
+
+	etnaviv_batch_start(etnaviv, op);
+	etnaviv_de_op(etnaviv, op, RegionRects(region), RegionNumRects(region));
+	etnaviv_de_end(etnaviv);
+}
+
+static Bool etnaviv_putimage_userptr(struct etnaviv *etnaviv,
+	struct etnaviv_de_op *op, GCPtr pGC, RegionPtr region,
+	int x, int y, unsigned cpp, unsigned stride, size_t size, char *bits)
+{
+	unsigned xoff = (uintptr_t)bits & VIVANTE_ALIGN_MASK;
+	struct etna_bo *usr;
+	xPoint src;
+
+	if (stride & 15 || xoff % cpp)
+		return FALSE;
+
+	usr = etna_bo_from_usermem_prot(etnaviv->conn, bits - xoff,
+					size + xoff, PROT_READ);
+	if (!usr)
+		return FALSE;
+
+	src.x = xoff / cpp - x - op->dst.offset.x;
+	src.y = -y - op->dst.offset.y;
+
+	etnaviv_putimage_blit(etnaviv, op, pGC, region, usr, stride, src);
+
+	etnaviv_commit(etnaviv, TRUE);
+	etna_bo_del(etnaviv->conn, usr, NULL);
+
+	return TRUE;
+}
+
+static Bool etnaviv_putimage_staging(struct etnaviv *etnaviv,
+	struct etnaviv_de_op *op, GCPtr pGC, RegionPtr region,
+	int x, int y, int w, int h, unsigned bpp, unsigned stride,
+	char *bits)
+{
+	struct etnaviv_ring *ring = &etnaviv->staging;
+	unsigned pitch = etnaviv_pitch(w, bpp);
+	unsigned i, bytes = w * bpp / 8;
+	ssize_t offset;
+	uint8_t *dst;
+	xPoint src;
+
+	if (!ring->bo &&
+	    !etnaviv_ring_init(etnaviv, ring, ETNAVIV_STAGING_SLOT_SIZE,
+			       DRM_ETNA_GEM_CACHE_WCOMBINE))
+		return FALSE;
+
+	/* The image starts on a row boundary of the staging buffer */
+	offset = etnaviv_ring_alloc(etnaviv, ring, pitch * h, pitch);
+	if (offset < 0)
+		return FALSE;
+
+	for (i = 0, dst = ring->ptr + offset; i < h; i++, dst += pitch)
+		memcpy(dst, bits + i * stride, bytes);
+
+	src.x = -x - op->dst.offset.x;
+	src.y = offset / pitch - y - op->dst.offset.y;
+
+	etnaviv_putimage_blit(etnaviv, op, pGC, region, ring->bo, pitch, src);
+
+	return TRUE;
+}
+
+Bool etnaviv_accel_PutImage(DrawablePtr pDrawable, GCPtr pGC, int depth,
+	int x, int y, int w, int h, int leftPad, int format, char *bits)
+{
+	struct etnaviv *etnaviv = etnaviv_get_screen_priv(pDrawable->pScreen);
+	ScreenPtr pScreen = pDrawable->pScreen;
+	struct etnaviv_pixmap *vPix;
+	struct etnaviv_de_op op;
+	PixmapPtr pPix, pTemp;
+	unsigned bpp, stride;
+	RegionRec region;
+	size_t size;
+	BoxRec box;
+	GCPtr gc;
+	Bool ret;
+
+	if (format == XYBitmap)
+		return etnaviv_accel_PutImageBitmap(pDrawable, pGC, x, y, w, h,
+						    leftPad, bits);
+
+	if (format != ZPixmap)
+		return FALSE;
+
+	pPix = drawable_pixmap(pDrawable);
+	vPix = etnaviv_get_pixmap_priv(pPix);
+	if (!(vPix->state & ST_GPU_RW))
+		return FALSE;
+
+	bpp = pDrawable->bitsPerPixel;
+	stride = PixmapBytePad(w, depth);
+	size = (size_t)stride * h;
+
+	if (bpp >= 8 && (size >= ETNAVIV_PUTIMAGE_USERPTR_MIN ||
+			  size <= ETNAVIV_STAGING_SLOT_SIZE / 2)) {
+		if (!etnaviv_init_dst_drawable(etnaviv, &op, pDrawable))
+			return FALSE;
+
+		x += pDrawable->x;
+		y += pDrawable->y;
+
+		box_init(&box, x, y, w, h);
+		RegionInit(&region, &box, 1);
+		RegionIntersect(&region, &region, fbGetCompositeClip(pGC));
+
+		if (!RegionNumRects(&region)) {
+			ret = TRUE;
+		} else if (size >= ETNAVIV_PUTIMAGE_USERPTR_MIN) {
+			ret = etnaviv_putimage_userptr(etnaviv, &op, pGC,
+						       &region, x, y, bpp / 8,
+						       stride, size, bits);
+		} else {
+			ret = etnaviv_putimage_staging(etnaviv, &op, pGC,
+						       &region, x, y, w, h,
+						       bpp, stride, bits);
+		}
+
+		RegionUninit(&region);
+
+		if (ret)
+			return TRUE;
+
+		x -= pDrawable->x;
+		y -= pDrawable->y;
+	}
+
+	pTemp = pScreen->CreatePixmap(pScreen, w, h, pPix->drawable.depth,
+				      CREATE_PIXMAP_USAGE_GPU);
+	if (!pTemp)
+		return FALSE;
+
+	gc = GetScratchGC(pTemp->drawable.depth, pScreen);
+	if (!gc) {
+		pScreen->DestroyPixmap(pTemp);
+		return FALSE;
+	}
+
+	ValidateGC(&pTemp->drawable, gc);
+	unaccel_PutImage(&pTemp->drawable, gc, depth, 0, 0, w, h, leftPad,
+			 format, bits);
+	FreeScratchGC(gc);
+
+	pGC->ops->CopyArea(&pTemp->drawable, pDrawable, pGC,
+			   0, 0, w, h, x, y);
+	pScreen->DestroyPixmap(pTemp);
+	return TRUE;
+}
+
+/*
+ * ZPixmap GetImage.  The GPU copies the area, masked by the planemask,
+ * either straight into the reply buffer through a userptr mapping, or
+ * into a slot of a cached readback ring from which the reply is then
+ * copied.  Only the fence for the slot is waited for.
+ */
+#define ETNAVIV_READBACK_SLOT_SIZE	(256 * 1024)
+
+static void etnaviv_getimage_blit(struct etnaviv *etnaviv,
+	struct etnaviv_de_op *op, int depth, unsigned long planeMask,
+	struct etna_bo *bo, unsigned pitch, const BoxRec *box, xPoint src)
+{
+	struct etnaviv_format fmt = op->src.format;
+
+	fmt.tile = 0;
+
+	op->dst = INIT_BLIT_BO(bo, pitch, fmt, ZERO_OFFSET);
+	op->src.offset = src;
+	op->blend_op = NULL;
+	op->clip = box;
+	op->src_origin_mode = SRC_ORIGIN_RELATIVE;
+	op->cmd = VIVS_DE_DEST_CONFIG_COMMAND_BIT_BLT;
+
+	if ((planeMask & FbFullMask(depth)) == FbFullMask(depth)) {
+		op->rop = etnaviv_copy_rop[GXcopy];
+		op->brush = BRUSH_NONE;
+	} else {
+		/* Source AND brush, with the planemask as the brush */
+		op->rop = 0xc0;
+		op->brush = BRUSH_SOLID;
+		op->fg_colour = etnaviv_pixel_col(etnaviv, depth, planeMask);
+	}
+
+	etnaviv_batch_start(etnaviv, op);
+	etnaviv_de_op(etnaviv, op, box, 1);
+	etnaviv_de_end(etnaviv);
+}
+
+static Bool etnaviv_getimage_userptr(struct etnaviv *etnaviv,
+	struct etnaviv_de_op *op, int depth, unsigned long planeMask,
+	int x, int y, int w, int h, unsigned cpp, unsigned stride,
+	size_t size, char *d)
+{
+	unsigned xoff = (uintptr_t)d & VIVANTE_ALIGN_MASK;
+	struct etna_bo *usr;
+	xPoint src;
+	BoxRec box;
+
+	if (stride & 15 || xoff % cpp)
+		return FALSE;
+
+	usr = etna_bo_from_usermem(etnaviv->conn, d - xoff, size + xoff);
+	if (!usr)
+		return FALSE;
+
+	box_init(&box, xoff / cpp, 0, w, h);
+	src.x = x - box.x1;
+	src.y = y;
+
+	etnaviv_getimage_blit(etnaviv, op, depth, planeMask, usr, stride,
+			      &box, src);
+	etnaviv_commit(etnaviv, TRUE);
+
+	etna_bo_cpu_prep(usr, NULL, DRM_ETNA_PREP_READ);
+	etna_bo_cpu_fini(usr);
+	etna_bo_del(etnaviv->conn, usr, NULL);
+
+	return TRUE;
+}
+
+static Bool etnaviv_getimage_readback(struct etnaviv *etnaviv,
+	struct etnaviv_de_op *op, int depth, unsigned long planeMask,
+	int x, int y, int w, int h, unsigned bpp, unsigned stride, char *d)
+{
+	struct etnaviv_ring *ring = &etnaviv->readback;
+	unsigned pitch = etnaviv_pitch(w, bpp);
+	unsigned i, bytes = w * bpp / 8;
+	const uint8_t *src_ptr;
+	unsigned int slot;
+	ssize_t offset;
+	xPoint src;
+	BoxRec box;
+
+	if (!ring->bo &&
+	    !etnaviv_ring_init(etnaviv, ring, ETNAVIV_READBACK_SLOT_SIZE,
+			       DRM_ETNA_GEM_CACHE_WBACK))
+		return FALSE;
+
+	offset = etnaviv_ring_alloc(etnaviv, ring, pitch * h, pitch);
+	if (offset < 0)
+		return FALSE;
+	slot = ring->slot;
+
+	box_init(&box, 0, offset / pitch, w, h);
+	src.x = x;
+	src.y = y - box.y1;
+
+	etnaviv_getimage_blit(etnaviv, op, depth, planeMask, ring->bo, pitch,
+			      &box, src);
+	etnaviv_fence_wait(etnaviv, &ring->fence[slot]);
+
+	etna_bo_cpu_prep(ring->bo, NULL, DRM_ETNA_PREP_READ);
+	for (i = 0, src_ptr = ring->ptr + offset; i < h;
+	     i++, src_ptr += pitch, d += stride)
+		memcpy(d, src_ptr, bytes);
+	etna_bo_cpu_fini(ring->bo);
+
+	return TRUE;
+}
+
+Bool etnaviv_accel_GetImage(DrawablePtr pDrawable, int x, int y, int w, int h,
+	unsigned int format, unsigned long planeMask, char *d)
+{
+	struct etnaviv *etnaviv = etnaviv_get_screen_priv(pDrawable->pScreen);
+	ScreenPtr pScreen = pDrawable->pScreen;
+	struct etnaviv_pixmap *vPix;
+	struct etnaviv_de_op op;
+	PixmapPtr pPix, pTemp;
+	unsigned bpp, stride;
+	GCPtr gc;
+	xPoint src_offset;
+	size_t size;
+
+	pPix = drawable_pixmap_offset(pDrawable, &src_offset);
+	vPix = etnaviv_get_pixmap_priv(pPix);
+	if (!vPix || !(vPix->state & ST_GPU_R))
+		return FALSE;
+
+	x += pDrawable->x + src_offset.x;
+	y += pDrawable->y + src_offset.y;
+
+	bpp = pDrawable->bitsPerPixel;
+	stride = PixmapBytePad(w, pDrawable->depth);
+	size = (size_t)stride * h;
+
+	if (format == ZPixmap && bpp >= 8 &&
+	    etnaviv_init_src_pixmap(etnaviv, &op, pPix) &&
+	    etnaviv_dst_format_valid(etnaviv, op.src.format)) {
+		if (size >= ETNAVIV_PUTIMAGE_USERPTR_MIN &&
+		    etnaviv_getimage_userptr(etnaviv, &op, pDrawable->depth,
+					     planeMask, x, y, w, h, bpp / 8,
+					     stride, size, d))
+			return TRUE;
+
+		if (etnaviv_getimage_readback(etnaviv, &op, pDrawable->depth,
+					      planeMask, x, y, w, h, bpp,
+					      stride, d))
+			return TRUE;
+	}
+
+	pTemp = pScreen->CreatePixmap(pScreen, w, h, pPix->drawable.depth,
+				      CREATE_PIXMAP_USAGE_GPU);
+	if (!pTemp)
+		return FALSE;
+
+	/*
+	 * Copy to the temporary pixmap first using the GPU so that the
+	 * source pixmap stays on the GPU.
+	 */
+	gc = GetScratchGC(pTemp->drawable.depth, pScreen);
+	if (!gc) {
+		pScreen->DestroyPixmap(pTemp);
+		return FALSE;
+	}
+
+	ValidateGC(&pTemp->drawable, gc);
+	gc->ops->CopyArea(&pPix->drawable, &pTemp->drawable, gc,
+			  x, y, w, h, 0, 0);
+	FreeScratchGC(gc);
+
+	unaccel_GetImage(&pTemp->drawable, 0, 0, w, h, format, planeMask, d);
+
+	pScreen->DestroyPixmap(pTemp);
+	return TRUE;
+}
+
+void etnaviv_accel_CopyNtoN(DrawablePtr pSrc, DrawablePtr pDst,
+	GCPtr pGC, BoxPtr pBox, int nBox, int dx, int dy, Bool reverse,
+	Bool upsidedown, Pixel bitPlane, void *closure)
+{
+	struct etnaviv *etnaviv = etnaviv_get_screen_priv(pDst->pScreen);
+	struct etnaviv_pixmap *vDst;
+	struct etnaviv_de_op op;
+	BoxRec extent, *clip;
+	uint8_t content;
+
+	if (!nBox)
+		return;
+
+	if (etnaviv->force_fallback)
+		goto fallback;
+
+	vDst = etnaviv_drawable(pDst);
+	content = vDst ? vDst->content : 0;
+
+	if (!etnaviv_init_dstsrc_drawable(etnaviv, &op, pDst, pSrc))
+		goto fallback;
+
+	/* Include the copy delta on the source */
+	op.src.offset.x += dx - op.dst.offset.x;
+	op.src.offset.y += dy - op.dst.offset.y;
+	op.src_origin_mode = SRC_ORIGIN_RELATIVE;
+
+	/* Calculate the overall extent */
+	extent.x1 = max_t(short, pDst->x, pSrc->x - dx);
+	extent.y1 = max_t(short, pDst->y, pSrc->y - dy);
+	extent.x2 = min_t(short, pDst->x + pDst->width,
+				 pSrc->x + pSrc->width - dx);
+	extent.y2 = min_t(short, pDst->y + pDst->height,
+				 pSrc->y + pSrc->height - dy);
+
+	if (pGC) {
+		clip = RegionExtents(fbGetCompositeClip(pGC));
+		if (__box_intersect(&extent, &extent, clip))
+			return;
+	} else {
+		if (extent.x1 < 0)
+			extent.x1 = 0;
+		if (extent.y1 < 0)
+			extent.y1 = 0;
+	}
+
+	op.blend_op = NULL;
+	op.clip = &extent;
+	op.rop = etnaviv_copy_rop[pGC ? pGC->alu : GXcopy];
+	op.cmd = VIVS_DE_DEST_CONFIG_COMMAND_BIT_BLT;
+	op.brush = BRUSH_NONE;
+
+	/*
+	 * With a partial planemask, use the planemask as the brush and
+	 * take the destination where the brush bits are clear.
+	 */
+	if (pGC && !fb_full_planemask(pDst, pGC->planemask)) {
+		op.rop = (op.rop & 0xf0) | (etnaviv_fill_rop[GXnoop] & 0x0f);
+		op.brush = BRUSH_SOLID;
+		op.fg_colour = etnaviv_pixel_col(etnaviv, pDst->depth,
+					pGC->planemask & FbFullMask(pDst->depth));
+	}
+
+	etnaviv_batch_start(etnaviv, &op);
+	etnaviv_blit_clipped(etnaviv, &op, pBox, nBox);
+	etnaviv_de_end(etnaviv);
+
+	/* Copying opaque pixels leaves an opaque pixmap opaque */
+	if (content & CT_OPAQUE && op.rop == 0xcc &&
+	    (op.src.pixmap == vDst || op.src.pixmap->content & CT_OPAQUE))
+		vDst->content = CT_OPAQUE;
+
+	return;
+
+ fallback:
+	unaccel_CopyNtoN(pSrc, pDst, pGC, pBox, nBox, dx, dy, reverse,
+		upsidedown, bitPlane, closure);
+}
+
+Bool etnaviv_accel_PolyPoint(DrawablePtr pDrawable, GCPtr pGC, int mode,
+	int npt, DDXPointPtr ppt)
+{
+	struct etnaviv *etnaviv = etnaviv_get_screen_priv(pDrawable->pScreen);
+	RegionPtr clip = fbGetCompositeClip(pGC);
+	struct etnaviv_fill_passes passes;
+	struct etnaviv_box_batch bb;
+	struct etnaviv_de_op op;
+	int i, x, y;
+
+	if (RegionNumRects(clip) == 0)
+		return TRUE;
+
+	if (!etnaviv_init_dst_drawable(etnaviv, &op, pDrawable))
+		return FALSE;
+
+	etnaviv_init_fill(etnaviv, &op, &passes, pGC);
+	op.clip = RegionExtents(clip);
+	op.cmd = VIVS_DE_DEST_CONFIG_COMMAND_BIT_BLT;
+
+	etnaviv_box_batch_init(&bb, etnaviv, &op, &passes, clip);
+	etnaviv_batch_start(etnaviv, &op);
+
+	x = pDrawable->x;
+	y = pDrawable->y;
+	for (i = 0; i < npt; i++) {
+		if (mode == CoordModePrevious) {
+			x += ppt[i].x;
+			y += ppt[i].y;
+		} else {
+			x = ppt[i].x + pDrawable->x;
+			y = ppt[i].y + pDrawable->y;
+		}
+
+		etnaviv_box_batch_add(&bb, x, y, x + 1, y + 1);
+	}
+
+	etnaviv_box_batch_flush(&bb);
+	etnaviv_de_end(etnaviv);
+
+	return TRUE;
+}
+
+/*
+ * Zero-width lines.  The line engine's choice of pixels for lines
+ * which fall exactly between two pixels does not follow the X server's
+ * octant bias, so we step the lines ourselves with the same Bresenham
+ * setup as fb and mi, and draw each run of pixels along the major axis
+ * as a rectangle.  Horizontal and vertical lines are a single run.
+ */
+static void etnaviv_zero_line(struct etnaviv_box_batch *bb,
+	int x1, int y1, int x2, int y2, unsigned int bias, Bool draw_last)
+{
+	int adx, ady, signdx, signdy, e, e1, e2, e3, len, octant;
+	Bool ymajor;
+
+	CalcLineDeltas(x1, y1, x2, y2, adx, ady, signdx, signdy, 1, 1, octant);
+
+	ymajor = adx <= ady;
+	if (!ymajor) {
+		e1 = ady << 1;
+		e2 = e1 - (adx << 1);
+		e = e1 - adx;
+		len = adx;
+	} else {
+		e1 = adx << 1;
+		e2 = e1 - (ady << 1);
+		e = e1 - ady;
+		len = ady;
+		SetYMajorOctant(octant);
+	}
+
+	FIXUP_ERROR(e, octant, bias);
+
+	/* Adjust the error terms to compare against zero */
+	e3 = e2 - e1;
+	e = e - e1;
+
+	if (draw_last)
+		len++;
+
+	while (len > 0) {
+		Bool minor = FALSE;
+		int n = 0;
+
+		if (e1 == 0) {
+			n = len;
+		} else {
+			do {
+				n++;
+				e += e1;
+				if (e >= 0) {
+					e += e3;
+					minor = TRUE;
+					break;
+				}
+			} while (n < len);
+		}
+		len -= n;
+
+		if (ymajor) {
+			int y = signdy > 0 ? y1 : y1 - n + 1;
+
+			etnaviv_box_batch_add(bb, x1, y, x1 + 1, y + n);
+			y1 += signdy * n;
+			if (minor)
+				x1 += signdx;
+		} else {
+			int x = signdx > 0 ? x1 : x1 - n + 1;
+
+			etnaviv_box_batch_add(bb, x, y1, x + n, y1 + 1);
+			x1 += signdx * n;
+			if (minor)
+				y1 += signdy;
+		}
+	}
+}
+
+static Bool etnaviv_box_overlaps(const BoxRec *box, int x1, int y1,
+	int x2, int y2)
+{
+	return box->x1 < x2 && box->x2 > x1 && box->y1 < y2 && box->y2 > y1;
+}
+
+Bool etnaviv_accel_PolyLines(DrawablePtr pDrawable, GCPtr pGC, int mode,
+	int npt, DDXPointPtr ppt)
+{
+	struct etnaviv *etnaviv = etnaviv_get_screen_priv(pDrawable->pScreen);
+	unsigned int bias = miGetZeroLineBias(pDrawable->pScreen);
+	struct etnaviv_fill_passes passes;
+	struct etnaviv_box_batch bb;
+	struct etnaviv_de_op op;
+	RegionPtr clip = fbGetCompositeClip(pGC);
+	int x1, y1, x2, y2, min_x, min_y, max_x, max_y;
+	Bool draw_last;
+	int i;
+
+	assert(pGC->miTranslate);
+
+	if (RegionNumRects(clip) == 0 || npt < 2)
+		return TRUE;
+
+	if (!etnaviv_init_dst_drawable(etnaviv, &op, pDrawable))
+		return FALSE;
+
+	etnaviv_init_fill(etnaviv, &op, &passes, pGC);
+	op.cmd = VIVS_DE_DEST_CONFIG_COMMAND_BIT_BLT;
+
+	/* Find the extent of the lines, and the final point */
+	min_x = max_x = x2 = ppt[0].x + pDrawable->x;
+	min_y = max_y = y2 = ppt[0].y + pDrawable->y;
+	for (i = 1; i < npt; i++) {
+		if (mode == CoordModePrevious) {
+			x2 += ppt[i].x;
+			y2 += ppt[i].y;
+		} else {
+			x2 = ppt[i].x + pDrawable->x;
+			y2 = ppt[i].y + pDrawable->y;
+		}
+		min_x = mint(min_x, x2);
+		max_x = maxt(max_x, x2);
+		min_y = mint(min_y, y2);
+		max_y = maxt(max_y, y2);
+	}
+
+	/*
+	 * As mi, the final point is not drawn if it closes the shape,
+	 * so that it is not drawn twice.
+	 */
+	draw_last = pGC->capStyle != CapNotLast &&
+		    (x2 != ppt[0].x + pDrawable->x ||
+		     y2 != ppt[0].y + pDrawable->y || npt == 2);
+
+	if (!etnaviv_box_overlaps(RegionExtents(clip), min_x, min_y,
+				  max_x + 1, max_y + 1))
+		return TRUE;
+
+	op.clip = RegionExtents(clip);
+	etnaviv_box_batch_init(&bb, etnaviv, &op, &passes, clip);
+	etnaviv_batch_start(etnaviv, &op);
+
+	x1 = ppt[0].x + pDrawable->x;
+	y1 = ppt[0].y + pDrawable->y;
+	for (i = 1; i < npt; i++) {
+		if (mode == CoordModePrevious) {
+			x2 = x1 + ppt[i].x;
+			y2 = y1 + ppt[i].y;
+		} else {
+			x2 = ppt[i].x + pDrawable->x;
+			y2 = ppt[i].y + pDrawable->y;
+		}
+
+		etnaviv_zero_line(&bb, x1, y1, x2, y2, bias,
+				  i == npt - 1 && draw_last);
+
+		x1 = x2;
+		y1 = y2;
+	}
+
+	etnaviv_box_batch_flush(&bb);
+	etnaviv_de_end(etnaviv);
+
+	return TRUE;
+}
+
+Bool etnaviv_accel_PolySegment(DrawablePtr pDrawable, GCPtr pGC, int nseg,
+	xSegment *pSeg)
+{
+	struct etnaviv *etnaviv = etnaviv_get_screen_priv(pDrawable->pScreen);
+	unsigned int bias = miGetZeroLineBias(pDrawable->pScreen);
+	struct etnaviv_fill_passes passes;
+	struct etnaviv_box_batch bb;
+	struct etnaviv_de_op op;
+	RegionPtr clip = fbGetCompositeClip(pGC);
+	const BoxRec *ext;
+	Bool draw_last;
+	int i;
 
-	if (!etnaviv_init_dstsrc_drawable(etnaviv, &op, pDst, pSrc))
+	assert(pGC->miTranslate);
+
+	if (RegionNumRects(clip) == 0)
+		return TRUE;
+
+	if (!etnaviv_init_dst_drawable(etnaviv, &op, pDrawable))
+		return FALSE;
+
+	etnaviv_init_fill(etnaviv, &op, &passes, pGC);
+	op.cmd = VIVS_DE_DEST_CONFIG_COMMAND_BIT_BLT;
+
+	draw_last = pGC->capStyle != CapNotLast;
+
+	ext = RegionExtents(clip);
+	op.clip = ext;
+	etnaviv_box_batch_init(&bb, etnaviv, &op, &passes, clip);
+	etnaviv_batch_start(etnaviv, &op);
+
+	for (i = 0; i < nseg; i++) {
+		int x1 = pSeg[i].x1 + pDrawable->x;
+		int y1 = pSeg[i].y1 + pDrawable->y;
+		int x2 = pSeg[i].x2 + pDrawable->x;
+		int y2 = pSeg[i].y2 + pDrawable->y;
+
+		if (!etnaviv_box_overlaps(ext, mint(x1, x2), mint(y1, y2),
+					  maxt(x1, x2) + 1, maxt(y1, y2) + 1))
+			continue;
+
+		etnaviv_zero_line(&bb, x1, y1, x2, y2, bias, draw_last);
+	}
+
+	etnaviv_box_batch_flush(&bb);
+	etnaviv_de_end(etnaviv);
+
+	return TRUE;
+}
+
+Bool etnaviv_accel_PolyFillRectSolid(DrawablePtr pDrawable, GCPtr pGC, int n,
+	xRectangle * prect)
+{
+	struct etnaviv *etnaviv = etnaviv_get_screen_priv(pDrawable->pScreen);
+	RegionPtr clip = fbGetCompositeClip(pGC);
+	struct etnaviv_fill_passes passes;
+	struct etnaviv_pixmap *vPix;
+	struct etnaviv_box_batch bb;
+	struct etnaviv_de_op op;
+	Bool replace, opaque, whole;
+	uint32_t pixel;
+	uint8_t content;
+	xPoint offset;
+
+	if (RegionNumRects(clip) == 0)
+		return TRUE;
+
+	vPix = etnaviv_drawable_offset(pDrawable, &offset);
+	if (!vPix)
+		return FALSE;
+
+	/* Only track fills whose pixel value is known without a readback */
+	replace = pGC->alu == GXcopy &&
+		  fb_full_planemask(pDrawable, pGC->planemask) &&
+		  (pGC->fillStyle != FillTiled || pGC->tileIsPixel);
+	pixel = replace ? etnaviv_fg_pixel(pGC) : 0;
+	opaque = replace && pDrawable->bitsPerPixel == 32 &&
+		 pixel >> 24 == 0xff;
+	content = vPix->content;
+
+	/*
+	 * A single rectangle replacing the whole pixmap overwrites any
+	 * fill which was deferred, so forget it rather than drawing it.
+	 */
+	whole = FALSE;
+	if (replace && n == 1 && RegionNumRects(clip) == 1) {
+		BoxRec box;
+
+		box.x1 = prect->x + pDrawable->x;
+		box.y1 = prect->y + pDrawable->y;
+		box.x2 = box.x1 + prect->width;
+		box.y2 = box.y1 + prect->height;
+
+		whole = etnaviv_pixmap_covered(vPix, &box, offset) &&
+			etnaviv_pixmap_covered(vPix, RegionExtents(clip),
+					       offset);
+		if (whole)
+			vPix->content = 0;
+	}
+
+	if (!etnaviv_init_dst_drawable(etnaviv, &op, pDrawable))
+		return FALSE;
+
+	etnaviv_init_fill(etnaviv, &op, &passes, pGC);
+
+	if (whole && etnaviv_pixmap_defer_fill(etnaviv, vPix, pixel,
+					       op.fg_colour, opaque))
+		return TRUE;
+
+	prefetch(prect);
+	prefetch(prect + 4);
+
+	op.clip = RegionExtents(clip);
+	op.cmd = VIVS_DE_DEST_CONFIG_COMMAND_BIT_BLT;
+
+	etnaviv_box_batch_init(&bb, etnaviv, &op, &passes, clip);
+	etnaviv_batch_start(etnaviv, &op);
+
+	while (n--) {
+		int x = prect->x + pDrawable->x;
+		int y = prect->y + pDrawable->y;
+
+		prefetch(prect + 8);
+
+		etnaviv_box_batch_add(&bb, x, y, x + prect->width,
+				      y + prect->height);
+		prect++;
+	}
+
+	etnaviv_box_batch_flush(&bb);
+	etnaviv_de_end(etnaviv);
+
+	/* Opaque fills leave an opaque pixmap opaque */
+	if (opaque && content & CT_OPAQUE)
+		vPix->content = CT_OPAQUE;
+
+	return TRUE;
+}
+
+/*
+ * Tiled fills.  8x8 tiles are handled by the hardware pattern brush.
+ * For other tiles, one copy of the tile is drawn, and the filled area
+ * is then doubled by copying it onto itself until the box is covered,
+ * which takes log2(N) blits rather than one blit per tile.  Very small
+ * tiles are first expanded into a larger strip, which is cached along
+ * with the tile, so that fewer doubling steps are needed.
+ */
+#define ETNAVIV_TILE_STRIP_SIZE	64	/* minimum strip dimension */
+#define ETNAVIV_TILE_DOUBLE_MIN	32	/* minimum tile count for doubling */
+
+/* Fill a box with the tile, one blit per whole or partial tile */
+static void etnaviv_fill_tiled_box(struct etnaviv *etnaviv,
+	const struct etnaviv_de_op *op, const BoxRec *box, xPoint tile_off,
+	int tile_w, int tile_h)
+{
+	xPoint tile_origin;
+	int dst_y, height, tile_y;
+
+	dst_y = box->y1;
+	height = box->y2 - dst_y;
+	modulus(dst_y - tile_off.y, tile_h, tile_y);
+
+	tile_origin.y = tile_y;
+
+	while (height > 0) {
+		int dst_x, width, tile_x, h;
+
+		dst_x = box->x1;
+		width = box->x2 - dst_x;
+		modulus(dst_x - tile_off.x, tile_w, tile_x);
+
+		tile_origin.x = tile_x;
+
+		h = tile_h - tile_origin.y;
+		if (h > height)
+			h = height;
+		height -= h;
+
+		while (width > 0) {
+			BoxRec dst;
+			int w;
+
+			w = tile_w - tile_origin.x;
+			if (w > width)
+				w = width;
+			width -= w;
+
+			box_init(&dst, dst_x, dst_y, w, h);
+			etnaviv_de_op_src_origin(etnaviv, op, tile_origin, &dst);
+
+			dst_x += w;
+			tile_origin.x = 0;
+		}
+		dst_y += h;
+		tile_origin.y = 0;
+	}
+}
+
+/*
+ * The top left w x h of the box has been filled with the tile: double
+ * the filled area, first across and then down, until the box is full.
+ * Each step reads the result of the previous step, so each is issued
+ * as a separate operation.
+ */
+static void etnaviv_fill_tiled_double(struct etnaviv *etnaviv,
+	const struct etnaviv_blit_buf *dst, const BoxRec *box, int w, int h)
+{
+	struct etnaviv_de_op op;
+	xPoint origin;
+	BoxRec copy;
+	int n;
+
+	op.dst = *dst;
+	op.src = *dst;
+	op.blend_op = NULL;
+	op.clip = box;
+	op.src_origin_mode = SRC_ORIGIN_NONE;
+	op.rop = 0xcc;
+	op.cmd = VIVS_DE_DEST_CONFIG_COMMAND_BIT_BLT;
+	op.brush = BRUSH_NONE;
+
+	origin.x = box->x1 + dst->offset.x;
+	origin.y = box->y1 + dst->offset.y;
+
+	while (w < box->x2 - box->x1) {
+		n = mint(w, box->x2 - box->x1 - w);
+		box_init(&copy, box->x1 + w, box->y1, n, h);
+
+		etnaviv_batch_start(etnaviv, &op);
+		etnaviv_de_op_src_origin(etnaviv, &op, origin, &copy);
+		etnaviv_de_end(etnaviv);
+		w += n;
+	}
+
+	while (h < box->y2 - box->y1) {
+		n = mint(h, box->y2 - box->y1 - h);
+		box_init(&copy, box->x1, box->y1 + h, w, n);
+
+		etnaviv_batch_start(etnaviv, &op);
+		etnaviv_de_op_src_origin(etnaviv, &op, origin, &copy);
+		etnaviv_de_end(etnaviv);
+		h += n;
+	}
+}
+
+/*
+ * Expand a small tile into a strip which is a multiple of the tile
+ * size, and arrange for the strip to be used as the tile instead.
+ * The strip is kept with the tile until the tile is next written.
+ */
+static Bool etnaviv_fill_tiled_strip(struct etnaviv *etnaviv,
+	struct etnaviv_de_op *op, unsigned bpp)
+{
+	struct etnaviv_pixmap *vTile = op->src.pixmap;
+	unsigned tile_w = op->src.width, tile_h = op->src.height;
+
+	if (vTile->format.tile ||
+	    !etnaviv_dst_format_valid(etnaviv, vTile->format))
+		return FALSE;
+
+	if (!vTile->strip_bo) {
+		unsigned w, h, pitch;
+
+		w = tile_w * ((ETNAVIV_TILE_STRIP_SIZE + tile_w - 1) / tile_w);
+		h = tile_h * ((ETNAVIV_TILE_STRIP_SIZE + tile_h - 1) / tile_h);
+		pitch = etnaviv_pitch(w, bpp);
+
+		vTile->strip_bo = etna_bo_new(etnaviv->conn, pitch * h,
+				DRM_ETNA_GEM_TYPE_BMP | DRM_ETNA_GEM_CACHE_WCOMBINE);
+		if (!vTile->strip_bo)
+			return FALSE;
+
+		vTile->strip_width = w;
+		vTile->strip_height = h;
+		vTile->strip_pitch = pitch;
+		vTile->strip_valid = FALSE;
+	}
+
+	if (!vTile->strip_valid) {
+		struct etnaviv_de_op sop = *op;
+		BoxRec box, stamp;
+
+		box_init(&box, 0, 0, vTile->strip_width, vTile->strip_height);
+		box_init(&stamp, 0, 0, tile_w, tile_h);
+
+		sop.dst = INIT_BLIT_BUF(vTile->format, vTile, vTile->strip_bo,
+					vTile->strip_pitch, ZERO_OFFSET,
+					vTile->strip_width, vTile->strip_height,
+					DE_ROT_MODE_ROT0);
+		sop.clip = &box;
+		sop.rop = 0xcc;
+
+		etnaviv_batch_start(etnaviv, &sop);
+		etnaviv_fill_tiled_box(etnaviv, &sop, &stamp, ZERO_OFFSET,
+				       tile_w, tile_h);
+		etnaviv_de_end(etnaviv);
+
+		etnaviv_fill_tiled_double(etnaviv, &sop.dst, &box,
+					  tile_w, tile_h);
+
+		vTile->strip_valid = TRUE;
+	}
+
+	op->src.bo = vTile->strip_bo;
+	op->src.pitch = vTile->strip_pitch;
+	op->src.width = vTile->strip_width;
+	op->src.height = vTile->strip_height;
+
+	return TRUE;
+}
+
+/*
+ * The pattern brush takes a linear 8x8 pattern with no padding between
+ * lines, in one of the PE1.0 formats.
+ */
+static Bool etnaviv_tile_is_pattern(struct etnaviv_pixmap *vTile,
+	PixmapPtr pTile)
+{
+	return pTile->drawable.width == 8 && pTile->drawable.height == 8 &&
+	       !vTile->format.tile && !vTile->format.swizzle &&
+	       vTile->format.format < 16 &&
+	       vTile->pitch == pTile->drawable.bitsPerPixel;
+}
+
+Bool etnaviv_accel_PolyFillRectTiled(DrawablePtr pDrawable, GCPtr pGC, int n,
+	xRectangle * prect)
+{
+	struct etnaviv *etnaviv = etnaviv_get_screen_priv(pDrawable->pScreen);
+	struct etnaviv_de_op op;
+	PixmapPtr pTile = pGC->tile.pixmap;
+	RegionPtr rects;
+	int nbox;
+
+	if (!etnaviv_init_dst_drawable(etnaviv, &op, pDrawable) ||
+	    !etnaviv_init_src_pixmap(etnaviv, &op, pTile))
+		return FALSE;
+
+	op.blend_op = NULL;
+	op.src_origin_mode = SRC_ORIGIN_NONE;
+	op.rop = etnaviv_copy_rop[pGC ? pGC->alu : GXcopy];
+	op.cmd = VIVS_DE_DEST_CONFIG_COMMAND_BIT_BLT;
+	op.brush = BRUSH_NONE;
+
+	/* Convert the rectangles to a region */
+	rects = RegionFromRects(n, prect, CT_UNSORTED);
+
+	/* Translate them for the drawable position */
+	RegionTranslate(rects, pDrawable->x, pDrawable->y);
+
+	/* Intersect them with the clipping region */
+	RegionIntersect(rects, rects, fbGetCompositeClip(pGC));
+
+	nbox = RegionNumRects(rects);
+	if (nbox) {
+		int tile_w, tile_h;
+		xPoint tile_off;
+		Bool can_double;
+		BoxPtr pBox;
+
+		/* Calculate the tile offset from the rect coords */
+		tile_off.x = pDrawable->x + pGC->patOrg.x;
+		tile_off.y = pDrawable->y + pGC->patOrg.y;
+
+		tile_w = pTile->drawable.width;
+		tile_h = pTile->drawable.height;
+
+		pBox = RegionRects(rects);
+
+		if (etnaviv_tile_is_pattern(op.src.pixmap, pTile)) {
+			/* The pattern origin is in destination coordinates */
+			op.src.offset.x = tile_off.x + op.dst.offset.x;
+			op.src.offset.y = tile_off.y + op.dst.offset.y;
+			op.rop = etnaviv_fill_rop[pGC->alu];
+			op.brush = BRUSH_PATTERN;
+			op.clip = RegionExtents(rects);
+
+			etnaviv_batch_start(etnaviv, &op);
+			etnaviv_de_op(etnaviv, &op, pBox, nbox);
+			etnaviv_de_end(etnaviv);
+			goto done;
+		}
+
+		/*
+		 * Doubling copies what has already been drawn, so the
+		 * raster op must not depend on the destination.
+		 */
+		can_double = pGC->alu == GXcopy || pGC->alu == GXcopyInverted;
+
+		if (tile_w * tile_h < 64 &&
+		    etnaviv_fill_tiled_strip(etnaviv, &op,
+					     pTile->drawable.bitsPerPixel)) {
+			tile_w = op.src.width;
+			tile_h = op.src.height;
+		}
+
+		/* The destination is also the source when doubling */
+		op.dst.width = op.dst.pixmap->width;
+		op.dst.height = op.dst.pixmap->height;
+		op.dst.rotate = DE_ROT_MODE_ROT0;
+
+		while (nbox--) {
+			int w = pBox->x2 - pBox->x1;
+			int h = pBox->y2 - pBox->y1;
+
+			op.clip = pBox;
+
+			if (can_double &&
+			    ((w + tile_w - 1) / tile_w) * ((h + tile_h - 1) / tile_h) >=
+			    ETNAVIV_TILE_DOUBLE_MIN) {
+				BoxRec stamp;
+
+				box_init(&stamp, pBox->x1, pBox->y1,
+					 mint(w, tile_w), mint(h, tile_h));
+
+				etnaviv_batch_start(etnaviv, &op);
+				etnaviv_fill_tiled_box(etnaviv, &op, &stamp,
+						       tile_off, tile_w, tile_h);
+				etnaviv_de_end(etnaviv);
+
+				etnaviv_fill_tiled_double(etnaviv, &op.dst, pBox,
+							  stamp.x2 - stamp.x1,
+							  stamp.y2 - stamp.y1);
+			} else {
+				etnaviv_batch_start(etnaviv, &op);
+				etnaviv_fill_tiled_box(etnaviv, &op, pBox,
+						       tile_off, tile_w, tile_h);
+				etnaviv_de_end(etnaviv);
+			}
+
+			pBox++;
+		}
+	}
+
+ done:
+	RegionUninit(rects);
+	RegionDestroy(rects);
+
+	return TRUE;
+}
+
+Bool etnaviv_accel_PolyFillRectStippled(DrawablePtr pDrawable, GCPtr pGC,
+	int n, xRectangle * prect)
+{
+	struct etnaviv *etnaviv = etnaviv_get_screen_priv(pDrawable->pScreen);
+	struct etnaviv_mono_cache *mc;
+	struct etnaviv_de_op op;
+	PixmapPtr pStip = pGC->stipple;
+	RegionPtr rects;
+	int nbox;
+
+	if (!etnaviv_init_dst_drawable(etnaviv, &op, pDrawable))
+		return FALSE;
+
+	mc = etnaviv_mono_lookup(etnaviv, pStip);
+	if (!mc)
+		return FALSE;
+
+	etnaviv_init_mono(etnaviv, &op, pGC, mc->bo, mc->pitch,
+			  pStip->drawable.width, pStip->drawable.height,
+			  pGC->fillStyle == FillOpaqueStippled);
+	op.src_origin_mode = SRC_ORIGIN_NONE;
+
+	rects = RegionFromRects(n, prect, CT_UNSORTED);
+	RegionTranslate(rects, pDrawable->x, pDrawable->y);
+	RegionIntersect(rects, rects, fbGetCompositeClip(pGC));
+
+	nbox = RegionNumRects(rects);
+	if (nbox) {
+		BoxPtr pBox = RegionRects(rects);
+		xPoint stip_off;
+
+		stip_off.x = pDrawable->x + pGC->patOrg.x;
+		stip_off.y = pDrawable->y + pGC->patOrg.y;
+
+		/* The stipple is repeated within each box, so clip to all */
+		op.clip = RegionExtents(rects);
+
+		etnaviv_batch_start(etnaviv, &op);
+		while (nbox--) {
+			etnaviv_fill_tiled_box(etnaviv, &op, pBox, stip_off,
+					       pStip->drawable.width,
+					       pStip->drawable.height);
+			pBox++;
+		}
+		etnaviv_de_end(etnaviv);
+	}
+
+	RegionUninit(rects);
+	RegionDestroy(rects);
+
+	return TRUE;
+}
+
+/* CopyPlane from a depth-1 pixmap: expand to the GC colours */
+void etnaviv_accel_Copy1toN(DrawablePtr pSrc, DrawablePtr pDst,
+	GCPtr pGC, BoxPtr pBox, int nBox, int dx, int dy, Bool reverse,
+	Bool upsidedown, Pixel bitPlane, void *closure)
+{
+	struct etnaviv *etnaviv = etnaviv_get_screen_priv(pDst->pScreen);
+	struct etnaviv_mono_cache *mc;
+	struct etnaviv_de_op op;
+	PixmapPtr pSrcPix;
+	xPoint src_offset;
+
+	if (!nBox)
+		return;
+
+	if (etnaviv->force_fallback)
 		goto fallback;
 
-	/* Include the copy delta on the source */
-	op.src.offset.x += dx - op.dst.offset.x;
-	op.src.offset.y += dy - op.dst.offset.y;
-	op.src_origin_mode = SRC_ORIGIN_RELATIVE;
+	if (!etnaviv_init_dst_drawable(etnaviv, &op, pDst))
+		goto fallback;
 
-	/* Calculate the overall extent */
-	extent.x1 = max_t(short, pDst->x, pSrc->x - dx);
-	extent.y1 = max_t(short, pDst->y, pSrc->y - dy);
-	extent.x2 = min_t(short, pDst->x + pDst->width,
-				 pSrc->x + pSrc->width - dx);
-	extent.y2 = min_t(short, pDst->y + pDst->height,
-				 pSrc->y + pSrc->height - dy);
+	pSrcPix = drawable_pixmap_offset(pSrc, &src_offset);
+	mc = etnaviv_mono_lookup(etnaviv, pSrcPix);
+	if (!mc)
+		goto fallback;
 
-	if (pGC) {
-		clip = RegionExtents(fbGetCompositeClip(pGC));
-		if (__box_intersect(&extent, &extent, clip))
-			return;
-	} else {
-		if (extent.x1 < 0)
-			extent.x1 = 0;
-		if (extent.y1 < 0)
-			extent.y1 = 0;
-	}
+	etnaviv_init_mono(etnaviv, &op, pGC, mc->bo, mc->pitch,
+			  pSrcPix->drawable.width, pSrcPix->drawable.height,
+			  TRUE);
 
-	op.blend_op = NULL;
-	op.clip = &extent;
-	op.rop = etnaviv_copy_rop[pGC ? pGC->alu : GXcopy];
-	op.cmd = VIVS_DE_DEST_CONFIG_COMMAND_BIT_BLT;
-	op.brush = FALSE;
+	/* Include the copy delta on the source */
+	op.src.offset.x = src_offset.x + dx - op.dst.offset.x;
+	op.src.offset.y = src_offset.y + dy - op.dst.offset.y;
+	op.src_origin_mode = SRC_ORIGIN_RELATIVE;
+	op.clip = RegionExtents(fbGetCompositeClip(pGC));
 
 	etnaviv_batch_start(etnaviv, &op);
 	etnaviv_blit_clipped(etnaviv, &op, pBox, nBox);
@@ -570,390 +2650,583 @@ void etnaviv_accel_CopyNtoN(DrawablePtr pSrc, DrawablePtr pDst,
 	return;
 
  fallback:
-	unaccel_CopyNtoN(pSrc, pDst, pGC, pBox, nBox, dx, dy, reverse,
-		upsidedown, bitPlane, closure);
+	unaccel_Copy1toN(pSrc, pDst, pGC, pBox, nBox, dx, dy, reverse,
+			 upsidedown, bitPlane, closure);
 }
 
-Bool etnaviv_accel_PolyPoint(DrawablePtr pDrawable, GCPtr pGC, int mode,
-	int npt, DDXPointPtr ppt)
+/* PushPixels with a solid fill is a transparent expansion of the bitmap */
+Bool etnaviv_accel_PushPixels(GCPtr pGC, PixmapPtr pBitmap,
+	DrawablePtr pDrawable, int w, int h, int x, int y)
 {
 	struct etnaviv *etnaviv = etnaviv_get_screen_priv(pDrawable->pScreen);
+	struct etnaviv_mono_cache *mc;
 	struct etnaviv_de_op op;
-	BoxPtr pBox;
 	RegionRec region;
-	int i;
-	Bool overlap;
+	BoxRec box;
 
 	if (!etnaviv_init_dst_drawable(etnaviv, &op, pDrawable))
 		return FALSE;
 
-	etnaviv_init_fill(etnaviv, &op, pGC);
-	op.cmd = VIVS_DE_DEST_CONFIG_COMMAND_BIT_BLT;
-
-	pBox = malloc(npt * sizeof *pBox);
-	if (!pBox)
+	mc = etnaviv_mono_lookup(etnaviv, pBitmap);
+	if (!mc)
 		return FALSE;
 
-	if (mode == CoordModePrevious) {
-		int x, y;
-
-		x = y = 0;
-		for (i = 0; i < npt; i++) {
-			x += ppt[i].x;
-			y += ppt[i].y;
-			box_init(&pBox[i], x + pDrawable->x, y + pDrawable->y,
-				 1, 1);
-		}
-	} else {
-		for (i = 0; i < npt; i++) {
-			box_init(&pBox[i],
-				 ppt[i].x + pDrawable->x,
-				 ppt[i].y + pDrawable->y, 1, 1);
-		}
-	}
+	x += pDrawable->x;
+	y += pDrawable->y;
 
-	/* Convert the boxes to a region */
-	RegionInitBoxes(&region, pBox, npt);
-	free(pBox);
+	etnaviv_init_mono(etnaviv, &op, pGC, mc->bo, mc->pitch,
+			  pBitmap->drawable.width, pBitmap->drawable.height,
+			  FALSE);
+	op.src.offset.x = -x - op.dst.offset.x;
+	op.src.offset.y = -y - op.dst.offset.y;
 
-	RegionValidate(&region, &overlap);
-
-	/* Intersect them with the clipping region */
+	box_init(&box, x, y, w, h);
+	RegionInit(&region, &box, 1);
 	RegionIntersect(&region, &region, fbGetCompositeClip(pGC));
 
-	if (RegionNumRects(&region)) {
-		op.clip = RegionExtents(&region);
-
-		etnaviv_batch_start(etnaviv, &op);
-		etnaviv_de_op(etnaviv, &op, RegionRects(&region),
-			      RegionNumRects(&region));
-		etnaviv_de_end(etnaviv);
-	}
+	etnaviv_mono_region(etnaviv, &op, &region);
 
 	RegionUninit(&region);
 
 	return TRUE;
 }
 
-Bool etnaviv_accel_PolyLines(DrawablePtr pDrawable, GCPtr pGC, int mode,
-	int npt, DDXPointPtr ppt)
+/*
+ * Expand a whole depth-1 pixmap into the top left of vDst, which is
+ * set to fg where the bitmap is set, and bg elsewhere.  The colours
+ * are as the drawing engine wants them for vDst's pict_format.
+ */
+Bool etnaviv_accel_expand_bitmap(struct etnaviv *etnaviv,
+	struct etnaviv_pixmap *vDst, PixmapPtr pBitmap,
+	uint32_t fg, uint32_t bg)
 {
-	struct etnaviv *etnaviv = etnaviv_get_screen_priv(pDrawable->pScreen);
+	struct etnaviv_format fmt = { .format = DE_FORMAT_MONOCHROME, };
+	unsigned w = pBitmap->drawable.width, h = pBitmap->drawable.height;
+	struct etnaviv_mono_cache *mc;
 	struct etnaviv_de_op op;
-	RegionPtr clip = fbGetCompositeClip(pGC);
-	const BoxRec *box;
-	int nclip, i;
-	BoxRec *boxes, *b;
-	xSegment seg;
-
-	assert(pGC->miTranslate);
+	BoxRec box;
 
-	if (RegionNumRects(clip) == 0)
-		return TRUE;
+	mc = etnaviv_mono_lookup(etnaviv, pBitmap);
+	if (!mc)
+		return FALSE;
 
-	if (!etnaviv_init_dst_drawable(etnaviv, &op, pDrawable))
+	if (!etnaviv_map_gpu(etnaviv, vDst, GPU_ACCESS_RW))
 		return FALSE;
 
-	etnaviv_init_fill(etnaviv, &op, pGC);
-	op.cmd = VIVS_DE_DEST_CONFIG_COMMAND_LINE;
+	box_init(&box, 0, 0, w, h);
+
+	op.dst = INIT_BLIT_PIX(vDst, vDst->pict_format, ZERO_OFFSET);
+	op.src = INIT_BLIT_BUF(fmt, NULL, mc->bo, mc->pitch, ZERO_OFFSET,
+			       w, h, DE_ROT_MODE_ROT0);
+	op.blend_op = NULL;
+	op.clip = &box;
+	op.src_origin_mode = SRC_ORIGIN_RELATIVE;
+	op.rop = 0xcc;
+	op.bg_rop = 0xcc;
+	op.cmd = VIVS_DE_DEST_CONFIG_COMMAND_BIT_BLT;
+	op.brush = BRUSH_NONE;
+	op.fg_colour = fg;
+	op.bg_colour = bg;
+
+	etnaviv_batch_start(etnaviv, &op);
+	etnaviv_de_op(etnaviv, &op, &box, 1);
+	etnaviv_de_end(etnaviv);
+
+	return TRUE;
+}
+
+/*
+ * Core font text.  Glyph bitmaps are uploaded into a 1bpp atlas, packed
+ * into rows on byte boundaries, and found again through a direct mapped
+ * hash of the font and glyph.  Glyphs are only ever written to unused
+ * parts of the atlas, so we need not wait for the GPU to finish reading
+ * it.  When the atlas is full, it is replaced and all entries dropped.
+ */
+#define ETNAVIV_CORE_ATLAS_WIDTH	1024
+#define ETNAVIV_CORE_ATLAS_HEIGHT	1024
+#define ETNAVIV_CORE_ATLAS_PITCH	(ETNAVIV_CORE_ATLAS_WIDTH / 8)
+
+static unsigned etnaviv_core_glyph_hash(FontPtr font, CharInfoPtr pci)
+{
+	uintptr_t key = (uintptr_t)pci / sizeof(*pci) ^ (uintptr_t)font >> 6;
+
+	return (key ^ key >> 10) & (ETNAVIV_CORE_GLYPH_HASH - 1);
+}
+
+static Bool etnaviv_core_atlas_new(struct etnaviv *etnaviv)
+{
+	struct etna_bo *bo;
+	uint8_t *ptr;
 
-	boxes = malloc(sizeof(BoxRec) * npt);
-	if (!boxes)
+	bo = etna_bo_new(etnaviv->conn,
+			 ETNAVIV_CORE_ATLAS_PITCH * ETNAVIV_CORE_ATLAS_HEIGHT,
+			 DRM_ETNA_GEM_TYPE_BMP | DRM_ETNA_GEM_CACHE_WCOMBINE);
+	if (!bo)
 		return FALSE;
 
-	nclip = RegionNumRects(clip);
-	for (box = RegionRects(clip); nclip; nclip--, box++) {
-		seg.x1 = ppt[0].x;
-		seg.y1 = ppt[0].y;
+	ptr = etna_bo_map(bo);
+	if (!ptr) {
+		etna_bo_del(etnaviv->conn, bo, NULL);
+		return FALSE;
+	}
 
-		for (b = boxes, i = 1; i < npt; i++) {
-			seg.x2 = ppt[i].x;
-			seg.y2 = ppt[i].y;
+	if (etnaviv->core_atlas)
+		etnaviv_mono_free(etnaviv, etnaviv->core_atlas);
 
-			if (mode == CoordModePrevious) {
-				seg.x2 += seg.x1;
-				seg.y2 += seg.y1;
-			}
+	etnaviv->core_atlas = bo;
+	etnaviv->core_atlas_ptr = ptr;
+	etnaviv->core_atlas_x = 0;
+	etnaviv->core_atlas_y = 0;
+	etnaviv->core_atlas_row = 0;
+	memset(etnaviv->core_glyph, 0, sizeof(etnaviv->core_glyph));
 
-			if (seg.x1 != seg.x2 && seg.y1 != seg.y2) {
-				free(boxes);
-				return FALSE;
-			}
+	return TRUE;
+}
 
-			/* We have to add the drawable position into the offset */
-			seg.x1 += pDrawable->x;
-			seg.x2 += pDrawable->x;
-			seg.y1 += pDrawable->y;
-			seg.y2 += pDrawable->y;
+static struct etnaviv_core_glyph *etnaviv_core_glyph_lookup(
+	struct etnaviv *etnaviv, FontPtr font, CharInfoPtr pci,
+	pointer pglyphBase)
+{
+	struct etnaviv_core_glyph *cg;
+	unsigned w = GLYPHWIDTHPIXELS(pci);
+	unsigned h = GLYPHHEIGHTPIXELS(pci);
+	uint8_t *dst;
+
+	cg = &etnaviv->core_glyph[etnaviv_core_glyph_hash(font, pci)];
+	if (cg->font == font && cg->pci == pci)
+		return cg;
+
+	if (etnaviv->core_atlas_x + w > ETNAVIV_CORE_ATLAS_WIDTH) {
+		etnaviv->core_atlas_y += etnaviv->core_atlas_row;
+		etnaviv->core_atlas_x = 0;
+		etnaviv->core_atlas_row = 0;
+	}
+	if (etnaviv->core_atlas_y + h > ETNAVIV_CORE_ATLAS_HEIGHT)
+		return NULL;
+
+	dst = etnaviv->core_atlas_ptr +
+	      etnaviv->core_atlas_y * ETNAVIV_CORE_ATLAS_PITCH +
+	      etnaviv->core_atlas_x / 8;
+	etnaviv_mono_copy(dst, ETNAVIV_CORE_ATLAS_PITCH,
+			  (const uint8_t *)FONTGLYPHBITS(pglyphBase, pci),
+			  GLYPHWIDTHBYTESPADDED(pci), GLYPHWIDTHBYTES(pci), h);
+
+	cg->font = font;
+	cg->pci = pci;
+	cg->x = etnaviv->core_atlas_x;
+	cg->y = etnaviv->core_atlas_y;
+
+	etnaviv->core_atlas_x += ALIGN(w, 8);
+	if (etnaviv->core_atlas_row < h)
+		etnaviv->core_atlas_row = h;
+
+	return cg;
+}
 
-			if (!box_intersect_line_rough(box, &seg))
-				continue;
+/*
+ * Find the atlas position of each glyph in the string, uploading those
+ * which are missing.  If the atlas fills part way through, start again
+ * with a new atlas so that the whole string comes from the same buffer.
+ */
+static Bool etnaviv_core_glyphs_place(struct etnaviv *etnaviv, FontPtr font,
+	unsigned int nglyph, CharInfoPtr *ppci, pointer pglyphBase,
+	xPoint *pos)
+{
+	struct etnaviv_core_glyph *cg;
+	unsigned int i, try;
 
-			if (i == npt - 1 && pGC->capStyle != CapNotLast) {
-				if (seg.x1 < seg.x2)
-					seg.x2 += 1;
-				else if (seg.x1 > seg.x2)
-					seg.x2 -= 1;
-				if (seg.y1 < seg.y2)
-					seg.y2 += 1;
-				else if (seg.y1 > seg.y2)
-					seg.y2 -= 1;
-			}
+	if (!etnaviv->core_atlas && !etnaviv_core_atlas_new(etnaviv))
+		return FALSE;
 
-			b->x1 = seg.x1;
-			b->y1 = seg.y1;
-			b->x2 = seg.x2;
-			b->y2 = seg.y2;
-			b++;
+	for (try = 0; try < 2; try++) {
+		for (i = 0; i < nglyph; i++) {
+			CharInfoPtr pci = ppci[i];
 
-			seg.x1 = ppt[i].x;
-			seg.y1 = ppt[i].y;
-		}
+			if (GLYPHWIDTHPIXELS(pci) == 0 ||
+			    GLYPHHEIGHTPIXELS(pci) == 0)
+				continue;
 
-		if (b != boxes) {
-			op.clip = box;
-			etnaviv_batch_start(etnaviv, &op);
-			etnaviv_de_op(etnaviv, &op, boxes, b - boxes);
-			etnaviv_de_end(etnaviv);
+			cg = etnaviv_core_glyph_lookup(etnaviv, font, pci,
+						       pglyphBase);
+			if (!cg)
+				break;
+
+			pos[i].x = cg->x;
+			pos[i].y = cg->y;
 		}
-	}
+		if (i == nglyph)
+			return TRUE;
 
-	free(boxes);
+		if (!etnaviv_core_atlas_new(etnaviv))
+			break;
+	}
 
 	return FALSE;
 }
 
-Bool etnaviv_accel_PolySegment(DrawablePtr pDrawable, GCPtr pGC, int nseg,
-	xSegment *pSeg)
+/*
+ * ImageText fills the background rectangle with the background colour
+ * and then draws the glyphs in the foreground colour, both using GXcopy
+ * whatever the GC function.  Terminal fonts cover the background with
+ * their glyphs, so an opaque expansion of the glyphs does both at once.
+ * PolyText is a transparent expansion using the GC function.
+ */
+Bool etnaviv_accel_GlyphBlt(DrawablePtr pDrawable, GCPtr pGC,
+	int x, int y, unsigned int nglyph, CharInfoPtr *ppci,
+	pointer pglyphBase, Bool image)
 {
 	struct etnaviv *etnaviv = etnaviv_get_screen_priv(pDrawable->pScreen);
-	struct etnaviv_de_op op;
 	RegionPtr clip = fbGetCompositeClip(pGC);
-	const BoxRec *box;
-	int nclip, i;
-	BoxRec *boxes, *b;
-	bool last;
-
-	assert(pGC->miTranslate);
+	FontPtr font = pGC->font;
+	struct etnaviv_de_op op;
+	struct region_clip_iter it;
+	const BoxRec *hint = NULL;
+	BoxRec extents, box;
+	Bool opaque;
+	xPoint *pos;
+	unsigned int i;
+	int gx;
 
 	if (RegionNumRects(clip) == 0)
 		return TRUE;
 
+	for (i = 0; i < nglyph; i++)
+		if (GLYPHWIDTHPIXELS(ppci[i]) > ETNAVIV_CORE_ATLAS_WIDTH ||
+		    GLYPHHEIGHTPIXELS(ppci[i]) > ETNAVIV_CORE_ATLAS_HEIGHT)
+			return FALSE;
+
 	if (!etnaviv_init_dst_drawable(etnaviv, &op, pDrawable))
 		return FALSE;
 
-	etnaviv_init_fill(etnaviv, &op, pGC);
-	op.cmd = VIVS_DE_DEST_CONFIG_COMMAND_LINE;
-
-	last = pGC->capStyle != CapNotLast;
+	pos = malloc(nglyph * sizeof(*pos));
+	if (!pos)
+		return FALSE;
 
-	boxes = malloc(sizeof(BoxRec) * nseg * (1 + last));
-	if (!boxes)
+	if (!etnaviv_core_glyphs_place(etnaviv, font, nglyph, ppci,
+				       pglyphBase, pos)) {
+		free(pos);
 		return FALSE;
+	}
+
+	x += pDrawable->x;
+	y += pDrawable->y;
+
+	opaque = image && TERMINALFONT(font);
+	if (image && !opaque) {
+		struct etnaviv_de_op fill = op;
+		RegionRec region;
+		int width = 0;
+
+		for (i = 0; i < nglyph; i++)
+			width += ppci[i]->metrics.characterWidth;
+
+		box_init(&extents, width < 0 ? x + width : x,
+			 y - FONTASCENT(font), width < 0 ? -width : width,
+			 FONTASCENT(font) + FONTDESCENT(font));
+		RegionInit(&region, &extents, 1);
+		RegionIntersect(&region, &region, clip);
+
+		if (RegionNumRects(&region)) {
+			fill.src = INIT_BLIT_NULL;
+			fill.blend_op = NULL;
+			fill.src_origin_mode = SRC_ORIGIN_NONE;
+			fill.rop = etnaviv_fill_rop[GXcopy];
+			fill.cmd = VIVS_DE_DEST_CONFIG_COMMAND_BIT_BLT;
+			fill.brush = BRUSH_SOLID;
+			fill.fg_colour = etnaviv_pixel_col(etnaviv,
+						pGC->depth, pGC->bgPixel);
+			fill.clip = RegionExtents(&region);
+
+			etnaviv_batch_start(etnaviv, &fill);
+			etnaviv_de_op(etnaviv, &fill, RegionRects(&region),
+				      RegionNumRects(&region));
+			etnaviv_de_end(etnaviv);
+		}
+		RegionUninit(&region);
+	}
 
-	nclip = RegionNumRects(clip);
-	for (box = RegionRects(clip); nclip; nclip--, box++) {
-		for (b = boxes, i = 0; i < nseg; i++) {
-			xSegment seg = pSeg[i];
+	etnaviv_init_mono(etnaviv, &op, pGC, etnaviv->core_atlas,
+			  ETNAVIV_CORE_ATLAS_PITCH, ETNAVIV_CORE_ATLAS_WIDTH,
+			  ETNAVIV_CORE_ATLAS_HEIGHT, opaque);
+	if (image) {
+		op.rop = etnaviv_copy_rop[GXcopy];
+		op.bg_rop = opaque ? op.rop : 0xaa;
+	}
+	op.src_origin_mode = SRC_ORIGIN_NONE;
+	op.clip = RegionExtents(clip);
 
-			/* We have to add the drawable position into the offset */
-			seg.x1 += pDrawable->x;
-			seg.x2 += pDrawable->x;
-			seg.y1 += pDrawable->y;
-			seg.y2 += pDrawable->y;
+	etnaviv_batch_start(etnaviv, &op);
+	for (i = 0, gx = x; i < nglyph; gx += ppci[i]->metrics.characterWidth,
+	     i++) {
+		CharInfoPtr pci = ppci[i];
 
-			if (!box_intersect_line_rough(box, &seg))
-				continue;
+		if (GLYPHWIDTHPIXELS(pci) == 0 || GLYPHHEIGHTPIXELS(pci) == 0)
+			continue;
 
-			b->x1 = seg.x1;
-			b->y1 = seg.y1;
-			b->x2 = seg.x2;
-			b->y2 = seg.y2;
-			b++;
-
-			if (last &&
-			    seg.x2 >= box->x1 && seg.x2 < box->x2 &&
-			    seg.y2 >= box->y1 && seg.y2 < box->y2) {
-				/*
-				 * Draw a one pixel long line to light the
-				 * last pixel on the line, but only if the
-				 * point is not off the edge.
-				 */
-				b->x1 = seg.x2;
-				b->y1 = seg.y2;
-				b->x2 = seg.x2 + 1;
-				b->y2 = seg.y2;
-				b++;
-			}
-		}
+		box_init(&extents, gx + pci->metrics.leftSideBearing,
+			 y - pci->metrics.ascent, GLYPHWIDTHPIXELS(pci),
+			 GLYPHHEIGHTPIXELS(pci));
 
-		if (b != boxes) {
-			op.clip = box;
-			etnaviv_batch_start(etnaviv, &op);
-			etnaviv_de_op(etnaviv, &op, boxes, b - boxes);
-			etnaviv_de_end(etnaviv);
+		hint = region_clip_iter_init(&it, clip, &extents, hint);
+		while (region_clip_iter_next(&it, &box)) {
+			xPoint src_origin;
+
+			src_origin.x = pos[i].x + box.x1 - extents.x1;
+			src_origin.y = pos[i].y + box.y1 - extents.y1;
+
+			etnaviv_de_op_src_origin(etnaviv, &op, src_origin,
+						 &box);
 		}
 	}
+	etnaviv_de_end(etnaviv);
 
-	free(boxes);
+	free(pos);
 
 	return TRUE;
 }
 
-Bool etnaviv_accel_PolyFillRectSolid(DrawablePtr pDrawable, GCPtr pGC, int n,
-	xRectangle * prect)
+/* Forget the glyphs of a font which is going away */
+void etnaviv_accel_UnrealizeFont(struct etnaviv *etnaviv, FontPtr pFont)
 {
-	struct etnaviv *etnaviv = etnaviv_get_screen_priv(pDrawable->pScreen);
-	struct etnaviv_de_op op;
-	RegionPtr clip = fbGetCompositeClip(pGC);
-	BoxRec boxes[VIVANTE_MAX_2D_RECTS], *box;
-	int nclip, nb, chunk;
+	unsigned i;
 
-	if (RegionNumRects(clip) == 0)
-		return TRUE;
+	for (i = 0; i < ARRAY_SIZE(etnaviv->core_glyph); i++)
+		if (etnaviv->core_glyph[i].font == pFont)
+			etnaviv->core_glyph[i].font = NULL;
+}
 
-	if (!etnaviv_init_dst_drawable(etnaviv, &op, pDrawable))
-		return FALSE;
+/* Copy the whole of a pixmap between two buffers using the GPU. */
+static void etnaviv_pixmap_copy(struct etnaviv *etnaviv,
+	struct etnaviv_pixmap *vPix, const struct etnaviv_blit_buf *dst,
+	const struct etnaviv_blit_buf *src)
+{
+	struct etnaviv_de_op op;
+	BoxRec box;
 
-	prefetch(prect);
-	prefetch(prect + 4);
+	box_init(&box, 0, 0, vPix->width, vPix->height);
 
-	etnaviv_init_fill(etnaviv, &op, pGC);
-	op.clip = RegionExtents(clip);
+	op.dst = *dst;
+	op.src = *src;
+	op.blend_op = NULL;
+	op.clip = &box;
+	op.src_origin_mode = SRC_ORIGIN_RELATIVE;
+	op.rop = 0xcc;
 	op.cmd = VIVS_DE_DEST_CONFIG_COMMAND_BIT_BLT;
+	op.brush = BRUSH_NONE;
 
 	etnaviv_batch_start(etnaviv, &op);
+	etnaviv_de_op(etnaviv, &op, &box, 1);
+	etnaviv_de_end(etnaviv);
+}
 
-	chunk = VIVANTE_MAX_2D_RECTS;
-	nb = 0;
-	while (n--) {
-		BoxRec full_rect;
+/*
+ * Tiled pixmaps can not be directly accessed by the CPU, nor can they
+ * be shared with other users.  Use the GPU to copy between the tiled
+ * pixmap and a linear buffer as required.
+ */
+static void etnaviv_tile_blit(struct etnaviv *etnaviv,
+	struct etnaviv_pixmap *vPix, Bool to_linear)
+{
+	struct etnaviv_format linear = vPix->format;
+	struct etnaviv_blit_buf tiled_buf, linear_buf;
 
-		prefetch (prect + 8);
+	linear.tile = 0;
 
-		box_init(&full_rect,
-			 prect->x + pDrawable->x,
-			 prect->y + pDrawable->y,
-			 prect->width, prect->height);
+	tiled_buf = INIT_BLIT_PIX(vPix, vPix->format, ZERO_OFFSET);
+	linear_buf = INIT_BLIT_BUF(linear, vPix, vPix->linear_bo,
+				   vPix->linear_pitch, ZERO_OFFSET, vPix->width,
+				   vPix->height, DE_ROT_MODE_ROT0);
 
-		prect++;
+	if (to_linear)
+		etnaviv_pixmap_copy(etnaviv, vPix, &linear_buf, &tiled_buf);
+	else
+		etnaviv_pixmap_copy(etnaviv, vPix, &tiled_buf, &linear_buf);
+}
 
-		for (box = RegionRects(clip), nclip = RegionNumRects(clip);
-		     nclip; nclip--, box++) {
-			if (__box_intersect(&boxes[nb], &full_rect, box))
-				continue;
+/*
+ * Allocate the linear shadow of a tiled pixmap.  This is left until the
+ * CPU first accesses the pixmap, as most tiled pixmaps never are.  The
+ * CPU reads the shadow, so make it cacheable.  If GPU memory can not be
+ * allocated, fall back to system memory, which the GPU can still copy
+ * to and from.
+ */
+Bool etnaviv_pixmap_alloc_shadow(struct etnaviv *etnaviv,
+	struct etnaviv_pixmap *vPix)
+{
+	size_t align = getpagesize();
+	size_t size = vPix->linear_pitch * vPix->height;
+	void *mem;
 
-			if (++nb >= chunk) {
-				etnaviv_de_op(etnaviv, &op, boxes, nb);
-				nb = 0;
-			}
-		}
+	if (vPix->linear_bo)
+		return TRUE;
+
+	vPix->linear_bo = etna_bo_new(etnaviv->conn, size,
+				      DRM_ETNA_GEM_TYPE_BMP |
+				      DRM_ETNA_GEM_CACHE_WBACK);
+	if (vPix->linear_bo)
+		return TRUE;
+
+	size = ALIGN(size, align);
+	if (posix_memalign(&mem, align, size))
+		return FALSE;
+
+	vPix->linear_bo = etna_bo_from_usermem(etnaviv->conn, mem, size);
+	if (!vPix->linear_bo) {
+		free(mem);
+		return FALSE;
 	}
-	if (nb)
-		etnaviv_de_op(etnaviv, &op, boxes, nb);
-	etnaviv_de_end(etnaviv);
+
+	vPix->linear_mem = mem;
 
 	return TRUE;
 }
 
-Bool etnaviv_accel_PolyFillRectTiled(DrawablePtr pDrawable, GCPtr pGC, int n,
-	xRectangle * prect)
+/*
+ * Copy a tiled pixmap to its linear shadow buffer, and wait for the
+ * copy to complete.
+ */
+void etnaviv_pixmap_detile(struct etnaviv *etnaviv,
+	struct etnaviv_pixmap *vPix)
 {
-	struct etnaviv *etnaviv = etnaviv_get_screen_priv(pDrawable->pScreen);
-	struct etnaviv_de_op op;
-	PixmapPtr pTile = pGC->tile.pixmap;
-	RegionPtr rects;
-	int nbox;
+	etnaviv_tile_blit(etnaviv, vPix, TRUE);
+	etnaviv_batch_wait_commit(etnaviv, vPix);
+}
 
-	if (!etnaviv_init_dst_drawable(etnaviv, &op, pDrawable) ||
-	    !etnaviv_init_src_pixmap(etnaviv, &op, pTile))
-		return FALSE;
+/*
+ * Copy the CPU-modified linear shadow back to the tiled pixmap.  This
+ * is queued like any other GPU operation.
+ */
+void etnaviv_pixmap_retile(struct etnaviv *etnaviv,
+	struct etnaviv_pixmap *vPix)
+{
+	etnaviv_tile_blit(etnaviv, vPix, FALSE);
+}
 
-	op.blend_op = NULL;
-	op.src_origin_mode = SRC_ORIGIN_NONE;
-	op.rop = etnaviv_copy_rop[pGC ? pGC->alu : GXcopy];
-	op.cmd = VIVS_DE_DEST_CONFIG_COMMAND_BIT_BLT;
-	op.brush = FALSE;
+/*
+ * Move a pixmap which the CPU frequently reads into a cached bo.
+ * Reading write-combined memory is very slow for the CPU, whereas
+ * the cache maintenance for a cached bo is comparatively cheap.
+ */
+Bool etnaviv_pixmap_set_cached(struct etnaviv *etnaviv,
+	struct etnaviv_pixmap *vPix)
+{
+	struct etnaviv_blit_buf src, dst;
+	struct etna_bo *bo;
 
-	/* Convert the rectangles to a region */
-	rects = RegionFromRects(n, prect, CT_UNSORTED);
+	bo = etna_bo_new(etnaviv->conn, etna_bo_size(vPix->etna_bo),
+			 DRM_ETNA_GEM_TYPE_BMP | DRM_ETNA_GEM_CACHE_WBACK);
+	if (!bo)
+		return FALSE;
 
-	/* Translate them for the drawable position */
-	RegionTranslate(rects, pDrawable->x, pDrawable->y);
+	src = INIT_BLIT_PIX(vPix, vPix->format, ZERO_OFFSET);
+	dst = INIT_BLIT_BUF(vPix->format, vPix, bo, vPix->pitch, ZERO_OFFSET,
+			    vPix->width, vPix->height, DE_ROT_MODE_ROT0);
 
-	/* Intersect them with the clipping region */
-	RegionIntersect(rects, rects, fbGetCompositeClip(pGC));
+	etnaviv_pixmap_copy(etnaviv, vPix, &dst, &src);
+	etnaviv_batch_wait_commit(etnaviv, vPix);
 
-	nbox = RegionNumRects(rects);
-	if (nbox) {
-		int tile_w, tile_h, tile_off_x, tile_off_y;
-		BoxPtr pBox;
+	etna_bo_del(etnaviv->conn, vPix->etna_bo, NULL);
+	vPix->etna_bo = bo;
+	vPix->cached = TRUE;
 
-		/* Calculate the tile offset from the rect coords */
-		tile_off_x = pDrawable->x + pGC->patOrg.x;
-		tile_off_y = pDrawable->y + pGC->patOrg.y;
+	return TRUE;
+}
 
-		tile_w = pTile->drawable.width;
-		tile_h = pTile->drawable.height;
+/*
+ * A solid fill of the whole of a private pixmap need not be drawn
+ * until something needs the pixel data: until then, users which can
+ * take the colour directly, such as Render sources, avoid reading the
+ * pixmap at all.  Returns FALSE if the fill must be drawn now.
+ */
+Bool etnaviv_pixmap_defer_fill(struct etnaviv *etnaviv,
+	struct etnaviv_pixmap *vPix, uint32_t pixel, uint32_t colour,
+	Bool opaque)
+{
+	if (!etnaviv_pixmap_private(vPix))
+		return FALSE;
 
-		pBox = RegionRects(rects);
-		while (nbox--) {
-			xPoint tile_origin;
-			int dst_y, height, tile_y;
+	/*
+	 * Collected spans may be added to without mapping the pixmap
+	 * again, so they must be drawn before the fill is deferred.
+	 */
+	if (etnaviv->span.n)
+		etnaviv_span_flush(etnaviv);
 
-			op.clip = pBox;
+	vPix->content = CT_SOLID | CT_DEFERRED | (opaque ? CT_OPAQUE : 0);
+	vPix->solid_pixel = pixel;
+	vPix->fill_colour = colour;
 
-			etnaviv_batch_start(etnaviv, &op);
+	return TRUE;
+}
+
+void etnaviv_pixmap_draw_deferred(struct etnaviv *etnaviv,
+	struct etnaviv_pixmap *vPix)
+{
+	uint8_t content = vPix->content & ~CT_DEFERRED;
+	struct etnaviv_de_op op;
+	BoxRec box;
 
-			dst_y = pBox->y1;
-			height = pBox->y2 - dst_y;
-			modulus(dst_y - tile_off_y, tile_h, tile_y);
+	/* Mapping the pixmap must not draw the fill again */
+	vPix->content = content;
 
-			tile_origin.y = tile_y;
+	if (!etnaviv_map_gpu(etnaviv, vPix, GPU_ACCESS_RW))
+		return;
 
-			while (height > 0) {
-				int dst_x, width, tile_x, h;
+	box_init(&box, 0, 0, vPix->width, vPix->height);
 
-				dst_x = pBox->x1;
-				width = pBox->x2 - dst_x;
-				modulus(dst_x - tile_off_x, tile_w, tile_x);
+	op.dst = INIT_BLIT_PIX(vPix, vPix->format, ZERO_OFFSET);
+	op.src = INIT_BLIT_NULL;
+	op.blend_op = NULL;
+	op.clip = &box;
+	op.src_origin_mode = SRC_ORIGIN_NONE;
+	op.rop = 0xf0;
+	op.cmd = VIVS_DE_DEST_CONFIG_COMMAND_BIT_BLT;
+	op.brush = BRUSH_SOLID;
+	op.fg_colour = vPix->fill_colour;
 
-				tile_origin.x = tile_x;
+	etnaviv_batch_start(etnaviv, &op);
+	etnaviv_de_op(etnaviv, &op, &box, 1);
+	etnaviv_de_end(etnaviv);
 
-				h = tile_h - tile_origin.y;
-				if (h > height)
-					h = height;
-				height -= h;
+	/* The contents are still known: they are what we just drew */
+	vPix->content = content;
+}
 
-				while (width > 0) {
-					BoxRec dst;
-					int w;
+/*
+ * Permanently convert a tiled pixmap to a linear layout, which is
+ * necessary before it can be exported to another user.
+ */
+Bool etnaviv_pixmap_linearise(struct etnaviv *etnaviv, PixmapPtr pixmap)
+{
+	struct etnaviv_pixmap *vPix = etnaviv_get_pixmap_priv(pixmap);
 
-					w = tile_w - tile_origin.x;
-					if (w > width)
-						w = width;
-					width -= w;
+	if (!vPix || !vPix->format.tile)
+		return TRUE;
 
-					box_init(&dst, dst_x, dst_y, w, h);
-					etnaviv_de_op_src_origin(etnaviv, &op,
-								 tile_origin,
-								 &dst);
+	/* A shadow in system memory can not be shared */
+	if (!etnaviv_pixmap_alloc_shadow(etnaviv, vPix) || vPix->linear_mem)
+		return FALSE;
 
-					dst_x += w;
-					tile_origin.x = 0;
-				}
-				dst_y += h;
-				tile_origin.y = 0;
-			}
+	if (vPix->state & ST_CPU_RW)
+		etna_bo_cpu_fini(vPix->linear_bo);
 
-			etnaviv_de_end(etnaviv);
+	/*
+	 * The linear copy is up to date unless the GPU has written the
+	 * tiled pixmap since the CPU last accessed it.
+	 */
+	if (vPix->state & ST_GPU_W)
+		etnaviv_pixmap_detile(etnaviv, vPix);
 
-			pBox++;
-		}
-	}
+	/* Ensure the GPU has finished with the tiled buffer */
+	etnaviv_batch_wait_commit(etnaviv, vPix);
 
-	RegionUninit(rects);
-	RegionDestroy(rects);
+	etna_bo_del(etnaviv->conn, vPix->etna_bo, NULL);
+	vPix->etna_bo = vPix->linear_bo;
+	vPix->linear_bo = NULL;
+	vPix->pitch = vPix->linear_pitch;
+	vPix->format.tile = 0;
+	vPix->cached = TRUE;
+	vPix->state &= ~ST_CPU_RW;
 
 	return TRUE;
 }
@@ -1024,7 +3297,7 @@ Bool etnaviv_accel_init(struct etnaviv *etnaviv)
 		etnaviv->gc320_wa.src_origin_mode = SRC_ORIGIN_RELATIVE;
 		etnaviv->gc320_wa.rop = 0xcc;
 		etnaviv->gc320_wa.cmd = VIVS_DE_DEST_CONFIG_COMMAND_BIT_BLT;
-		etnaviv->gc320_wa.brush = FALSE;
+		etnaviv->gc320_wa.brush = BRUSH_NONE;
 
 		/* reserve some additional batch space */
 		etnaviv->batch_de_high_watermark -= BATCH_WA_GC320_SIZE;
@@ -1040,6 +3313,8 @@ Bool etnaviv_accel_init(struct etnaviv *etnaviv)
 
 void etnaviv_accel_shutdown(struct etnaviv *etnaviv)
 {
+	unsigned i;
+
 	TimerFree(etnaviv->cache_timer);
 	etnaviv->cache_timer = NULL;
 	etna_finish(etnaviv->ctx);
@@ -1048,6 +3323,32 @@ void etnaviv_accel_shutdown(struct etnaviv *etnaviv)
 	if (etnaviv->gc320_etna_bo)
 		etna_bo_del(etnaviv->conn, etnaviv->gc320_etna_bo, NULL);
 
+	for (i = 0; i < ARRAY_SIZE(etnaviv->mono_cache); i++) {
+		struct etnaviv_mono_cache *mc = &etnaviv->mono_cache[i];
+
+		if (mc->damage) {
+			etnaviv_DamageUnregister(&mc->pixmap->drawable,
+						 mc->damage);
+			DamageDestroy(mc->damage);
+		}
+		if (mc->bo)
+			etna_bo_del(etnaviv->conn, mc->bo, NULL);
+		memset(mc, 0, sizeof(*mc));
+	}
+
+	if (etnaviv->core_atlas)
+		etna_bo_del(etnaviv->conn, etnaviv->core_atlas, NULL);
+
+	free(etnaviv->span.box);
+	etnaviv->span.box = NULL;
+	free(etnaviv->composite.box);
+	etnaviv->composite.box = NULL;
+	free(etnaviv->composite.origin);
+	etnaviv->composite.origin = NULL;
+
+	etnaviv_ring_fini(etnaviv, &etnaviv->staging);
+	etnaviv_ring_fini(etnaviv, &etnaviv->readback);
+
 	etna_free(etnaviv->ctx);
 	viv_close(etnaviv->conn);
 }
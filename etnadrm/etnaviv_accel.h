@@ -8,6 +8,7 @@
 #define VIVANTE_ACCEL_H
 
 #include "compat-list.h"
+#include "damage.h"
 #include "pixmaputil.h"
 #include "etnaviv_fence.h"
 #include "etnaviv_op.h"
@@ -15,6 +16,32 @@
 
 #include <etnaviv/viv.h>
 
+/*
+ * A GPU buffer split into slots, used in turn for transfers.  Each slot
+ * has a fence; moving on to a slot waits for the GPU to finish with it.
+ */
+#define ETNAVIV_RING_SLOTS	4
+
+struct etnaviv_ring {
+	struct etna_bo *bo;
+	uint8_t *ptr;
+	size_t slot_size;
+	size_t offset;
+	unsigned int slot;
+	struct etnaviv_fence fence[ETNAVIV_RING_SLOTS];
+};
+
+/*
+ * The drawing engine has no plane mask, so fills with a partial
+ * planemask are drawn in up to three passes.  The op carries the first
+ * pass; the rest are described here.  See etnaviv_init_fill().
+ */
+struct etnaviv_fill_passes {
+	unsigned int n;
+	uint8_t rop[3];
+	uint32_t colour[3];
+};
+
 struct armada_accel_ops;
 struct drm_armada_bo;
 struct drm_armada_bufmgr;
@@ -33,9 +60,20 @@ struct etna_bo;
 /* Accelerated operations debugging */
 #undef DEBUG_COPYNTON
 #undef DEBUG_FILLSPANS
+#undef DEBUG_SPANS
+#undef DEBUG_COMPOSITE
 #undef DEBUG_POLYFILLRECT
 #undef DEBUG_PUTIMAGE
 
+/* Number of core font glyph cache entries, must be a power of two */
+#define ETNAVIV_CORE_GLYPH_HASH	1024
+
+/* Number of rendered gradient pictures to keep */
+#define ETNAVIV_GRADIENT_CACHE	8
+
+/* Number of convolution filter kernels to keep */
+#define ETNAVIV_CONVOLUTION_CACHE	4
+
 
 /* Debugging */
 #define OP_NOP 0
@@ -53,6 +91,7 @@ enum {
 	CREATE_PIXMAP_USAGE_TILE = 0x80000000,
 	CREATE_PIXMAP_USAGE_GPU = 0x40000000,	/* Must be vpix backed */
 	CREATE_PIXMAP_USAGE_3D = 0x20000000,	/* 3D has restrictions */
+	CREATE_PIXMAP_USAGE_SCANOUT = 0x10000000, /* May be scanned out */
 };
 
 /* Workarounds for hardware bugs */
@@ -123,6 +162,7 @@ struct etnaviv {
 	CreateScreenResourcesProcPtr CreateScreenResources;
 
 	CompositeProcPtr Composite;
+	CompositeRectsProcPtr CompositeRects;
 	GlyphsProcPtr Glyphs;
 	TrapezoidsProcPtr Trapezoids;
 	TrianglesProcPtr Triangles;
@@ -130,6 +170,145 @@ struct etnaviv {
 	AddTrapsProcPtr AddTraps;
 	UnrealizeGlyphProcPtr UnrealizeGlyph;
 
+	/*
+	 * Gradient pictures rendered into pixmaps, matched against the
+	 * gradient definition.  Gradients which vary along only one axis
+	 * are held as a one pixel strip along that axis.  extent is the
+	 * area of the picture held in the pixmap.
+	 */
+	struct etnaviv_gradient {
+		PixmapPtr pixmap;
+		unsigned int type;
+		xFixed geometry[6];
+		PictTransform transform;
+		PictGradientStop *stops;
+		int nstops;
+		uint16_t repeat;
+		uint8_t axis;
+		BoxRec extent;
+		uint32_t used;
+	} gradient[ETNAVIV_GRADIENT_CACHE];
+	uint32_t gradient_used;
+
+	/*
+	 * Filter blitter kernels for Render convolution filters, matched
+	 * against the filter parameters.  Separable filters take a vertical
+	 * then a horizontal pass; others take a horizontal pass for each
+	 * non-zero kernel row, given by row[].
+	 */
+	struct etnaviv_convolution {
+		xFixed params[2 + KERNEL_INDICES * KERNEL_INDICES];
+		int nparams;
+		Bool separable;
+		uint8_t npass;
+		uint8_t row[KERNEL_INDICES];
+		uint32_t kernel[KERNEL_INDICES][KERNEL_STATE_SZ];
+	} convolution[ETNAVIV_CONVOLUTION_CACHE];
+	unsigned convolution_next;
+
+	/*
+	 * Depth-1 pixmaps uploaded for colour expansion.  Entries are
+	 * valid until damage is reported on the pixmap; those which
+	 * clients may write directly are also only valid for the
+	 * current mono_gen.
+	 */
+	struct etnaviv_mono_cache {
+		PixmapPtr pixmap;
+		unsigned long serial;
+		DamagePtr damage;
+		Bool external;
+		uint32_t gen;
+		struct etna_bo *bo;
+		unsigned pitch;
+	} mono_cache[8];
+	unsigned mono_cache_next;
+	uint32_t mono_gen;
+
+	/*
+	 * System memory pixmaps converted to A8R8G8B8 GPU pixmaps for
+	 * use as Render sources and masks.  Entries are valid until
+	 * damage is reported on the source; those which clients may
+	 * write directly are also only valid for the current mono_gen.
+	 */
+	struct etnaviv_convert_cache {
+		PixmapPtr src;
+		unsigned long serial;
+		DamagePtr damage;
+		Bool external;
+		uint32_t gen;
+		PictFormatPtr format;
+		PixmapPtr pixmap;
+	} convert_cache[4];
+	unsigned convert_cache_next;
+
+	/*
+	 * Core font glyphs, packed into a 1bpp atlas and looked up by
+	 * font and glyph.  All entries are dropped when the atlas fills.
+	 */
+	struct etnaviv_core_glyph {
+		FontPtr font;
+		CharInfoPtr pci;
+		uint16_t x;
+		uint16_t y;
+	} core_glyph[ETNAVIV_CORE_GLYPH_HASH];
+	struct etna_bo *core_atlas;
+	uint8_t *core_atlas_ptr;
+	uint16_t core_atlas_x;
+	uint16_t core_atlas_y;
+	uint16_t core_atlas_row;
+	UnrealizeFontProcPtr UnrealizeFont;
+
+	/*
+	 * Spans generated while drawing arcs, polygons and wide lines,
+	 * collected as boxes and drawn together.  The boxes have been
+	 * clipped to the extents of the clip region.
+	 */
+	struct etnaviv_span_acc {
+		struct etnaviv_de_op op;
+		struct etnaviv_fill_passes passes;
+		DrawablePtr drawable;
+		GCPtr gc;
+		RegionPtr clip;
+		unsigned long planemask;
+		uint32_t fg;
+		uint8_t alu;
+		BoxPtr box;
+		unsigned int n;
+		unsigned int size;
+		unsigned int depth;
+		Bool flushing;
+#ifdef DEBUG_SPANS
+		unsigned int spans;
+		unsigned int draws;
+		unsigned int submits;
+#endif
+	} span;
+
+	/*
+	 * Final composite blends waiting to be drawn, collected while
+	 * consecutive composites share the source, destination and
+	 * blend.  See etnaviv_composite_queue().
+	 */
+	struct etnaviv_composite_acc {
+		struct etnaviv_de_op op;
+		struct etnaviv_blend_op blend;
+		BoxRec clip;
+		BoxPtr box;
+		xPoint *origin;
+		unsigned int n;
+		unsigned int size;
+		Bool relative;
+		Bool flushing;
+#ifdef DEBUG_COMPOSITE
+		unsigned int composites;
+#endif
+	} composite;
+
+	/* Staging buffer for small PutImage uploads */
+	struct etnaviv_ring staging;
+	/* Cached buffer for GetImage readback */
+	struct etnaviv_ring readback;
+
 	struct etnaviv_xv_priv *xv;
 	unsigned xv_ports;
 	CloseScreenProcPtr xv_CloseScreen;
@@ -158,6 +337,49 @@ struct etnaviv_pixmap {
 #endif
 	struct drm_armada_bo *bo;
 	struct etna_bo *etna_bo;
+	/*
+	 * Linear shadow of a tiled pixmap, used for CPU access.  This
+	 * is allocated on first use, and is in system memory, linear_mem,
+	 * if GPU memory could not be allocated.
+	 */
+	struct etna_bo *linear_bo;
+	void *linear_mem;
+	unsigned linear_pitch;
+	/* Expanded copy of a small tile, for tiled fills */
+	struct etna_bo *strip_bo;
+	unsigned short strip_width;
+	unsigned short strip_height;
+	unsigned strip_pitch;
+	Bool strip_valid;
+	/*
+	 * What is known about the pixmap contents.  Any write which is
+	 * not accounted for forgets it.  A solid fill of the whole pixmap
+	 * may be deferred until something needs the pixel data, in which
+	 * case fill_colour is the brush colour which draws solid_pixel.
+	 */
+	uint8_t content;
+#define CT_OPAQUE	(1 << 0)	/* 32bpp, every top byte is 0xff */
+#define CT_SOLID	(1 << 1)	/* every pixel is solid_pixel */
+#define CT_DEFERRED	(1 << 2)	/* the solid fill is not yet drawn */
+	uint32_t solid_pixel;
+	uint32_t fill_colour;
+	/* Number of CPU accesses following GPU use */
+	uint8_t cpu_reads;
+	Bool cached;
+	Bool shared;
+	/*
+	 * System memory copy for pixmaps in use by both the CPU and GPU.
+	 * Drawing is tracked by damage, and attributed to whichever side
+	 * was writing.  Only the damaged areas are copied when the other
+	 * side next needs the pixmap.
+	 */
+	Bool migratable;
+	int8_t score;
+	uint8_t cpp;
+	void *sys_ptr;
+	DamagePtr damage;
+	RegionRec cpu_damage;	/* system copy newer than the GPU copy */
+	RegionRec gpu_damage;	/* GPU copy newer than the system copy */
 	uint32_t name;
 	unsigned int refcnt;
 };
@@ -210,6 +432,31 @@ Bool etnaviv_accel_PolyFillRectSolid(DrawablePtr pDrawable, GCPtr pGC, int n,
 	xRectangle * prect);
 Bool etnaviv_accel_PolyFillRectTiled(DrawablePtr pDrawable, GCPtr pGC, int n,
 	xRectangle * prect);
+Bool etnaviv_accel_PolyFillRectStippled(DrawablePtr pDrawable, GCPtr pGC,
+	int n, xRectangle * prect);
+void etnaviv_accel_Copy1toN(DrawablePtr pSrc, DrawablePtr pDst,
+	GCPtr pGC, BoxPtr pBox, int nBox, int dx, int dy, Bool reverse,
+	Bool upsidedown, Pixel bitPlane, void *closure);
+Bool etnaviv_accel_PushPixels(GCPtr pGC, PixmapPtr pBitmap,
+	DrawablePtr pDrawable, int w, int h, int x, int y);
+Bool etnaviv_accel_expand_bitmap(struct etnaviv *etnaviv,
+	struct etnaviv_pixmap *vDst, PixmapPtr pBitmap,
+	uint32_t fg, uint32_t bg);
+Bool etnaviv_accel_GlyphBlt(DrawablePtr pDrawable, GCPtr pGC,
+	int x, int y, unsigned int nglyph, CharInfoPtr *ppci,
+	pointer pglyphBase, Bool image);
+void etnaviv_accel_UnrealizeFont(struct etnaviv *etnaviv, FontPtr pFont);
+Bool etnaviv_accel_FillPolygon(DrawablePtr pDrawable, GCPtr pGC,
+	int shape, int mode, int count, DDXPointPtr pPts);
+Bool etnaviv_accel_PolyFillArc(DrawablePtr pDrawable, GCPtr pGC,
+	int narcs, xArc *parcs);
+
+void etnaviv_span_begin(struct etnaviv *etnaviv);
+void etnaviv_span_end(struct etnaviv *etnaviv);
+void etnaviv_span_flush(struct etnaviv *etnaviv);
+void etnaviv_composite_queue(struct etnaviv *etnaviv,
+	const struct etnaviv_de_op *op, const BoxRec *pBox, unsigned int nBox);
+void etnaviv_composite_flush(struct etnaviv *etnaviv);
 
 void etnaviv_commit(struct etnaviv *etnaviv, Bool stall);
 void etnaviv_finish_fences(struct etnaviv *etnaviv, uint32_t fence);
@@ -217,6 +464,23 @@ void etnaviv_finish_fences(struct etnaviv *etnaviv, uint32_t fence);
 void etnaviv_batch_wait_commit(struct etnaviv *etnaviv, struct etnaviv_pixmap *vPix);
 void etnaviv_batch_start(struct etnaviv *etnaviv,
 	const struct etnaviv_de_op *op);
+void etnaviv_vr_start(struct etnaviv *etnaviv, struct etnaviv_pixmap *vSrc,
+	struct etnaviv_pixmap *vDst);
+
+Bool etnaviv_pixmap_alloc_shadow(struct etnaviv *etnaviv,
+	struct etnaviv_pixmap *vPix);
+void etnaviv_pixmap_detile(struct etnaviv *etnaviv,
+	struct etnaviv_pixmap *vPix);
+void etnaviv_pixmap_retile(struct etnaviv *etnaviv,
+	struct etnaviv_pixmap *vPix);
+Bool etnaviv_pixmap_linearise(struct etnaviv *etnaviv, PixmapPtr pixmap);
+Bool etnaviv_pixmap_set_cached(struct etnaviv *etnaviv,
+	struct etnaviv_pixmap *vPix);
+Bool etnaviv_pixmap_defer_fill(struct etnaviv *etnaviv,
+	struct etnaviv_pixmap *vPix, uint32_t pixel, uint32_t colour,
+	Bool opaque);
+void etnaviv_pixmap_draw_deferred(struct etnaviv *etnaviv,
+	struct etnaviv_pixmap *vPix);
 
 void etnaviv_accel_shutdown(struct etnaviv *);
 Bool etnaviv_accel_init(struct etnaviv *);
@@ -240,6 +504,33 @@ static inline struct etnaviv_pixmap *etnaviv_drawable(DrawablePtr pDrawable)
 	return etnaviv_get_pixmap_priv(pix);
 }
 
+/*
+ * Only private pixmaps which nothing else can write may have their
+ * contents tracked.
+ */
+static inline Bool etnaviv_pixmap_private(struct etnaviv_pixmap *vPix)
+{
+	return vPix->etna_bo && !vPix->shared && !vPix->bo && !vPix->name &&
+	       !vPix->sys_ptr && !(vPix->state & ST_DMABUF);
+}
+
+/* Does a box, offset into pixmap coordinates, cover the whole pixmap? */
+static inline Bool etnaviv_pixmap_covered(struct etnaviv_pixmap *vPix,
+	const BoxRec *box, xPoint offset)
+{
+	return box->x1 + offset.x <= 0 && box->y1 + offset.y <= 0 &&
+	       box->x2 + offset.x >= vPix->width &&
+	       box->y2 + offset.y >= vPix->height;
+}
+
+/* Draw any deferred fill before the pixel data is used */
+static inline void etnaviv_pixmap_realise(struct etnaviv *etnaviv,
+	struct etnaviv_pixmap *vPix)
+{
+	if (vPix->content & CT_DEFERRED)
+		etnaviv_pixmap_draw_deferred(etnaviv, vPix);
+}
+
 static inline struct etnaviv *etnaviv_get_screen_priv(ScreenPtr pScreen)
 {
 	extern etnaviv_Key etnaviv_screen_index;
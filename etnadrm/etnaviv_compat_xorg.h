@@ -17,4 +17,10 @@
 #define etnaviv_Key                  int
 #endif
 
+#if XORG_VERSION_CURRENT < XORG_VERSION_NUMERIC(1,14,99,2,0)
+#define etnaviv_DamageUnregister(d, dd) DamageUnregister(d, dd)
+#else
+#define etnaviv_DamageUnregister(d, dd) DamageUnregister(dd)
+#endif
+
 #endif
@@ -39,12 +39,40 @@ struct etnaviv_dri2_info {
 	char *devname;
 };
 
+/*
+ * Back buffers which are the same size as an active CRTC are likely
+ * to end up being flipped to, so allocate them as scanout buffers.
+ */
+static Bool etnaviv_dri2_crtc_sized(DrawablePtr drawable,
+	unsigned int attachment)
+{
+	ScrnInfoPtr pScrn = xf86ScreenToScrn(drawable->pScreen);
+	xf86CrtcConfigPtr config = XF86_CRTC_CONFIG_PTR(pScrn);
+	int i;
+
+	if (attachment != DRI2BufferBackLeft &&
+	    attachment != DRI2BufferBackRight)
+		return FALSE;
+
+	for (i = 0; i < config->num_crtc; i++) {
+		xf86CrtcPtr crtc = config->crtc[i];
+
+		if (crtc->enabled &&
+		    crtc->mode.HDisplay == drawable->width &&
+		    crtc->mode.VDisplay == drawable->height)
+			return TRUE;
+	}
+
+	return FALSE;
+}
+
 static DRI2Buffer2Ptr etnaviv_dri2_CreateBuffer(DrawablePtr drawable,
 	unsigned int attachment, unsigned int format)
 {
 	struct common_dri2_buffer *buf;
 	ScreenPtr pScreen = drawable->pScreen;
 	PixmapPtr pixmap = NULL;
+	unsigned usage;
 	uint32_t name;
 
 	buf = calloc(1, sizeof *buf);
@@ -64,9 +92,12 @@ static DRI2Buffer2Ptr etnaviv_dri2_CreateBuffer(DrawablePtr drawable,
 	}
 
 	if (pixmap == NULL) {
+		usage = CREATE_PIXMAP_USAGE_GPU | CREATE_PIXMAP_USAGE_3D;
+		if (etnaviv_dri2_crtc_sized(drawable, attachment))
+			usage |= CREATE_PIXMAP_USAGE_SCANOUT;
+
 		pixmap = common_dri2_create_pixmap(drawable, attachment, format,
-						   CREATE_PIXMAP_USAGE_GPU |
-						   CREATE_PIXMAP_USAGE_3D);
+						   usage);
 		if (!pixmap)
 			goto err;
 	}
@@ -31,6 +31,7 @@
 
 #include "etnaviv_accel.h"
 #include "etnaviv_dri3.h"
+#include "etnaviv_utils.h"
 
 #include <etnaviv/etna_bo.h>
 #include "etnaviv_compat.h"
@@ -92,6 +93,21 @@ static int etnaviv_dri3_fd_from_pixmap(ScreenPtr pScreen, PixmapPtr pixmap,
 	if (!vPix || !vPix->etna_bo)
 		return -1;
 
+	/* Other users will read the pixel data, and may write it */
+	etnaviv_pixmap_realise(etnaviv, vPix);
+	vPix->content = 0;
+
+	/* Other users expect a linear buffer */
+	if (!etnaviv_pixmap_linearise(etnaviv, pixmap))
+		return -1;
+
+	/*
+	 * Shared pixmaps must keep their bo, and other users will
+	 * not see a system memory copy.
+	 */
+	etnaviv_pixmap_free_sys(pixmap, TRUE);
+	vPix->shared = TRUE;
+
 	*stride = pixmap->devKind;
 	*size = etna_bo_size(vPix->etna_bo);
 
@@ -2,6 +2,8 @@
 #include "config.h"
 #endif
 
+#include <math.h>
+
 #include "xf86.h"
 #include "fb.h"
 
@@ -144,6 +146,16 @@ static void etnaviv_set_source_bo(struct etnaviv *etnaviv,
 	EL_END();
 }
 
+static void etnaviv_emit_mono_colours(struct etnaviv *etnaviv,
+	const struct etnaviv_de_op *op)
+{
+	EL_START(etnaviv, 4);
+	EL(LOADSTATE(VIVS_DE_SRC_COLOR_BG, 2));
+	EL(op->bg_colour);
+	EL(op->fg_colour);
+	EL_END();
+}
+
 static void etnaviv_set_dest_bo(struct etnaviv *etnaviv,
 	const struct etnaviv_blit_buf *buf, uint32_t cmd)
 {
@@ -195,6 +207,24 @@ static void etnaviv_emit_brush(struct etnaviv *etnaviv, uint32_t fg)
 	EL_END();
 }
 
+static void etnaviv_emit_pattern(struct etnaviv *etnaviv,
+	const struct etnaviv_blit_buf *pat)
+{
+	EL_START(etnaviv, 8);
+	EL(LOADSTATE(VIVS_DE_PATTERN_ADDRESS, 2));
+	EL_RELOC(pat->bo, 0, FALSE);
+	EL(VIVS_DE_PATTERN_CONFIG_FORMAT(pat->format.format) |
+	   VIVS_DE_PATTERN_CONFIG_TYPE_PATTERN |
+	   VIVS_DE_PATTERN_CONFIG_ORIGIN_X(pat->offset.x & 7) |
+	   VIVS_DE_PATTERN_CONFIG_ORIGIN_Y(pat->offset.y & 7) |
+	   VIVS_DE_PATTERN_CONFIG_INIT_TRIGGER(3));
+	EL_ALIGN();
+	EL(LOADSTATE(VIVS_DE_PATTERN_MASK_LOW, 2));
+	EL(~0);
+	EL(~0);
+	EL_END();
+}
+
 static void etnaviv_set_blend(struct etnaviv *etnaviv,
 	const struct etnaviv_blend_op *op)
 {
@@ -219,9 +249,10 @@ static void etnaviv_set_blend(struct etnaviv *etnaviv,
 
 		if (pe20) {
 			EL(LOADSTATE(VIVS_DE_GLOBAL_SRC_COLOR, 3));
-			EL(op->src_alpha << 24);
+			EL(op->src_alpha << 24 | op->src_colour);
 			EL(op->dst_alpha << 24);
-			EL(VIVS_DE_COLOR_MULTIPLY_MODES_SRC_PREMULTIPLY_DISABLE |
+			EL(op->multiply_mode ? op->multiply_mode :
+			   VIVS_DE_COLOR_MULTIPLY_MODES_SRC_PREMULTIPLY_DISABLE |
 			   VIVS_DE_COLOR_MULTIPLY_MODES_DST_PREMULTIPLY_DISABLE |
 			   VIVS_DE_COLOR_MULTIPLY_MODES_SRC_GLOBAL_PREMULTIPLY_DISABLE |
 			   VIVS_DE_COLOR_MULTIPLY_MODES_DST_DEMULTIPLY_DISABLE);
@@ -272,13 +303,22 @@ static void etnaviv_emit_2d_draw(struct etnaviv *etnaviv, const BoxRec *pbox,
 
 static void de_start(struct etnaviv *etnaviv, const struct etnaviv_de_op *op)
 {
-	if (op->src.bo)
+	unsigned bg_rop = op->rop;
+
+	if (op->src.bo && op->brush != BRUSH_PATTERN) {
 		etnaviv_set_source_bo(etnaviv, &op->src, op->src_origin_mode);
+		if (op->src.format.format == DE_FORMAT_MONOCHROME) {
+			etnaviv_emit_mono_colours(etnaviv, op);
+			bg_rop = op->bg_rop;
+		}
+	}
 	etnaviv_set_dest_bo(etnaviv, &op->dst, op->cmd);
 	etnaviv_set_blend(etnaviv, op->blend_op);
-	if (op->brush)
+	if (op->brush == BRUSH_SOLID)
 		etnaviv_emit_brush(etnaviv, op->fg_colour);
-	etnaviv_emit_rop_clip(etnaviv, op->rop, op->rop, op->clip,
+	else if (op->brush == BRUSH_PATTERN)
+		etnaviv_emit_pattern(etnaviv, &op->src);
+	etnaviv_emit_rop_clip(etnaviv, op->rop, bg_rop, op->clip,
 			      op->dst.offset);
 	etnaviv_emit_src_rotate(etnaviv, &op->src);
 }
@@ -515,3 +555,124 @@ void etnaviv_flush(struct etnaviv *etnaviv)
 	etna_set_state(ctx, VIVS_GL_FLUSH_CACHE, VIVS_GL_FLUSH_CACHE_PE2D);
 	etna_set_state(ctx, VIVS_GL_FLUSH_CACHE, VIVS_GL_FLUSH_CACHE_PE2D);
 }
+
+static inline float sinc(float x)
+{
+	return x != 0.0 ? sinf(x) / x : 1.0;
+}
+
+static float etnaviv_filter_tap(enum etnaviv_filter filter, float x)
+{
+	float radius = 4.0;
+
+	switch (filter) {
+	case ETNAVIV_FILTER_NEAREST:
+		return x > -0.5 && x <= 0.5 ? 1.0 : 0.0;
+
+	case ETNAVIV_FILTER_BILINEAR:
+		return fabs(x) < 1.0 ? 1.0 - fabs(x) : 0.0;
+
+	case ETNAVIV_FILTER_LANCZOS:
+		if (fabs(x) <= radius)
+			return sinc(M_PI * x) * sinc(M_PI * x / radius);
+		break;
+	}
+
+	return 0.0;
+}
+
+/* Convert 1.14 format kernel values into VIVS_DE_FILTER_KERNEL states */
+static void etnaviv_kernel_states(uint32_t *state, const int16_t *kernel_val)
+{
+	unsigned i;
+
+	for (i = 0; i < KERNEL_STATE_SZ * 2; i += 2)
+		state[i / 2] =
+			VIVS_DE_FILTER_KERNEL_COEFFICIENT0(kernel_val[i]) |
+			VIVS_DE_FILTER_KERNEL_COEFFICIENT1(kernel_val[i + 1]);
+}
+
+/*
+ * Some interesting observations of the kernel.  According to the etnaviv
+ * rnndb files:
+ *  - there are 128 states which hold the kernel.
+ *  - each entry contains 9 coefficients (one for each filter tap).
+ *  - the entries are indexed by 5 bits from the fractional coordinate
+ *    (which makes 32 entries.)
+ *
+ * As the kernel table is symmetrical around the centre of the fractional
+ * coordinate, only half of the entries need to be stored.  In other words,
+ * these pairs of indices should be the same:
+ *
+ *  00=31 01=30 02=29 03=28 04=27 05=26 06=25 07=24
+ *  08=23 09=22 10=21 11=20 12=19 13=18 14=17 15=16
+ *
+ * This means that there are only 16 entries.  However, etnaviv
+ * documentation says 17 are required.  What's the additional entry?
+ *
+ * The next issue is that the filter code always produces zero for the
+ * ninth filter tap.  If this is always zero, what's the point of having
+ * hardware deal with nine filter taps?  This makes no sense to me.
+ *
+ * The result is suitable for loading into VIVS_DE_FILTER_KERNEL.
+ */
+void etnaviv_filter_kernel(uint32_t *state, enum etnaviv_filter filter)
+{
+	unsigned row, idx, i;
+	int16_t kernel_val[KERNEL_STATE_SZ * 2];
+	float row_ofs = 0.5;
+
+	for (row = i = 0; row < KERNEL_ROWS; row++) {
+		float kernel[KERNEL_INDICES] = { 0.0 };
+		float sum = 0.0;
+
+		for (idx = 0; idx < KERNEL_INDICES; idx++) {
+			kernel[idx] = etnaviv_filter_tap(filter,
+							 idx - 4.0 + row_ofs);
+			sum += kernel[idx];
+		}
+
+		/* normalise the row */
+		if (sum)
+			for (idx = 0; idx < KERNEL_INDICES; idx++)
+				kernel[idx] /= sum;
+
+		/* convert to 1.14 format */
+		for (idx = 0; idx < KERNEL_INDICES; idx++) {
+			int val = kernel[idx] * (float)(1 << 14);
+
+			if (val < -0x8000)
+				val = -0x8000;
+			else if (val > 0x7fff)
+				val = 0x7fff;
+
+			kernel_val[i++] = val;
+		}
+
+		row_ofs -= 1.0 / ((KERNEL_ROWS - 1) * 2);
+	}
+
+	kernel_val[KERNEL_SIZE] = 0;
+
+	etnaviv_kernel_states(state, kernel_val);
+}
+
+/*
+ * Build a kernel which applies the same 1.14 format taps at every
+ * fractional coordinate.  At unit scale, the filter blitter then
+ * convolves the source with the taps, the centre tap reading the
+ * source pixel itself.
+ */
+void etnaviv_filter_kernel_taps(uint32_t *state, const int16_t *taps)
+{
+	int16_t kernel_val[KERNEL_STATE_SZ * 2];
+	unsigned row, idx, i;
+
+	for (row = i = 0; row < KERNEL_ROWS; row++)
+		for (idx = 0; idx < KERNEL_INDICES; idx++)
+			kernel_val[i++] = taps[idx];
+
+	kernel_val[KERNEL_SIZE] = 0;
+
+	etnaviv_kernel_states(state, kernel_val);
+}
@@ -32,6 +32,12 @@ struct etnaviv_blend_op {
 	uint8_t dst_mode;	/* DE_BLENDMODE_xx */
 	uint8_t src_alpha;
 	uint8_t dst_alpha;
+	/*
+	 * PE2.0 only: the RGB of the global source colour, and the
+	 * colour multiply modes.  Zero leaves multiplication disabled.
+	 */
+	uint32_t src_colour;
+	uint32_t multiply_mode;
 };
 
 struct etnaviv_blit_buf {
@@ -75,6 +81,15 @@ struct etnaviv_blit_buf {
 #define SRC_ORIGIN_ABSOLUTE	1
 #define SRC_ORIGIN_RELATIVE	2
 
+/*
+ * Brush types.  A solid brush uses fg_colour; a pattern brush uses an
+ * 8x8 pattern described by the source buffer, with the pattern origin
+ * in the source offset.
+ */
+#define BRUSH_NONE		0
+#define BRUSH_SOLID		1
+#define BRUSH_PATTERN		2
+
 struct etnaviv_de_op {
 	struct etnaviv_blit_buf dst;
 	struct etnaviv_blit_buf src;
@@ -83,8 +98,14 @@ struct etnaviv_de_op {
 	uint8_t src_origin_mode;
 	uint8_t rop;
 	unsigned cmd;
-	Bool brush;
+	uint8_t brush;
 	uint32_t fg_colour;
+	/*
+	 * Monochrome sources are expanded to fg_colour and bg_colour.
+	 * Source pixels which are clear use bg_rop rather than rop.
+	 */
+	uint32_t bg_colour;
+	uint8_t bg_rop;
 };
 
 struct etnaviv_vr_op {
@@ -99,6 +120,17 @@ struct etnaviv_vr_op {
 	unsigned vr_op;
 };
 
+#define KERNEL_ROWS	17
+#define KERNEL_INDICES	9
+#define KERNEL_SIZE	(KERNEL_ROWS * KERNEL_INDICES)
+#define KERNEL_STATE_SZ	((KERNEL_SIZE + 1) / 2)
+
+enum etnaviv_filter {
+	ETNAVIV_FILTER_NEAREST,
+	ETNAVIV_FILTER_BILINEAR,
+	ETNAVIV_FILTER_LANCZOS,
+};
+
 void etnaviv_de_start(struct etnaviv *etnaviv, const struct etnaviv_de_op *op);
 void etnaviv_de_end(struct etnaviv *etnaviv);
 void etnaviv_de_op_src_origin(struct etnaviv *etnaviv,
@@ -110,5 +142,7 @@ void etnaviv_vr_op(struct etnaviv *etnaviv, struct etnaviv_vr_op *op,
 	const BoxRec *boxes, size_t n);
 void etnaviv_emit(struct etnaviv *etnaviv);
 void etnaviv_flush(struct etnaviv *etnaviv);
+void etnaviv_filter_kernel(uint32_t *state, enum etnaviv_filter filter);
+void etnaviv_filter_kernel_taps(uint32_t *state, const int16_t *taps);
 
 #endif
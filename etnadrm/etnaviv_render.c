@@ -11,6 +11,8 @@
 #include <errno.h>
 #include <stdarg.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 #include <sys/mman.h>
 #include <unistd.h>
 
@@ -38,6 +40,7 @@
 #include "etnaviv_render.h"
 #include "etnaviv_utils.h"
 
+#include <etnaviv/etna.h>
 #include <etnaviv/etna_bo.h>
 #include <etnaviv/common.xml.h>
 #include <etnaviv/state_2d.xml.h>
@@ -52,6 +55,7 @@ struct etnaviv_composite_state {
 	struct etnaviv_blend_op final_blend;
 	struct etnaviv_de_op final_op;
 	PixmapPtr pPixTemp;
+	PixmapPtr pPixMask;
 	RegionRec region;
 #ifdef DEBUG_BLEND
 	CARD8 op;
@@ -100,6 +104,9 @@ static struct etnaviv_format etnaviv_pict_format(PictFormatShort fmt)
 	};
 }
 
+/* Filter blitter kernels for scaled pictures, indexed by etnaviv_filter */
+static uint32_t etnaviv_render_kernel[ETNAVIV_FILTER_LANCZOS + 1][KERNEL_STATE_SZ];
+
 #ifdef DEBUG_BLEND
 static void etnaviv_debug_blend_op(const char *func,
 	CARD8 op, CARD16 width, CARD16 height,
@@ -238,6 +245,20 @@ static Bool etnaviv_blend_src_alpha_normal(struct etnaviv_blend_op *op)
 		VIVS_DE_ALPHA_MODES_GLOBAL_SRC_ALPHA_MODE_NORMAL;
 }
 
+/*
+ * Does blending a solid colour reduce to replacing the destination,
+ * so that the colour can be drawn as a plain fill?
+ */
+static Bool etnaviv_blend_replaces(const struct etnaviv_blend_op *blend,
+	uint32_t colour)
+{
+	return blend->alpha_mode == 0 &&
+	       blend->src_mode == DE_BLENDMODE_ONE &&
+	       (blend->dst_mode == DE_BLENDMODE_ZERO ||
+		(blend->dst_mode == DE_BLENDMODE_INVERSED &&
+		 colour >> 24 == 0xff));
+}
+
 static Bool etnaviv_fill_single(struct etnaviv *etnaviv,
 	struct etnaviv_pixmap *vPix, const BoxRec *clip, uint32_t colour)
 {
@@ -245,7 +266,7 @@ static Bool etnaviv_fill_single(struct etnaviv *etnaviv,
 		.clip = clip,
 		.rop = 0xf0,
 		.cmd = VIVS_DE_DEST_CONFIG_COMMAND_BIT_BLT,
-		.brush = TRUE,
+		.brush = BRUSH_SOLID,
 		.fg_colour = colour,
 	};
 
@@ -273,7 +294,7 @@ static Bool etnaviv_blend(struct etnaviv *etnaviv, const BoxRec *clip,
 		.src_origin_mode = SRC_ORIGIN_RELATIVE,
 		.rop = 0xcc,
 		.cmd = VIVS_DE_DEST_CONFIG_COMMAND_BIT_BLT,
-		.brush = FALSE,
+		.brush = BRUSH_NONE,
 	};
 
 	if (!etnaviv_map_gpu(etnaviv, vDst, GPU_ACCESS_RW) ||
@@ -319,6 +340,71 @@ static struct etnaviv_pixmap *etnaviv_get_scratch_argb(ScreenPtr pScreen,
 	return vpix;
 }
 
+/*
+ * picture_is_solid() only recognises 1x1 repeating drawables, and reads
+ * their pixel back from the pixmap.  Repeating pixmaps which we know to
+ * be solid need neither the readback nor the 1x1 size.  Outside a
+ * non-repeating drawable pixels are transparent, and the composite
+ * region does not exclude them, so such pictures are not solid.
+ */
+static Bool etnaviv_picture_is_solid(PicturePtr pict, CARD32 *pixel)
+{
+	if (pict->pDrawable && !pict->alphaMap && pict->repeat &&
+	    pict->filter != PictFilterConvolution) {
+		struct etnaviv_pixmap *vPix = etnaviv_drawable(pict->pDrawable);
+
+		if (vPix && vPix->content & CT_SOLID) {
+			*pixel = vPix->solid_pixel;
+			return TRUE;
+		}
+	}
+
+	return picture_is_solid(pict, pixel);
+}
+
+/* Is the alpha of this format the top byte of a 32bpp pixel? */
+static Bool etnaviv_pict_alpha_top(PictFormatShort format)
+{
+	return PICT_FORMAT_BPP(format) == 32 && PICT_FORMAT_A(format) == 8 &&
+	       (PICT_FORMAT_TYPE(format) == PICT_TYPE_ARGB ||
+		PICT_FORMAT_TYPE(format) == PICT_TYPE_ABGR);
+}
+
+/*
+ * Is every pixel the picture supplies over area, in drawable coordinates,
+ * opaque?  As above, non-repeating pictures supply transparent pixels
+ * outside the drawable, so unless the picture repeats, the untransformed
+ * area must lie within the drawable.  Convolution filters may reduce the
+ * alpha.
+ */
+static Bool etnaviv_pict_opaque(PicturePtr pict, const BoxRec *area)
+{
+	struct etnaviv_pixmap *vPix;
+
+	if (!pict->pDrawable || pict->alphaMap ||
+	    pict->filter == PictFilterConvolution)
+		return FALSE;
+
+	if (!pict->repeat &&
+	    (pict->transform || !drawable_contains_box(pict->pDrawable, area)))
+		return FALSE;
+
+	if (PICT_FORMAT_A(pict->format) == 0)
+		return TRUE;
+
+	vPix = etnaviv_drawable(pict->pDrawable);
+
+	return vPix && vPix->content & CT_OPAQUE &&
+	       etnaviv_pict_alpha_top(pict->format);
+}
+
+/* Does the picture read the pixel data of this pixmap? */
+static Bool etnaviv_pict_reads(PicturePtr pict, struct etnaviv_pixmap *vPix)
+{
+	return pict && pict->pDrawable &&
+	       etnaviv_drawable(pict->pDrawable) == vPix;
+}
+
 static Bool etnaviv_pict_solid_argb(PicturePtr pict, uint32_t *col)
 {
 	unsigned r, g, b, a, rbits, gbits, bbits, abits;
@@ -327,7 +413,7 @@ static Bool etnaviv_pict_solid_argb(PicturePtr pict, uint32_t *col)
 	CARD32 pixel;
 	uint32_t argb;
 
-	if (!picture_is_solid(pict, &pixel))
+	if (!etnaviv_picture_is_solid(pict, &pixel))
 		return FALSE;
 
 	pFormat = pict->pFormat;
@@ -431,6 +517,192 @@ static Bool etnaviv_workaround_nonalpha(struct etnaviv_format *fmt)
 	return FALSE;
 }
 
+/*
+ * Pictures in system memory pixmaps - depth-1 bitmaps, 24bpp and 4bpp
+ * pixmaps, and those we could not allocate on the GPU - can not be read
+ * by the GPU.  Rather than converting the composited area on the CPU for
+ * every operation, convert the whole pixmap once into an A8R8G8B8 GPU
+ * pixmap, and keep it until Damage reports a change to the source.  a1
+ * bitmaps are expanded by the drawing engine, everything else is
+ * converted by pixman.
+ */
+#define CONVERT_MAX_AREA	(1024 * 1024)
+
+static void etnaviv_convert_damage_destroy(DamagePtr damage, void *closure)
+{
+	struct etnaviv_convert_cache *cc = closure;
+
+	cc->damage = NULL;
+}
+
+static void etnaviv_convert_release(ScreenPtr pScreen,
+	struct etnaviv_convert_cache *cc)
+{
+	if (cc->damage) {
+		DamagePtr damage = cc->damage;
+
+		cc->damage = NULL;
+		etnaviv_DamageUnregister(&cc->src->drawable, damage);
+		DamageDestroy(damage);
+	}
+	if (cc->pixmap)
+		pScreen->DestroyPixmap(cc->pixmap);
+	memset(cc, 0, sizeof(*cc));
+}
+
+static Bool etnaviv_convert_render(ScreenPtr pScreen, PicturePtr pict,
+	PixmapPtr pSrc, PixmapPtr pixmap)
+{
+	struct etnaviv *etnaviv = etnaviv_get_screen_priv(pScreen);
+	struct etnaviv_pixmap *vPix = etnaviv_get_pixmap_priv(pixmap);
+	PicturePtr src;
+	Bool ret;
+	int err;
+
+	if (pict->format == PICT_a1)
+		return etnaviv_accel_expand_bitmap(etnaviv, vPix, pSrc,
+						   0xff000000, 0);
+
+	/* A plain picture, without the source picture's transform */
+	src = CreatePicture(0, &pSrc->drawable, pict->pFormat, 0, 0,
+			    serverClient, &err);
+	if (!src)
+		return FALSE;
+
+	ret = etnaviv_composite_to_pixmap(PictOpSrc, src, NULL, pixmap,
+					  0, 0, 0, 0,
+					  pSrc->drawable.width,
+					  pSrc->drawable.height);
+
+	FreePicture(src, 0);
+
+	return ret;
+}
+
+static struct etnaviv_pixmap *etnaviv_acquire_converted(ScreenPtr pScreen,
+	PicturePtr pict)
+{
+	struct etnaviv *etnaviv = etnaviv_get_screen_priv(pScreen);
+	struct etnaviv_convert_cache *cc, *victim = NULL;
+	PixmapPtr pSrc, pixmap;
+	DamagePtr damage;
+	unsigned i;
+
+	if (pict->pDrawable->type != DRAWABLE_PIXMAP || pict->alphaMap)
+		return NULL;
+
+	pSrc = drawable_pixmap(pict->pDrawable);
+
+	/*
+	 * An entry remains valid while its source pixmap is undamaged.
+	 * Once damaged, it is replaced by the new conversion.  Damage
+	 * can not see clients writing external pixmaps, so conversions
+	 * of these are only valid for the current mono_gen.
+	 */
+	for (i = 0; i < ARRAY_SIZE(etnaviv->convert_cache); i++) {
+		cc = &etnaviv->convert_cache[i];
+		if (!cc->pixmap || !cc->damage || cc->src != pSrc ||
+		    cc->serial != pSrc->drawable.serialNumber ||
+		    cc->format != pict->pFormat)
+			continue;
+
+		if (!RegionNotEmpty(DamageRegion(cc->damage)) &&
+		    (!cc->external || cc->gen == etnaviv->mono_gen))
+			return etnaviv_get_pixmap_priv(cc->pixmap);
+
+		victim = cc;
+		break;
+	}
+
+	/*
+	 * Glyph sized pictures are usually used once, and cost less
+	 * to convert on each use than to allocate a GPU pixmap for.
+	 */
+	if (pSrc->drawable.width * pSrc->drawable.height > CONVERT_MAX_AREA ||
+	    (!pict->repeat &&
+	     pSrc->drawable.width <= 32 && pSrc->drawable.height <= 32))
+		return NULL;
+
+	if (!victim) {
+		i = etnaviv->convert_cache_next++ %
+			ARRAY_SIZE(etnaviv->convert_cache);
+		victim = &etnaviv->convert_cache[i];
+	}
+	etnaviv_convert_release(pScreen, victim);
+
+	pixmap = pScreen->CreatePixmap(pScreen, pSrc->drawable.width,
+				       pSrc->drawable.height, 32,
+				       CREATE_PIXMAP_USAGE_GPU);
+	if (!pixmap)
+		return NULL;
+
+	if (!etnaviv_get_pixmap_priv(pixmap)) {
+		pScreen->DestroyPixmap(pixmap);
+		return NULL;
+	}
+
+	etnaviv_get_pixmap_priv(pixmap)->pict_format =
+		etnaviv_pict_format(PICT_a8r8g8b8);
+
+	damage = DamageCreate(NULL, etnaviv_convert_damage_destroy,
+			      DamageReportNone, TRUE, pScreen, victim);
+	if (!damage) {
+		pScreen->DestroyPixmap(pixmap);
+		return NULL;
+	}
+
+	DamageRegister(&pSrc->drawable, damage);
+
+	victim->src = pSrc;
+	victim->damage = damage;
+	victim->pixmap = pixmap;
+
+	if (!etnaviv_convert_render(pScreen, pict, pSrc, pixmap)) {
+		etnaviv_convert_release(pScreen, victim);
+		return NULL;
+	}
+
+	victim->serial = pSrc->drawable.serialNumber;
+	victim->external = etnaviv_pixmap_external(pSrc);
+	victim->gen = etnaviv->mono_gen;
+	victim->format = pict->pFormat;
+
+	return etnaviv_get_pixmap_priv(pixmap);
+}
+
+static void etnaviv_convert_cache_free(ScreenPtr pScreen)
+{
+	struct etnaviv *etnaviv = etnaviv_get_screen_priv(pScreen);
+	unsigned i;
+
+	for (i = 0; i < ARRAY_SIZE(etnaviv->convert_cache); i++)
+		etnaviv_convert_release(pScreen, &etnaviv->convert_cache[i]);
+}
+
+/*
+ * Find the GPU pixmap holding a drawable picture's pixels, converting
+ * the picture if the GPU can not read it.  offset is set to the offset
+ * of the drawable on the pixmap.
+ */
+static struct etnaviv_pixmap *etnaviv_picture_pixmap(ScreenPtr pScreen,
+	PicturePtr pict, xPoint *offset)
+{
+	struct etnaviv *etnaviv = etnaviv_get_screen_priv(pScreen);
+	struct etnaviv_pixmap *vpix;
+
+	vpix = etnaviv_drawable_offset(pict->pDrawable, offset);
+	if (!vpix) {
+		offset->x = offset->y = 0;
+		return etnaviv_acquire_converted(pScreen, pict);
+	}
+
+	etnaviv_set_format(vpix, pict);
+	if (!etnaviv_src_format_valid(etnaviv, vpix->pict_format))
+		return NULL;
+
+	return vpix;
+}
+
 /*
  * Acquire a drawable picture.  origin refers to the location in untransformed
  * space of the origin, which will be updated for the underlying pixmap origin.
@@ -446,20 +718,16 @@ static struct etnaviv_pixmap *etnaviv_acquire_drawable_picture(
 	struct etnaviv_pixmap *vpix;
 	xPoint offset;
 
-	vpix = etnaviv_drawable_offset(drawable, &offset);
+	if (!picture_has_pixels(pict, *origin, clip))
+		return NULL;
+
+	vpix = etnaviv_picture_pixmap(pScreen, pict, &offset);
 	if (!vpix)
 		return NULL;
 
 	offset.x += drawable->x;
 	offset.y += drawable->y;
 
-	etnaviv_set_format(vpix, pict);
-	if (!etnaviv_src_format_valid(etnaviv, vpix->pict_format))
-		return NULL;
-
-	if (!picture_has_pixels(pict, *origin, clip))
-		return NULL;
-
 	if (pict->transform) {
 		struct transform_properties prop;
 		struct pixman_transform inv;
@@ -517,102 +785,1245 @@ static struct etnaviv_pixmap *etnaviv_acquire_drawable_picture(
 }
 
 /*
- * Acquire the source. If we're filling a solid surface, force it to have
- * alpha; it may be used in combination with a mask.  Otherwise, we ask
- * for the plain source format, with or without alpha, and convert later
- * when copying.  If force_vtemp is set, we ensure that the source is in
- * our temporary pixmap.
+ * Transforms which only scale (and possibly reflect) each axis can be
+ * handled by the filter blitter.
  */
-static struct etnaviv_pixmap *etnaviv_acquire_src(ScreenPtr pScreen,
-	PicturePtr pict, const BoxRec *clip, PixmapPtr *ppPixTemp,
-	xPoint *src_topleft, unsigned *rotation, Bool force_vtemp)
+static Bool picture_scale(PicturePtr pict, xFixed *sx, xFixed *sy)
 {
-	struct etnaviv *etnaviv = etnaviv_get_screen_priv(pScreen);
-	struct etnaviv_pixmap *vSrc, *vTemp;
-	struct etnaviv_blend_op copy_op;
-	uint32_t colour;
+	PictTransformPtr t = pict->transform;
 
-	if (etnaviv_pict_solid_argb(pict, &colour)) {
-		vTemp = etnaviv_get_scratch_argb(pScreen, ppPixTemp,
-						 clip->x2, clip->y2);
-		if (!vTemp)
-			return NULL;
+	if (!t ||
+	    t->matrix[2][0] != 0 ||
+	    t->matrix[2][1] != 0 ||
+	    t->matrix[2][2] != pixman_int_to_fixed(1) ||
+	    t->matrix[0][1] != 0 ||
+	    t->matrix[1][0] != 0 ||
+	    t->matrix[0][0] == 0 ||
+	    t->matrix[1][1] == 0)
+		return FALSE;
 
-		if (!etnaviv_fill_single(etnaviv, vTemp, clip, colour))
-			return NULL;
+	*sx = t->matrix[0][0];
+	*sy = t->matrix[1][1];
 
-		src_topleft->x = 0;
-		src_topleft->y = 0;
+	return TRUE;
+}
 
-		if (rotation)
-			*rotation = DE_ROT_MODE_ROT0;
+static Bool picture_filter(PicturePtr pict, enum etnaviv_filter *filter)
+{
+	switch (pict->filter) {
+	case PictFilterNearest:
+	case PictFilterFast:
+		*filter = ETNAVIV_FILTER_NEAREST;
+		return TRUE;
+	case PictFilterBilinear:
+	case PictFilterGood:
+		*filter = ETNAVIV_FILTER_BILINEAR;
+		return TRUE;
+	case PictFilterBest:
+		*filter = ETNAVIV_FILTER_LANCZOS;
+		return TRUE;
+	}
+	return FALSE;
+}
 
-		return vTemp;
+/*
+ * Reflect the pixels from vSrc at src into box in vDst, one column (or
+ * row) at a time.  The pixmaps may be the same provided the areas do
+ * not overlap.
+ */
+static Bool etnaviv_reflect(struct etnaviv *etnaviv,
+	struct etnaviv_pixmap *vDst, const BoxRec *box,
+	struct etnaviv_pixmap *vSrc, xPoint src, Bool horizontal)
+{
+	struct etnaviv_de_op op = {
+		.clip = box,
+		.src_origin_mode = SRC_ORIGIN_NONE,
+		.rop = 0xcc,
+		.cmd = VIVS_DE_DEST_CONFIG_COMMAND_BIT_BLT,
+		.brush = BRUSH_NONE,
+	};
+	xPoint origin;
+	BoxRec line;
+	int i;
+
+	if (!etnaviv_map_gpu(etnaviv, vDst, GPU_ACCESS_RW) ||
+	    !etnaviv_map_gpu(etnaviv, vSrc, GPU_ACCESS_RO))
+		return FALSE;
+
+	op.src = INIT_BLIT_PIX(vSrc, vSrc->pict_format, ZERO_OFFSET);
+	op.dst = INIT_BLIT_PIX(vDst, vDst->pict_format, ZERO_OFFSET);
+
+	etnaviv_batch_start(etnaviv, &op);
+	if (horizontal) {
+		origin.y = src.y;
+		for (i = box->x1; i < box->x2; i++) {
+			box_init(&line, i, box->y1, 1, box_height(box));
+			origin.x = src.x + box->x2 - 1 - i;
+			etnaviv_de_op_src_origin(etnaviv, &op, origin, &line);
+		}
+	} else {
+		origin.x = src.x;
+		for (i = box->y1; i < box->y2; i++) {
+			box_init(&line, box->x1, i, box_width(box), 1);
+			origin.y = src.y + box->y2 - 1 - i;
+			etnaviv_de_op_src_origin(etnaviv, &op, origin, &line);
+		}
 	}
+	etnaviv_de_end(etnaviv);
+	etnaviv_flush(etnaviv);
 
-	vSrc = etnaviv_acquire_drawable_picture(pScreen, pict, clip,
-						src_topleft, rotation);
-	if (!vSrc)
-		goto fallback;
+	return TRUE;
+}
 
-	if (force_vtemp)
-		goto copy_to_vtemp;
+static void etnaviv_scale_pass(struct etnaviv *etnaviv,
+	struct etnaviv_vr_op *op, struct etnaviv_pixmap *vSrc,
+	struct etnaviv_pixmap *vDst, const BoxRec *box, uint32_t x1,
+	uint32_t y1)
+{
+	op->src = INIT_BLIT_PIX(vSrc, vSrc->pict_format, ZERO_OFFSET);
+	op->dst = INIT_BLIT_PIX(vDst, vDst->pict_format, ZERO_OFFSET);
 
-	return vSrc;
+	etnaviv_vr_start(etnaviv, vSrc, vDst);
+	etnaviv_vr_op(etnaviv, op, box, x1, y1, box, 1);
+}
 
-fallback:
-	vTemp = etnaviv_get_scratch_argb(pScreen, ppPixTemp,
-					 clip->x2, clip->y2);
-	if (!vTemp)
+/*
+ * Resample a scaled picture into the temporary pixmap using the filter
+ * blitter, which is what Xv uses to scale video.  Like Xv, scaling in
+ * both directions takes a vertical pass into an intermediate pixmap
+ * followed by a horizontal pass.  The filter blitter can not step
+ * backwards through the source, so reflections are undone afterwards.
+ * On success, origin is updated to the temporary pixmap origin.
+ */
+static struct etnaviv_pixmap *etnaviv_acquire_scaled(ScreenPtr pScreen,
+	PicturePtr pict, const BoxRec *clip, PixmapPtr *ppPixTemp,
+	xPoint *origin)
+{
+	struct etnaviv *etnaviv = etnaviv_get_screen_priv(pScreen);
+	DrawablePtr drawable = pict->pDrawable;
+	PictTransformPtr t = pict->transform;
+	struct etnaviv_pixmap *vSrc, *vTemp, *vFlip = NULL, *vDst;
+	PixmapPtr pPixStage = NULL, pPixFlip = NULL;
+	struct etnaviv_vr_op op = { };
+	enum etnaviv_filter filter;
+	int64_t x1, x2, y1, y2;
+	xFixed sx, sy;
+	xPoint offset, corner;
+	BoxRec box;
+	Bool ret = FALSE;
+
+	if (!drawable || !picture_scale(pict, &sx, &sy) ||
+	    !picture_filter(pict, &filter))
 		return NULL;
 
-	if (!etnaviv_composite_to_pixmap(PictOpSrc, pict, NULL, *ppPixTemp,
-					 src_topleft->x, src_topleft->y,
-					 0, 0, clip->x2, clip->y2))
+	if (!picture_has_pixels(pict, *origin, clip))
 		return NULL;
 
-	src_topleft->x = 0;
-	src_topleft->y = 0;
+	vSrc = etnaviv_picture_pixmap(pScreen, pict, &offset);
+	if (!vSrc)
+		return NULL;
 
-	if (rotation)
-		*rotation = DE_ROT_MODE_ROT0;
+	offset.x += drawable->x;
+	offset.y += drawable->y;
 
-	return vTemp;
+	/* Source edges, relative to the drawable, of the destination box */
+	x1 = (int64_t)sx * (origin->x + clip->x1) + t->matrix[0][2];
+	x2 = (int64_t)sx * (origin->x + clip->x2) + t->matrix[0][2];
+	y1 = (int64_t)sy * (origin->y + clip->y1) + t->matrix[1][2];
+	y2 = (int64_t)sy * (origin->y + clip->y2) + t->matrix[1][2];
+	if (sx < 0)
+		x1 = x2;
+	if (sy < 0)
+		y1 = y2;
+	if (x1 < 0 || y1 < 0)
+		return NULL;
 
-copy_to_vtemp:
 	vTemp = etnaviv_get_scratch_argb(pScreen, ppPixTemp,
 					 clip->x2, clip->y2);
 	if (!vTemp)
 		return NULL;
 
-	copy_op = etnaviv_composite_op[PictOpSrc];
+	if (sx < 0 || sy < 0) {
+		vFlip = etnaviv_get_scratch_argb(pScreen, &pPixFlip,
+						 clip->x2, clip->y2);
+		if (!vFlip)
+			goto out;
+	}
 
-	if (etnaviv_workaround_nonalpha(&vSrc->pict_format)) {
-		copy_op.alpha_mode |= VIVS_DE_ALPHA_MODES_GLOBAL_SRC_ALPHA_MODE_GLOBAL;
-		copy_op.src_alpha = 255;
+	if (!etnaviv_map_gpu(etnaviv, vSrc, GPU_ACCESS_RO) ||
+	    !etnaviv_map_gpu(etnaviv, vTemp, GPU_ACCESS_RW) ||
+	    (vFlip && !etnaviv_map_gpu(etnaviv, vFlip, GPU_ACCESS_RW)))
+		goto out;
+
+	etna_set_state_multi(etnaviv->ctx, VIVS_DE_FILTER_KERNEL(0),
+			     KERNEL_STATE_SZ, etnaviv_render_kernel[filter]);
+
+	box_init(&op.src_bounds, offset.x, offset.y,
+		 drawable->width, drawable->height);
+
+	/* Check whether we need to scale in the vertical direction first. */
+	if (abs(sy) != pixman_fixed_1 || xFixedFrac(y1)) {
+		struct etnaviv_pixmap *vStage;
+
+		vStage = etnaviv_get_scratch_argb(pScreen, &pPixStage,
+						  drawable->width,
+						  box_height(clip));
+		if (!vStage ||
+		    !etnaviv_map_gpu(etnaviv, vStage, GPU_ACCESS_RW))
+			goto out;
+
+		box_init(&box, 0, 0, drawable->width, box_height(clip));
+
+		op.h_scale = 1 << 16;
+		op.v_scale = abs(sy);
+		op.cmd = VIVS_DE_DEST_CONFIG_COMMAND_VER_FILTER_BLT;
+		op.vr_op = VIVS_DE_VR_CONFIG_START_VERTICAL_BLIT;
+
+		etnaviv_scale_pass(etnaviv, &op, vSrc, vStage, &box,
+				   offset.x << 16, y1 + (offset.y << 16));
+
+		/* The stage pixmap starts at the drawable origin */
+		vSrc = vStage;
+		op.src_bounds = box;
+		y1 = 0;
+	} else {
+		x1 += offset.x << 16;
+		y1 += offset.y << 16;
 	}
 
-	if (!etnaviv_blend(etnaviv, clip, &copy_op, vTemp, vSrc, clip, 1,
-			   *src_topleft, ZERO_OFFSET))
-		return NULL;
+	/*
+	 * Arrange for the last pass to write the temporary pixmap: with
+	 * a single reflection, the horizontal pass writes vFlip.
+	 */
+	vDst = (sx < 0) != (sy < 0) ? vFlip : vTemp;
+
+	op.h_scale = abs(sx);
+	op.v_scale = 1 << 16;
+	op.cmd = VIVS_DE_DEST_CONFIG_COMMAND_HOR_FILTER_BLT;
+	op.vr_op = VIVS_DE_VR_CONFIG_START_HORIZONTAL_BLIT;
+
+	etnaviv_scale_pass(etnaviv, &op, vSrc, vDst, clip, x1, y1);
+	etnaviv_flush(etnaviv);
+
+	corner.x = clip->x1;
+	corner.y = clip->y1;
+
+	if (sx < 0 &&
+	    !etnaviv_reflect(etnaviv, vDst == vTemp ? vFlip : vTemp, clip,
+			     vDst, corner, TRUE))
+		goto out;
+	if (sy < 0 &&
+	    !etnaviv_reflect(etnaviv, vTemp, clip, vFlip, corner, FALSE))
+		goto out;
+
+	origin->x = 0;
+	origin->y = 0;
+	ret = TRUE;
+
+out:
+	if (pPixStage)
+		pScreen->DestroyPixmap(pPixStage);
+	if (pPixFlip)
+		pScreen->DestroyPixmap(pPixFlip);
+
+	return ret ? vTemp : NULL;
+}
 
-	src_topleft->x = 0;
-	src_topleft->y = 0;
+/* Place n taps in 1.14 format about the centre tap of the filter */
+static Bool etnaviv_convolution_taps(int16_t *taps, const double *val, int n)
+{
+	int i, v;
 
-	if (rotation)
-		*rotation = DE_ROT_MODE_ROT0;
+	for (i = 0; i < KERNEL_INDICES; i++)
+		taps[i] = 0;
 
-	return vTemp;
+	for (i = 0; i < n; i++) {
+		v = val[i] * (1 << 14) + 0.5;
+		if (v > 0x7fff)
+			return FALSE;
+		taps[KERNEL_INDICES / 2 - n / 2 + i] = v;
+	}
+
+	return TRUE;
 }
 
 /*
- * Compute the regions (in destination pixmap coordinates) which need to
- * be composited.  Each picture's pCompositeClip includes the drawable
- * position, so each position must be adjusted for its position on the
- * backing pixmap.
+ * Build the filter blitter kernels for a convolution filter.  The passes
+ * are clamped individually, so negative taps would give a different
+ * result from pixman, as would taps which do not fit the blitter.
  */
-static Bool etnaviv_compute_composite_region(RegionPtr region,
-	PicturePtr pSrc, PicturePtr pMask, PicturePtr pDst,
+static Bool etnaviv_convolution_build(struct etnaviv_convolution *conv,
+	const xFixed *params, int nparams)
+{
+	int w = pixman_fixed_to_int(params[0]);
+	int h = pixman_fixed_to_int(params[1]);
+	const xFixed *k = params + 2;
+	double hv[KERNEL_INDICES], vv[KERNEL_INDICES], sum, d;
+	int16_t taps[KERNEL_INDICES];
+	int i, j, max = 0;
+
+	if (w < 1 || h < 1 || w > KERNEL_INDICES || h > KERNEL_INDICES ||
+	    nparams != 2 + w * h)
+		return FALSE;
+
+	for (i = 0; i < w * h; i++) {
+		if (k[i] < 0)
+			return FALSE;
+		if (k[i] > k[max])
+			max = i;
+	}
+
+	conv->separable = FALSE;
+	conv->npass = 0;
+
+	if (k[max] == 0)
+		return TRUE;
+
+	/*
+	 * The kernel is separable if each row is a multiple of the row
+	 * holding the largest tap.  Normalise the vertical pass, so that
+	 * its intermediate result never needs clamping.
+	 */
+	for (j = 0; j < w; j++)
+		hv[j] = pixman_fixed_to_double(k[max / w * w + j]);
+
+	for (sum = 0, i = 0; i < h; i++) {
+		vv[i] = (double)k[i * w + max % w] / k[max];
+		sum += vv[i];
+	}
+
+	conv->separable = TRUE;
+	for (i = 0; i < h; i++)
+		for (j = 0; j < w; j++) {
+			d = vv[i] * hv[j] - pixman_fixed_to_double(k[i * w + j]);
+			if (d > 1.0 / (1 << 14) || d < -1.0 / (1 << 14))
+				conv->separable = FALSE;
+		}
+
+	if (conv->separable) {
+		for (i = 0; i < h; i++)
+			vv[i] /= sum;
+		for (j = 0; j < w; j++)
+			hv[j] *= sum;
+
+		if (!etnaviv_convolution_taps(taps, vv, h))
+			return FALSE;
+		etnaviv_filter_kernel_taps(conv->kernel[0], taps);
+
+		if (!etnaviv_convolution_taps(taps, hv, w))
+			return FALSE;
+		etnaviv_filter_kernel_taps(conv->kernel[1], taps);
+
+		conv->npass = 2;
+		return TRUE;
+	}
+
+	for (i = 0; i < h; i++) {
+		for (sum = 0, j = 0; j < w; j++) {
+			hv[j] = pixman_fixed_to_double(k[i * w + j]);
+			sum += hv[j];
+		}
+
+		if (sum == 0)
+			continue;
+
+		if (!etnaviv_convolution_taps(taps, hv, w))
+			return FALSE;
+		etnaviv_filter_kernel_taps(conv->kernel[conv->npass], taps);
+		conv->row[conv->npass++] = i;
+	}
+
+	return TRUE;
+}
+
+static struct etnaviv_convolution *etnaviv_convolution_lookup(
+	struct etnaviv *etnaviv, PicturePtr pict)
+{
+	struct etnaviv_convolution *conv;
+	int nparams = pict->filter_nparams;
+	unsigned i;
+
+	if (nparams < 2 || nparams > ARRAY_SIZE(conv->params))
+		return NULL;
+
+	for (i = 0; i < ETNAVIV_CONVOLUTION_CACHE; i++) {
+		conv = &etnaviv->convolution[i];
+		if (conv->nparams == nparams &&
+		    memcmp(conv->params, pict->filter_params,
+			   nparams * sizeof(xFixed)) == 0)
+			return conv;
+	}
+
+	i = etnaviv->convolution_next++ % ETNAVIV_CONVOLUTION_CACHE;
+	conv = &etnaviv->convolution[i];
+	conv->nparams = 0;
+
+	if (!etnaviv_convolution_build(conv, pict->filter_params, nparams))
+		return NULL;
+
+	memcpy(conv->params, pict->filter_params, nparams * sizeof(xFixed));
+	conv->nparams = nparams;
+
+	return conv;
+}
+
+/*
+ * Convolve a picture into the temporary pixmap using the filter blitter
+ * at unit scale.  The source area the kernel reads is first copied into
+ * a padded pixmap, which is transparent outside the drawable.  Kernels
+ * which are not separable take a horizontal pass per kernel row, summed
+ * with saturating adds; as no tap is negative, this is the same as
+ * clamping the total.  On success, origin is updated to the temporary
+ * pixmap origin.
+ */
+static struct etnaviv_pixmap *etnaviv_acquire_convolved(ScreenPtr pScreen,
+	PicturePtr pict, const BoxRec *clip, PixmapPtr *ppPixTemp,
+	xPoint *origin)
+{
+	struct etnaviv *etnaviv = etnaviv_get_screen_priv(pScreen);
+	DrawablePtr drawable = pict->pDrawable;
+	struct etnaviv_pixmap *vSrc, *vPad, *vStage = NULL, *vTemp;
+	struct etnaviv_convolution *conv;
+	struct etnaviv_blend_op copy_op;
+	struct etnaviv_vr_op op = { };
+	PixmapPtr pPixPad = NULL, pPixStage = NULL;
+	xPoint offset, src;
+	BoxRec pad, area, box;
+	int kw, kh;
+	unsigned i;
+	Bool ret = FALSE;
+
+	if (!drawable || pict->filter != PictFilterConvolution ||
+	    pict->transform ||
+	    (pict->repeat && pict->repeatType != RepeatNone))
+		return NULL;
+
+	conv = etnaviv_convolution_lookup(etnaviv, pict);
+	if (!conv)
+		return NULL;
+
+	vSrc = etnaviv_picture_pixmap(pScreen, pict, &offset);
+	if (!vSrc)
+		return NULL;
+
+	kw = pixman_fixed_to_int(pict->filter_params[0]);
+	kh = pixman_fixed_to_int(pict->filter_params[1]);
+
+	/* The area of the drawable read by the kernel */
+	box_init(&area, origin->x + clip->x1 - kw / 2,
+		 origin->y + clip->y1 - kh / 2,
+		 box_width(clip) + kw - 1, box_height(clip) + kh - 1);
+	box_init(&pad, 0, 0, box_width(&area), box_height(&area));
+
+	vTemp = etnaviv_get_scratch_argb(pScreen, ppPixTemp,
+					 clip->x2, clip->y2);
+	if (!vTemp)
+		return NULL;
+
+	vPad = etnaviv_get_scratch_argb(pScreen, &pPixPad,
+					box_width(&pad), box_height(&pad));
+	if (!vPad)
+		goto out;
+
+	if (conv->separable)
+		vStage = etnaviv_get_scratch_argb(pScreen, &pPixStage,
+						  box_width(&pad),
+						  box_height(clip));
+	else if (conv->npass > 1)
+		vStage = etnaviv_get_scratch_argb(pScreen, &pPixStage,
+						  clip->x2, clip->y2);
+	if (conv->npass > 1 && !vStage)
+		goto out;
+
+	/* Copy the drawable pixels, clearing those outside the drawable */
+	box_init(&box, 0, 0, drawable->width, drawable->height);
+	if (__box_intersect(&box, &box, &area) ||
+	    box.x1 != area.x1 || box.y1 != area.y1 ||
+	    box.x2 != area.x2 || box.y2 != area.y2) {
+		if (!etnaviv_fill_single(etnaviv, vPad, &pad, 0))
+			goto out;
+	}
+
+	if (box.x1 < box.x2 && box.y1 < box.y2) {
+		src.x = area.x1 + offset.x + drawable->x;
+		src.y = area.y1 + offset.y + drawable->y;
+		box.x1 -= area.x1;
+		box.x2 -= area.x1;
+		box.y1 -= area.y1;
+		box.y2 -= area.y1;
+
+		copy_op = etnaviv_composite_op[PictOpSrc];
+
+		if (etnaviv_workaround_nonalpha(&vSrc->pict_format)) {
+			copy_op.alpha_mode |= VIVS_DE_ALPHA_MODES_GLOBAL_SRC_ALPHA_MODE_GLOBAL;
+			copy_op.src_alpha = 255;
+		}
+
+		if (!etnaviv_blend(etnaviv, &pad, &copy_op, vPad, vSrc, &box,
+				   1, src, ZERO_OFFSET))
+			goto out;
+	}
+	etnaviv_flush(etnaviv);
+
+	if (!etnaviv_map_gpu(etnaviv, vPad, GPU_ACCESS_RO) ||
+	    !etnaviv_map_gpu(etnaviv, vTemp, GPU_ACCESS_RW) ||
+	    (vStage && !etnaviv_map_gpu(etnaviv, vStage, GPU_ACCESS_RW)))
+		goto out;
+
+	op.src_bounds = pad;
+	op.h_scale = 1 << 16;
+	op.v_scale = 1 << 16;
+
+	if (conv->separable) {
+		box_init(&box, 0, 0, box_width(&pad), box_height(clip));
+
+		etna_set_state_multi(etnaviv->ctx, VIVS_DE_FILTER_KERNEL(0),
+				     KERNEL_STATE_SZ, conv->kernel[0]);
+
+		op.cmd = VIVS_DE_DEST_CONFIG_COMMAND_VER_FILTER_BLT;
+		op.vr_op = VIVS_DE_VR_CONFIG_START_VERTICAL_BLIT;
+
+		etnaviv_scale_pass(etnaviv, &op, vPad, vStage, &box,
+				   0, (kh / 2) << 16);
+
+		etna_set_state_multi(etnaviv->ctx, VIVS_DE_FILTER_KERNEL(0),
+				     KERNEL_STATE_SZ, conv->kernel[1]);
+
+		op.src_bounds = box;
+		op.cmd = VIVS_DE_DEST_CONFIG_COMMAND_HOR_FILTER_BLT;
+		op.vr_op = VIVS_DE_VR_CONFIG_START_HORIZONTAL_BLIT;
+
+		etnaviv_scale_pass(etnaviv, &op, vStage, vTemp, clip,
+				   (kw / 2) << 16, 0);
+		etnaviv_flush(etnaviv);
+	} else if (conv->npass == 0) {
+		if (!etnaviv_fill_single(etnaviv, vTemp, clip, 0))
+			goto out;
+	} else {
+		op.cmd = VIVS_DE_DEST_CONFIG_COMMAND_HOR_FILTER_BLT;
+		op.vr_op = VIVS_DE_VR_CONFIG_START_HORIZONTAL_BLIT;
+
+		for (i = 0; i < conv->npass; i++) {
+			etna_set_state_multi(etnaviv->ctx,
+					     VIVS_DE_FILTER_KERNEL(0),
+					     KERNEL_STATE_SZ, conv->kernel[i]);
+
+			etnaviv_scale_pass(etnaviv, &op, vPad,
+					   i ? vStage : vTemp, clip,
+					   (kw / 2) << 16, conv->row[i] << 16);
+			etnaviv_flush(etnaviv);
+
+			if (i && !etnaviv_blend(etnaviv, clip,
+					&etnaviv_composite_op[PictOpAdd],
+					vTemp, vStage, clip, 1,
+					ZERO_OFFSET, ZERO_OFFSET))
+				goto out;
+		}
+	}
+
+	origin->x = 0;
+	origin->y = 0;
+	ret = TRUE;
+
+out:
+	if (pPixPad)
+		pScreen->DestroyPixmap(pPixPad);
+	if (pPixStage)
+		pScreen->DestroyPixmap(pPixStage);
+
+	return ret ? vTemp : NULL;
+}
+
+static inline int etnaviv_mod(int a, int b)
+{
+	a %= b;
+	return a < 0 ? a + b : a;
+}
+
+/*
+ * Copy between two areas of the same pixmap.  The following copy will
+ * generally read what this one wrote, so flush the pixel engine.
+ */
+static void etnaviv_copy_self(struct etnaviv *etnaviv,
+	struct etnaviv_pixmap *vPix, const BoxRec *box, xPoint src)
+{
+	struct etnaviv_de_op op = {
+		.clip = box,
+		.src_origin_mode = SRC_ORIGIN_NONE,
+		.rop = 0xcc,
+		.cmd = VIVS_DE_DEST_CONFIG_COMMAND_BIT_BLT,
+		.brush = BRUSH_NONE,
+	};
+
+	op.src = INIT_BLIT_PIX(vPix, vPix->pict_format, ZERO_OFFSET);
+	op.dst = op.src;
+
+	etnaviv_batch_start(etnaviv, &op);
+	etnaviv_de_op_src_origin(etnaviv, &op, src, box);
+	etnaviv_de_end(etnaviv);
+	etnaviv_flush(etnaviv);
+}
+
+/*
+ * Fill box in vDst by repeating the tile in vSrc, where phase is the
+ * position in the tile which corresponds with the top left of box.
+ * The first tile's worth is assembled from at most four pieces of the
+ * tile, and then doubled across and down the box.
+ */
+static void etnaviv_fill_tiled(struct etnaviv *etnaviv,
+	struct etnaviv_pixmap *vDst, const BoxRec *box,
+	struct etnaviv_pixmap *vSrc, const struct etnaviv_blend_op *blend,
+	const BoxRec *tile, xPoint phase)
+{
+	struct etnaviv_de_op op = {
+		.blend_op = blend,
+		.clip = box,
+		.src_origin_mode = SRC_ORIGIN_NONE,
+		.rop = 0xcc,
+		.cmd = VIVS_DE_DEST_CONFIG_COMMAND_BIT_BLT,
+		.brush = BRUSH_NONE,
+	};
+	int w = box_width(tile), h = box_height(tile);
+	int bw = min_t(int, w, box_width(box));
+	int bh = min_t(int, h, box_height(box));
+	int x, y, sx, sy, pw, ph;
+	xPoint src;
+	BoxRec b;
+
+	op.src = INIT_BLIT_PIX(vSrc, vSrc->pict_format, ZERO_OFFSET);
+	op.dst = INIT_BLIT_PIX(vDst, vDst->pict_format, ZERO_OFFSET);
+
+	etnaviv_batch_start(etnaviv, &op);
+	for (y = 0, sy = phase.y; y < bh; y += ph, sy = 0) {
+		ph = min_t(int, h - sy, bh - y);
+		for (x = 0, sx = phase.x; x < bw; x += pw, sx = 0) {
+			pw = min_t(int, w - sx, bw - x);
+			box_init(&b, box->x1 + x, box->y1 + y, pw, ph);
+			src.x = tile->x1 + sx;
+			src.y = tile->y1 + sy;
+			etnaviv_de_op_src_origin(etnaviv, &op, src, &b);
+		}
+	}
+	etnaviv_de_end(etnaviv);
+	etnaviv_flush(etnaviv);
+
+	/* Each copy keeps the filled width a multiple of the tile width */
+	src.x = box->x1;
+	src.y = box->y1;
+	for (x = bw; x < box_width(box); x += pw) {
+		pw = min_t(int, x, box_width(box) - x);
+		box_init(&b, box->x1 + x, box->y1, pw, bh);
+		etnaviv_copy_self(etnaviv, vDst, &b, src);
+	}
+	for (y = bh; y < box_height(box); y += ph) {
+		ph = min_t(int, y, box_height(box) - y);
+		box_init(&b, box->x1, box->y1 + y, box_width(box), ph);
+		etnaviv_copy_self(etnaviv, vDst, &b, src);
+	}
+}
+
+/*
+ * Fill box in vDst with the tile in vSrc positioned at pos, replicating
+ * the edge pixels of the tile outwards.  Copy the part of the tile
+ * which is inside the box, or the nearest edge pixels if none is, and
+ * then double the edge columns and rows outwards.
+ */
+static Bool etnaviv_fill_padded(struct etnaviv *etnaviv,
+	struct etnaviv_pixmap *vDst, const BoxRec *box,
+	struct etnaviv_pixmap *vSrc, const struct etnaviv_blend_op *blend,
+	const BoxRec *tile, xPoint pos)
+{
+	int w = box_width(tile), h = box_height(tile);
+	int x, y, k;
+	xPoint off, src;
+	BoxRec fill, b;
+
+	fill.x1 = min_t(int, max_t(int, pos.x, box->x1), box->x2 - 1);
+	fill.x2 = min_t(int, max_t(int, pos.x + w, box->x1 + 1), box->x2);
+	fill.y1 = min_t(int, max_t(int, pos.y, box->y1), box->y2 - 1);
+	fill.y2 = min_t(int, max_t(int, pos.y + h, box->y1 + 1), box->y2);
+
+	off.x = tile->x1 - fill.x1 +
+		max_t(int, 0, min_t(int, fill.x1 - pos.x, w - 1));
+	off.y = tile->y1 - fill.y1 +
+		max_t(int, 0, min_t(int, fill.y1 - pos.y, h - 1));
+
+	if (!etnaviv_blend(etnaviv, &fill, blend, vDst, vSrc, &fill, 1,
+			   off, ZERO_OFFSET))
+		return FALSE;
+	etnaviv_flush(etnaviv);
+
+	for (x = fill.x1; x > box->x1; x -= k) {
+		k = min_t(int, fill.x1 - x + 1, x - box->x1);
+		box_init(&b, x - k, fill.y1, k, box_height(&fill));
+		src.x = x;
+		src.y = fill.y1;
+		etnaviv_copy_self(etnaviv, vDst, &b, src);
+	}
+	for (x = fill.x2; x < box->x2; x += k) {
+		k = min_t(int, x - fill.x2 + 1, box->x2 - x);
+		box_init(&b, x, fill.y1, k, box_height(&fill));
+		src.x = x - k;
+		src.y = fill.y1;
+		etnaviv_copy_self(etnaviv, vDst, &b, src);
+	}
+	for (y = fill.y1; y > box->y1; y -= k) {
+		k = min_t(int, fill.y1 - y + 1, y - box->y1);
+		box_init(&b, box->x1, y - k, box_width(box), k);
+		src.x = box->x1;
+		src.y = y;
+		etnaviv_copy_self(etnaviv, vDst, &b, src);
+	}
+	for (y = fill.y2; y < box->y2; y += k) {
+		k = min_t(int, y - fill.y2 + 1, box->y2 - y);
+		box_init(&b, box->x1, y, box_width(box), k);
+		src.x = box->x1;
+		src.y = y - k;
+		etnaviv_copy_self(etnaviv, vDst, &b, src);
+	}
+
+	return TRUE;
+}
+
+/*
+ * Expand an untransformed repeating picture into the temporary pixmap.
+ * Reflected pictures are first unfolded into a tile twice the size of
+ * the drawable, which then repeats normally.  On success, origin is
+ * updated to the temporary pixmap origin.
+ */
+static struct etnaviv_pixmap *etnaviv_acquire_repeat(ScreenPtr pScreen,
+	PicturePtr pict, const BoxRec *clip, PixmapPtr *ppPixTemp,
+	xPoint *origin)
+{
+	struct etnaviv *etnaviv = etnaviv_get_screen_priv(pScreen);
+	DrawablePtr drawable = pict->pDrawable;
+	struct etnaviv_pixmap *vSrc, *vTemp, *vTile;
+	struct etnaviv_blend_op copy_op;
+	PixmapPtr pPixTile = NULL;
+	xPoint offset, phase, corner;
+	BoxRec tile, b;
+	int w, h;
+	Bool ret = FALSE;
+
+	if (!drawable || !pict->repeat || pict->transform ||
+	    pict->filter == PictFilterConvolution)
+		return NULL;
+
+	vSrc = etnaviv_picture_pixmap(pScreen, pict, &offset);
+	if (!vSrc)
+		return NULL;
+
+	vTemp = etnaviv_get_scratch_argb(pScreen, ppPixTemp,
+					 clip->x2, clip->y2);
+	if (!vTemp)
+		return NULL;
+
+	if (!etnaviv_map_gpu(etnaviv, vSrc, GPU_ACCESS_RO) ||
+	    !etnaviv_map_gpu(etnaviv, vTemp, GPU_ACCESS_RW))
+		return NULL;
+
+	copy_op = etnaviv_composite_op[PictOpSrc];
+
+	if (etnaviv_workaround_nonalpha(&vSrc->pict_format)) {
+		copy_op.alpha_mode |= VIVS_DE_ALPHA_MODES_GLOBAL_SRC_ALPHA_MODE_GLOBAL;
+		copy_op.src_alpha = 255;
+	}
+
+	w = drawable->width;
+	h = drawable->height;
+	box_init(&tile, drawable->x + offset.x, drawable->y + offset.y, w, h);
+
+	switch (pict->repeatType) {
+	case RepeatNormal:
+		phase.x = etnaviv_mod(origin->x + clip->x1, w);
+		phase.y = etnaviv_mod(origin->y + clip->y1, h);
+		etnaviv_fill_tiled(etnaviv, vTemp, clip, vSrc, &copy_op,
+				   &tile, phase);
+		break;
+
+	case RepeatReflect:
+		vTile = etnaviv_get_scratch_argb(pScreen, &pPixTile,
+						 2 * w, 2 * h);
+		if (!vTile ||
+		    !etnaviv_map_gpu(etnaviv, vTile, GPU_ACCESS_RW))
+			goto out;
+
+		/* Unfold the drawable into the four quadrants of the tile */
+		box_init(&b, 0, 0, w, h);
+		offset.x = tile.x1;
+		offset.y = tile.y1;
+		if (!etnaviv_blend(etnaviv, &b, &copy_op, vTile, vSrc, &b, 1,
+				   offset, ZERO_OFFSET))
+			goto out;
+		etnaviv_flush(etnaviv);
+
+		corner.x = 0;
+		corner.y = 0;
+		box_init(&b, w, 0, w, h);
+		if (!etnaviv_reflect(etnaviv, vTile, &b, vTile, corner, TRUE))
+			goto out;
+		box_init(&b, 0, h, 2 * w, h);
+		if (!etnaviv_reflect(etnaviv, vTile, &b, vTile, corner, FALSE))
+			goto out;
+
+		box_init(&tile, 0, 0, 2 * w, 2 * h);
+		phase.x = etnaviv_mod(origin->x + clip->x1, 2 * w);
+		phase.y = etnaviv_mod(origin->y + clip->y1, 2 * h);
+		etnaviv_fill_tiled(etnaviv, vTemp, clip, vTile, NULL,
+				   &tile, phase);
+		break;
+
+	case RepeatPad:
+		corner.x = -origin->x;
+		corner.y = -origin->y;
+		if (!etnaviv_fill_padded(etnaviv, vTemp, clip, vSrc, &copy_op,
+					 &tile, corner))
+			goto out;
+		break;
+
+	default:
+		goto out;
+	}
+
+	origin->x = 0;
+	origin->y = 0;
+	ret = TRUE;
+
+out:
+	if (pPixTile)
+		pScreen->DestroyPixmap(pPixTile);
+
+	return ret ? vTemp : NULL;
+}
+
+#define GRADIENT_XY	0	/* varies along both axes */
+#define GRADIENT_X	1	/* varies along x only */
+#define GRADIENT_Y	2	/* varies along y only */
+
+/* Largest two dimensional gradient area worth caching, in pixels */
+#define GRADIENT_MAX_AREA	(256 * 1024)
+
+static Bool etnaviv_gradient_geometry(SourcePictPtr sp, xFixed *geom)
+{
+	memset(geom, 0, 6 * sizeof(*geom));
+
+	switch (sp->type) {
+	case SourcePictTypeLinear:
+		geom[0] = sp->linear.p1.x;
+		geom[1] = sp->linear.p1.y;
+		geom[2] = sp->linear.p2.x;
+		geom[3] = sp->linear.p2.y;
+		return TRUE;
+	case SourcePictTypeRadial:
+		geom[0] = sp->radial.c1.x;
+		geom[1] = sp->radial.c1.y;
+		geom[2] = sp->radial.c1.radius;
+		geom[3] = sp->radial.c2.x;
+		geom[4] = sp->radial.c2.y;
+		geom[5] = sp->radial.c2.radius;
+		return TRUE;
+	case SourcePictTypeConical:
+		geom[0] = sp->conical.center.x;
+		geom[1] = sp->conical.center.y;
+		geom[2] = sp->conical.angle;
+		return TRUE;
+	}
+	return FALSE;
+}
+
+/*
+ * A linear gradient's colour depends on the position projected onto
+ * the gradient vector.  Map the vector back through the transform to
+ * find whether the colour only changes along one axis.
+ */
+static unsigned etnaviv_gradient_axis(PicturePtr pict)
+{
+	SourcePictPtr sp = pict->pSourcePict;
+	PictTransformPtr t = pict->transform;
+	int64_t dx, dy, gx, gy;
+
+	if (sp->type != SourcePictTypeLinear)
+		return GRADIENT_XY;
+
+	dx = sp->linear.p2.x - sp->linear.p1.x;
+	dy = sp->linear.p2.y - sp->linear.p1.y;
+
+	if (t) {
+		if (t->matrix[2][0] != 0 ||
+		    t->matrix[2][1] != 0 ||
+		    t->matrix[2][2] != pixman_fixed_1)
+			return GRADIENT_XY;
+
+		gx = t->matrix[0][0] * dx + t->matrix[1][0] * dy;
+		gy = t->matrix[0][1] * dx + t->matrix[1][1] * dy;
+	} else {
+		gx = dx;
+		gy = dy;
+	}
+
+	if (gy == 0)
+		return GRADIENT_X;
+	if (gx == 0)
+		return GRADIENT_Y;
+	return GRADIENT_XY;
+}
+
+static Bool etnaviv_gradient_match(struct etnaviv_gradient *g,
+	PicturePtr pict, const xFixed *geom, const PictTransform *transform,
+	uint16_t repeat)
+{
+	SourcePictPtr sp = pict->pSourcePict;
+
+	return g->pixmap &&
+	       g->type == sp->type &&
+	       g->repeat == repeat &&
+	       g->nstops == sp->gradient.nstops &&
+	       memcmp(g->geometry, geom, sizeof(g->geometry)) == 0 &&
+	       memcmp(&g->transform, transform, sizeof(*transform)) == 0 &&
+	       memcmp(g->stops, sp->gradient.stops,
+		      g->nstops * sizeof(*g->stops)) == 0;
+}
+
+/*
+ * Render the gradient into a new pixmap for the cache entry.  pixman
+ * generates the gradient; the result is then only read by the GPU.
+ */
+static Bool etnaviv_gradient_render(ScreenPtr pScreen, PicturePtr pict,
+	struct etnaviv_gradient *g, const BoxRec *extent)
+{
+	SourcePictPtr sp = pict->pSourcePict;
+	PictGradientStop *stops;
+	PixmapPtr pixmap;
+
+	stops = malloc(sp->gradient.nstops * sizeof(*stops));
+	if (!stops)
+		return FALSE;
+
+	memcpy(stops, sp->gradient.stops, sp->gradient.nstops * sizeof(*stops));
+
+	pixmap = pScreen->CreatePixmap(pScreen, box_width(extent),
+				       box_height(extent), 32,
+				       CREATE_PIXMAP_USAGE_GPU);
+	if (!pixmap) {
+		free(stops);
+		return FALSE;
+	}
+
+	etnaviv_get_pixmap_priv(pixmap)->pict_format =
+		etnaviv_pict_format(PICT_a8r8g8b8);
+
+	if (!etnaviv_composite_to_pixmap(PictOpSrc, pict, NULL, pixmap,
+					 extent->x1, extent->y1, 0, 0,
+					 box_width(extent),
+					 box_height(extent))) {
+		pScreen->DestroyPixmap(pixmap);
+		free(stops);
+		return FALSE;
+	}
+
+	if (g->pixmap)
+		pScreen->DestroyPixmap(g->pixmap);
+	free(g->stops);
+
+	g->pixmap = pixmap;
+	g->stops = stops;
+	g->nstops = sp->gradient.nstops;
+	g->extent = *extent;
+
+	return TRUE;
+}
+
+/*
+ * Find the cache entry for the gradient covering the area (in picture
+ * coordinates), rendering it if it is not present.  An entry for the
+ * same gradient which does not cover the area is grown.
+ */
+static struct etnaviv_gradient *etnaviv_gradient_lookup(ScreenPtr pScreen,
+	PicturePtr pict, const BoxRec *area)
+{
+	struct etnaviv *etnaviv = etnaviv_get_screen_priv(pScreen);
+	struct etnaviv_gradient *g, *victim = NULL;
+	PictTransform transform;
+	xFixed geom[6];
+	uint16_t repeat;
+	unsigned axis;
+	BoxRec extent;
+
+	if (!etnaviv_gradient_geometry(pict->pSourcePict, geom))
+		return NULL;
+
+	if (pict->transform)
+		transform = *pict->transform;
+	else
+		pixman_transform_init_identity(&transform);
+
+	repeat = pict->repeat ? pict->repeatType : RepeatNone;
+	axis = etnaviv_gradient_axis(pict);
+
+	switch (axis) {
+	case GRADIENT_X:
+		box_init(&extent, area->x1, 0, box_width(area), 1);
+		break;
+	case GRADIENT_Y:
+		box_init(&extent, 0, area->y1, 1, box_height(area));
+		break;
+	default:
+		extent = *area;
+		break;
+	}
+
+	for (g = etnaviv->gradient;
+	     g < etnaviv->gradient + ETNAVIV_GRADIENT_CACHE; g++) {
+		if (etnaviv_gradient_match(g, pict, geom, &transform, repeat)) {
+			if (g->extent.x1 <= extent.x1 &&
+			    g->extent.y1 <= extent.y1 &&
+			    g->extent.x2 >= extent.x2 &&
+			    g->extent.y2 >= extent.y2)
+				goto found;
+
+			victim = g;
+			break;
+		}
+
+		if (!victim || !g->pixmap ||
+		    (victim->pixmap && g->used < victim->used))
+			victim = g;
+	}
+
+	g = victim;
+	if (g->pixmap && etnaviv_gradient_match(g, pict, geom, &transform,
+						repeat)) {
+		BoxRec grown;
+
+		grown.x1 = min_t(int, g->extent.x1, extent.x1);
+		grown.y1 = min_t(int, g->extent.y1, extent.y1);
+		grown.x2 = max_t(int, g->extent.x2, extent.x2);
+		grown.y2 = max_t(int, g->extent.y2, extent.y2);
+
+		if (box_width(&grown) <= MAXSHORT &&
+		    box_height(&grown) <= MAXSHORT &&
+		    (axis != GRADIENT_XY ||
+		     box_width(&grown) * box_height(&grown) <=
+		     GRADIENT_MAX_AREA))
+			extent = grown;
+	}
+
+	if (axis == GRADIENT_XY &&
+	    box_width(&extent) * box_height(&extent) > GRADIENT_MAX_AREA)
+		return NULL;
+
+	if (!etnaviv_gradient_render(pScreen, pict, g, &extent))
+		return NULL;
+
+	g->type = pict->pSourcePict->type;
+	memcpy(g->geometry, geom, sizeof(g->geometry));
+	g->transform = transform;
+	g->repeat = repeat;
+	g->axis = axis;
+
+found:
+	g->used = ++etnaviv->gradient_used;
+
+	return g;
+}
+
+/*
+ * Acquire a gradient picture from the gradient cache.  Gradients
+ * cached as a strip are expanded into the temporary pixmap, others are
+ * used directly from the cache.  origin is updated for the returned
+ * pixmap.
+ */
+static struct etnaviv_pixmap *etnaviv_acquire_gradient(ScreenPtr pScreen,
+	PicturePtr pict, const BoxRec *clip, PixmapPtr *ppPixTemp,
+	xPoint *origin)
+{
+	struct etnaviv *etnaviv = etnaviv_get_screen_priv(pScreen);
+	struct etnaviv_pixmap *vGrad, *vTemp;
+	struct etnaviv_gradient *g;
+	BoxRec area, tile;
+	xPoint phase;
+
+	if (pict->alphaMap)
+		return NULL;
+
+	box_init(&area, origin->x + clip->x1, origin->y + clip->y1,
+		 box_width(clip), box_height(clip));
+
+	g = etnaviv_gradient_lookup(pScreen, pict, &area);
+	if (!g)
+		return NULL;
+
+	vGrad = etnaviv_get_pixmap_priv(g->pixmap);
+
+	if (g->axis == GRADIENT_XY) {
+		origin->x -= g->extent.x1;
+		origin->y -= g->extent.y1;
+		return vGrad;
+	}
+
+	vTemp = etnaviv_get_scratch_argb(pScreen, ppPixTemp,
+					 clip->x2, clip->y2);
+	if (!vTemp)
+		return NULL;
+
+	if (!etnaviv_map_gpu(etnaviv, vGrad, GPU_ACCESS_RO) ||
+	    !etnaviv_map_gpu(etnaviv, vTemp, GPU_ACCESS_RW))
+		return NULL;
+
+	box_init(&tile, 0, 0, box_width(&g->extent), box_height(&g->extent));
+	phase.x = g->axis == GRADIENT_X ? area.x1 - g->extent.x1 : 0;
+	phase.y = g->axis == GRADIENT_Y ? area.y1 - g->extent.y1 : 0;
+
+	etnaviv_fill_tiled(etnaviv, vTemp, clip, vGrad, NULL, &tile, phase);
+
+	origin->x = 0;
+	origin->y = 0;
+
+	return vTemp;
+}
+
+static void etnaviv_gradient_cache_free(ScreenPtr pScreen)
+{
+	struct etnaviv *etnaviv = etnaviv_get_screen_priv(pScreen);
+	struct etnaviv_gradient *g;
+
+	for (g = etnaviv->gradient;
+	     g < etnaviv->gradient + ETNAVIV_GRADIENT_CACHE; g++) {
+		if (g->pixmap)
+			pScreen->DestroyPixmap(g->pixmap);
+		free(g->stops);
+		memset(g, 0, sizeof(*g));
+	}
+}
+
+/*
+ * Acquire the source. If we're filling a solid surface, force it to have
+ * alpha; it may be used in combination with a mask.  Otherwise, we ask
+ * for the plain source format, with or without alpha, and convert later
+ * when copying.  If force_vtemp is set, we ensure that the source is in
+ * our temporary pixmap.
+ */
+static struct etnaviv_pixmap *etnaviv_acquire_src(ScreenPtr pScreen,
+	PicturePtr pict, const BoxRec *clip, PixmapPtr *ppPixTemp,
+	xPoint *src_topleft, unsigned *rotation, Bool force_vtemp)
+{
+	struct etnaviv *etnaviv = etnaviv_get_screen_priv(pScreen);
+	struct etnaviv_pixmap *vSrc, *vTemp;
+	struct etnaviv_blend_op copy_op;
+	uint32_t colour;
+
+	if (etnaviv_pict_solid_argb(pict, &colour)) {
+		vTemp = etnaviv_get_scratch_argb(pScreen, ppPixTemp,
+						 clip->x2, clip->y2);
+		if (!vTemp)
+			return NULL;
+
+		if (!etnaviv_fill_single(etnaviv, vTemp, clip, colour))
+			return NULL;
+
+		src_topleft->x = 0;
+		src_topleft->y = 0;
+
+		if (rotation)
+			*rotation = DE_ROT_MODE_ROT0;
+
+		return vTemp;
+	}
+
+	if (!pict->pDrawable) {
+		vSrc = etnaviv_acquire_gradient(pScreen, pict, clip, ppPixTemp,
+						src_topleft);
+		if (!vSrc)
+			goto fallback;
+
+		if (rotation)
+			*rotation = DE_ROT_MODE_ROT0;
+
+		if (force_vtemp && vSrc != etnaviv_get_pixmap_priv(*ppPixTemp))
+			goto copy_to_vtemp;
+
+		return vSrc;
+	}
+
+	vSrc = etnaviv_acquire_drawable_picture(pScreen, pict, clip,
+						src_topleft, rotation);
+	if (!vSrc) {
+		vTemp = etnaviv_acquire_scaled(pScreen, pict, clip, ppPixTemp,
+					       src_topleft);
+		if (!vTemp)
+			vTemp = etnaviv_acquire_repeat(pScreen, pict, clip,
+						       ppPixTemp, src_topleft);
+		if (!vTemp)
+			vTemp = etnaviv_acquire_convolved(pScreen, pict, clip,
+							  ppPixTemp,
+							  src_topleft);
+		if (!vTemp)
+			goto fallback;
+
+		if (rotation)
+			*rotation = DE_ROT_MODE_ROT0;
+
+		return vTemp;
+	}
+
+	if (force_vtemp)
+		goto copy_to_vtemp;
+
+	return vSrc;
+
+fallback:
+	vTemp = etnaviv_get_scratch_argb(pScreen, ppPixTemp,
+					 clip->x2, clip->y2);
+	if (!vTemp)
+		return NULL;
+
+	if (!etnaviv_composite_to_pixmap(PictOpSrc, pict, NULL, *ppPixTemp,
+					 src_topleft->x, src_topleft->y,
+					 0, 0, clip->x2, clip->y2))
+		return NULL;
+
+	src_topleft->x = 0;
+	src_topleft->y = 0;
+
+	if (rotation)
+		*rotation = DE_ROT_MODE_ROT0;
+
+	return vTemp;
+
+copy_to_vtemp:
+	vTemp = etnaviv_get_scratch_argb(pScreen, ppPixTemp,
+					 clip->x2, clip->y2);
+	if (!vTemp)
+		return NULL;
+
+	copy_op = etnaviv_composite_op[PictOpSrc];
+
+	if (etnaviv_workaround_nonalpha(&vSrc->pict_format)) {
+		copy_op.alpha_mode |= VIVS_DE_ALPHA_MODES_GLOBAL_SRC_ALPHA_MODE_GLOBAL;
+		copy_op.src_alpha = 255;
+	}
+
+	if (!etnaviv_blend(etnaviv, clip, &copy_op, vTemp, vSrc, clip, 1,
+			   *src_topleft, ZERO_OFFSET))
+		return NULL;
+
+	src_topleft->x = 0;
+	src_topleft->y = 0;
+
+	if (rotation)
+		*rotation = DE_ROT_MODE_ROT0;
+
+	return vTemp;
+}
+
+/*
+ * Compute the regions (in destination pixmap coordinates) which need to
+ * be composited.  Each picture's pCompositeClip includes the drawable
+ * position, so each position must be adjusted for its position on the
+ * backing pixmap.
+ */
+static Bool etnaviv_compute_composite_region(RegionPtr region,
+	PicturePtr pSrc, PicturePtr pMask, PicturePtr pDst,
 	INT16 xSrc, INT16 ySrc, INT16 xMask, INT16 yMask,
 	INT16 xDst, INT16 yDst, CARD16 width, CARD16 height)
 {
@@ -665,13 +2076,32 @@ static int etnaviv_accel_composite_srconly(PicturePtr pSrc, PicturePtr pDst,
 	BoxRec clip_temp;
 	xPoint src_topleft;
 	unsigned rotation;
+	uint32_t colour;
 
 	if (pSrc->alphaMap)
 		return FALSE;
 
-	/* If the source has no drawable, and is not solid, fallback */
-	if (!pSrc->pDrawable && !picture_is_solid(pSrc, NULL))
-		return FALSE;
+	/*
+	 * PE2.0 can take a solid source colour from the brush, which
+	 * avoids filling a temporary pixmap and blending from it.  When
+	 * the blend reduces to replacing the destination, draw a fill.
+	 */
+	if (VIV_FEATURE(etnaviv->conn, chipMinorFeatures0, 2DPE20) &&
+	    etnaviv_pict_solid_argb(pSrc, &colour)) {
+		if (!etnaviv_map_gpu(etnaviv, state->dst.pix, GPU_ACCESS_RW))
+			return FALSE;
+
+		state->final_op.src = INIT_BLIT_NULL;
+		state->final_op.src_origin_mode = SRC_ORIGIN_NONE;
+		state->final_op.rop = 0xf0;
+		state->final_op.brush = BRUSH_SOLID;
+		state->final_op.fg_colour = colour;
+
+		if (etnaviv_blend_replaces(&state->final_blend, colour))
+			state->final_op.blend_op = NULL;
+
+		return TRUE;
+	}
 
 	src_topleft.x = xSrc;
 	src_topleft.y = ySrc;
@@ -726,6 +2156,64 @@ static int etnaviv_accel_composite_srconly(PicturePtr pSrc, PicturePtr pDst,
 	return TRUE;
 }
 
+/*
+ * PE2.0 can composite a solid colour through a mask in one operation,
+ * reading the mask as the source.  The ROP ORs a white brush into the
+ * colour channels, leaving the mask's alpha.  The blender premultiplies
+ * that by its alpha and by the global source colour, and scales the
+ * alpha by the global alpha, giving (src IN mask) for the blend.
+ */
+static Bool etnaviv_accel_composite_solid_mask(PicturePtr pSrc,
+	PicturePtr pMask, INT16 xMask, INT16 yMask, INT16 xDst, INT16 yDst,
+	const BoxRec *clip_temp, struct etnaviv_composite_state *state)
+{
+	ScreenPtr pScreen = pMask->pDrawable->pScreen;
+	struct etnaviv *etnaviv = etnaviv_get_screen_priv(pScreen);
+	struct etnaviv_pixmap *vMask;
+	xPoint mask_offset;
+	uint32_t colour;
+
+	if (!VIV_FEATURE(etnaviv->conn, chipMinorFeatures0, 2DPE20) ||
+	    pSrc->alphaMap || pMask->alphaMap ||
+	    (pMask->componentAlpha && PICT_FORMAT_RGB(pMask->format)) ||
+	    !etnaviv_blend_src_alpha_normal(&state->final_blend) ||
+	    !etnaviv_pict_solid_argb(pSrc, &colour))
+		return FALSE;
+
+	mask_offset.x = xMask;
+	mask_offset.y = yMask;
+
+	vMask = etnaviv_acquire_drawable_picture(pScreen, pMask, clip_temp,
+						 &mask_offset, NULL);
+	if (!vMask)
+		return FALSE;
+
+	mask_offset.x -= xDst + state->dst.offset.x;
+	mask_offset.y -= yDst + state->dst.offset.y;
+
+	if (!etnaviv_map_gpu(etnaviv, state->dst.pix, GPU_ACCESS_RW) ||
+	    !etnaviv_map_gpu(etnaviv, vMask, GPU_ACCESS_RO))
+		return FALSE;
+
+	state->final_op.src = INIT_BLIT_PIX(vMask, vMask->pict_format,
+					    mask_offset);
+	state->final_op.rop = 0xfc;
+	state->final_op.brush = BRUSH_SOLID;
+	state->final_op.fg_colour = 0x00ffffff;
+
+	state->final_blend.alpha_mode |=
+		VIVS_DE_ALPHA_MODES_GLOBAL_SRC_ALPHA_MODE_SCALED;
+	state->final_blend.src_alpha = colour >> 24;
+	state->final_blend.src_colour = colour & 0x00ffffff;
+	state->final_blend.multiply_mode =
+		VIVS_DE_COLOR_MULTIPLY_MODES_SRC_PREMULTIPLY_ENABLE |
+		VIVS_DE_COLOR_MULTIPLY_MODES_DST_PREMULTIPLY_DISABLE |
+		VIVS_DE_COLOR_MULTIPLY_MODES_SRC_GLOBAL_PREMULTIPLY_COLOR |
+		VIVS_DE_COLOR_MULTIPLY_MODES_DST_DEMULTIPLY_DISABLE;
+
+	return TRUE;
+}
+
 static int etnaviv_accel_composite_masked(PicturePtr pSrc, PicturePtr pMask,
 	PicturePtr pDst, INT16 xSrc, INT16 ySrc, INT16 xMask, INT16 yMask,
 	INT16 xDst, INT16 yDst, struct etnaviv_composite_state *state)
@@ -756,6 +2244,11 @@ static int etnaviv_accel_composite_masked(PicturePtr pSrc, PicturePtr pMask,
 	clip_temp.x2 -= xDst;
 	clip_temp.y2 -= yDst;
 
+	if (pMask->pDrawable &&
+	    etnaviv_accel_composite_solid_mask(pSrc, pMask, xMask, yMask,
+					       xDst, yDst, &clip_temp, state))
+		return TRUE;
+
 	/* Get a temporary pixmap. */
 	vTemp = etnaviv_get_scratch_argb(pScreen, &state->pPixTemp,
 					 clip_temp.x2, clip_temp.y2);
@@ -765,10 +2258,6 @@ static int etnaviv_accel_composite_masked(PicturePtr pSrc, PicturePtr pMask,
 	if (pSrc->alphaMap || pMask->alphaMap)
 		goto fallback;
 
-	/* If the source has no drawable, and is not solid, fallback */
-	if (!pSrc->pDrawable && !picture_is_solid(pSrc, NULL))
-		goto fallback;
-
 	mask_op = etnaviv_composite_op[PictOpInReverse];
 
 	if (pMask->componentAlpha && PICT_FORMAT_RGB(pMask->format)) {
@@ -784,11 +2273,26 @@ static int etnaviv_accel_composite_masked(PicturePtr pSrc, PicturePtr pMask,
 		mask_op.dst_mode = DE_BLENDMODE_COLOR;
 	}
 
-	if (!pMask->pDrawable)
-		goto fallback;
-
-	vMask = etnaviv_acquire_drawable_picture(pScreen, pMask, &clip_temp,
-						 &mask_offset, NULL);
+	if (pMask->pDrawable) {
+		vMask = etnaviv_acquire_drawable_picture(pScreen, pMask,
+						&clip_temp, &mask_offset, NULL);
+		if (!vMask)
+			vMask = etnaviv_acquire_scaled(pScreen, pMask,
+						&clip_temp, &state->pPixMask,
+						&mask_offset);
+		if (!vMask)
+			vMask = etnaviv_acquire_repeat(pScreen, pMask,
+						&clip_temp, &state->pPixMask,
+						&mask_offset);
+		if (!vMask)
+			vMask = etnaviv_acquire_convolved(pScreen, pMask,
+						&clip_temp, &state->pPixMask,
+						&mask_offset);
+	} else {
+		vMask = etnaviv_acquire_gradient(pScreen, pMask, &clip_temp,
+						 &state->pPixMask,
+						 &mask_offset);
+	}
 	if (!vMask)
 		goto fallback;
 
@@ -1016,29 +2520,12 @@ static Bool etnaviv_accel_reduce_mask(struct etnaviv_composite_state *state,
 }
 
 /*
- * A composite operation is: (pSrc IN pMask) OP pDst.  We always try
- * to perform an on-GPU "OP" where possible, which is handled by the
- * function below.  The source for this operation is determined by
- * sub-functions.
- */
-static int etnaviv_accel_Composite(CARD8 op, PicturePtr pSrc, PicturePtr pMask,
-	PicturePtr pDst, INT16 xSrc, INT16 ySrc, INT16 xMask, INT16 yMask,
-	INT16 xDst, INT16 yDst, CARD16 width, CARD16 height)
-{
-	ScreenPtr pScreen = pDst->pDrawable->pScreen;
-	struct etnaviv *etnaviv = etnaviv_get_screen_priv(pScreen);
-	struct etnaviv_composite_state state;
-	int rc;
-
-#ifdef DEBUG_BLEND
-	etnaviv_debug_blend_op(__FUNCTION__, op, width, height,
-			       pSrc, xSrc, ySrc,
-			       pMask, xMask, yMask,
-			       pDst, xDst, yDst);
-	state.op = op;
-#endif
-	state.pPixTemp = NULL;
-
+ * Set up the destination of a composite operation, and the blend which
+ * the final operation uses to combine the source with it.
+ */
+static Bool etnaviv_composite_dst_init(struct etnaviv *etnaviv, CARD8 op,
+	PicturePtr pDst, struct etnaviv_composite_state *state)
+{
 	/* If the destination has an alpha map, fallback */
 	if (pDst->alphaMap)
 		return FALSE;
@@ -1048,25 +2535,25 @@ static int etnaviv_accel_Composite(CARD8 op, PicturePtr pSrc, PicturePtr pMask,
 		return FALSE;
 
 	/* The destination pixmap must have a bo */
-	state.dst.pix = etnaviv_drawable_offset(pDst->pDrawable,
-						&state.dst.offset);
-	if (!state.dst.pix)
+	state->dst.pix = etnaviv_drawable_offset(pDst->pDrawable,
+						&state->dst.offset);
+	if (!state->dst.pix)
 		return FALSE;
 
-	state.dst.format = etnaviv_set_format(state.dst.pix, pDst);
+	state->dst.format = etnaviv_set_format(state->dst.pix, pDst);
 
 	/* ... and the destination format must be supported */
-	if (!etnaviv_dst_format_valid(etnaviv, state.dst.format))
+	if (!etnaviv_dst_format_valid(etnaviv, state->dst.format))
 		return FALSE;
 
-	state.final_blend = etnaviv_composite_op[op];
+	state->final_blend = etnaviv_composite_op[op];
 
 	/*
 	 * Apply the workaround for non-alpha destination.  The test order
 	 * is important here: we only need the full workaround for non-
 	 * PictOpClear operations, but we still need the format adjustment.
 	 */
-	if (etnaviv_workaround_nonalpha(&state.dst.format) &&
+	if (etnaviv_workaround_nonalpha(&state->dst.format) &&
 	    op != PictOpClear) {
 		/*
 		 * When the destination does not have an alpha channel, we
@@ -1075,12 +2562,12 @@ static int etnaviv_accel_Composite(CARD8 op, PicturePtr pSrc, PicturePtr pMask,
 		 * on destination alpha with their corresponding constant
 		 * value modes, rather than using global alpha subsitution.
 		 */
-		switch (state.final_blend.src_mode) {
+		switch (state->final_blend.src_mode) {
 		case DE_BLENDMODE_NORMAL:
-			state.final_blend.src_mode = DE_BLENDMODE_ONE;
+			state->final_blend.src_mode = DE_BLENDMODE_ONE;
 			break;
 		case DE_BLENDMODE_INVERSED:
-			state.final_blend.src_mode = DE_BLENDMODE_ZERO;
+			state->final_blend.src_mode = DE_BLENDMODE_ZERO;
 			break;
 		}
 
@@ -1093,11 +2580,52 @@ static int etnaviv_accel_Composite(CARD8 op, PicturePtr pSrc, PicturePtr pMask,
 		 * A4R4G4B4 limits src.A to the top four bits.
 		 */
 		if (!VIV_FEATURE(etnaviv->conn, chipMinorFeatures0, 2DPE20) &&
-		    state.dst.format.format != DE_FORMAT_A8R8G8B8 &&
-		    etnaviv_op_uses_source_alpha(&state.final_blend))
+		    state->dst.format.format != DE_FORMAT_A8R8G8B8 &&
+		    etnaviv_op_uses_source_alpha(&state->final_blend))
 			return FALSE;
 	}
 
+	return TRUE;
+}
+
+/*
+ * A composite operation is: (pSrc IN pMask) OP pDst.  We always try
+ * to perform an on-GPU "OP" where possible, which is handled by the
+ * function below.  The source for this operation is determined by
+ * sub-functions.
+ */
+static int etnaviv_accel_Composite(CARD8 op, PicturePtr pSrc, PicturePtr pMask,
+	PicturePtr pDst, INT16 xSrc, INT16 ySrc, INT16 xMask, INT16 yMask,
+	INT16 xDst, INT16 yDst, CARD16 width, CARD16 height)
+{
+	ScreenPtr pScreen = pDst->pDrawable->pScreen;
+	struct etnaviv *etnaviv = etnaviv_get_screen_priv(pScreen);
+	struct etnaviv_composite_state state;
+	Bool whole, opaque;
+	uint8_t content;
+	BoxRec src_area;
+	int rc;
+
+#ifdef DEBUG_BLEND
+	etnaviv_debug_blend_op(__FUNCTION__, op, width, height,
+			       pSrc, xSrc, ySrc,
+			       pMask, xMask, yMask,
+			       pDst, xDst, yDst);
+	state.op = op;
+#endif
+	state.pPixTemp = NULL;
+	state.pPixMask = NULL;
+
+	/* The source area read, in source drawable coordinates */
+	box_init(&src_area, xSrc, ySrc, width, height);
+
+	/* Over an opaque source without a mask replaces the destination */
+	if (op == PictOpOver && !pMask && etnaviv_pict_opaque(pSrc, &src_area))
+		op = PictOpSrc;
+
+	if (!etnaviv_composite_dst_init(etnaviv, op, pDst, &state))
+		return FALSE;
+
 	/*
 	 * Compute the composite region from the source, mask and
 	 * destination positions on their backing pixmaps.  The
@@ -1112,6 +2640,27 @@ static int etnaviv_accel_Composite(CARD8 op, PicturePtr pSrc, PicturePtr pMask,
 	if (pMask)
 		miCompositeSourceValidate(pMask);
 
+	/*
+	 * Clear and Src do not read the destination, so when they cover
+	 * all of it, any fill which was deferred need not be drawn.
+	 */
+	whole = RegionNumRects(&state.region) == 1 &&
+		etnaviv_pixmap_covered(state.dst.pix,
+				       RegionExtents(&state.region),
+				       state.dst.offset);
+	content = state.dst.pix->content;
+	if (whole && (op == PictOpClear || op == PictOpSrc) &&
+	    !etnaviv_pict_reads(pSrc, state.dst.pix) &&
+	    !etnaviv_pict_reads(pMask, state.dst.pix))
+		state.dst.pix->content = 0;
+
+	/* The final blend op, which the functions below may adjust */
+	state.final_op.blend_op = &state.final_blend;
+	state.final_op.src_origin_mode = SRC_ORIGIN_RELATIVE;
+	state.final_op.rop = 0xcc;
+	state.final_op.cmd = VIVS_DE_DEST_CONFIG_COMMAND_BIT_BLT;
+	state.final_op.brush = BRUSH_NONE;
+
 	if (op == PictOpClear) {
 		/* Short-circuit for PictOpClear */
 		rc = etnaviv_Composite_Clear(pDst, &state);
@@ -1139,25 +2688,55 @@ static int etnaviv_accel_Composite(CARD8 op, PicturePtr pSrc, PicturePtr pMask,
 						   state.dst.format,
 						   state.dst.offset);
 		state.final_op.clip = RegionExtents(&state.region);
-		state.final_op.blend_op = &state.final_blend;
-		state.final_op.src_origin_mode = SRC_ORIGIN_RELATIVE;
-		state.final_op.rop = 0xcc;
-		state.final_op.cmd = VIVS_DE_DEST_CONFIG_COMMAND_BIT_BLT;
-		state.final_op.brush = FALSE;
 
 #ifdef DEBUG_BLEND
-		etnaviv_batch_wait_commit(etnaviv, state.final_op.src.pixmap);
-		dump_vPix(etnaviv, state.final_op.src.pixmap, 1,
-			  "A-FSRC%2.2x-%p", op, pSrc);
+		if (state.final_op.src.pixmap) {
+			etnaviv_batch_wait_commit(etnaviv,
+						  state.final_op.src.pixmap);
+			dump_vPix(etnaviv, state.final_op.src.pixmap, 1,
+				  "A-FSRC%2.2x-%p", op, pSrc);
+		}
 		dump_vPix(etnaviv, state.final_op.dst.pixmap, 1,
 			  "A-FDST%2.2x-%p", op, pDst);
 #endif
 
-		etnaviv_batch_start(etnaviv, &state.final_op);
-		etnaviv_de_op(etnaviv, &state.final_op,
-			      RegionRects(&state.region),
-			      RegionNumRects(&state.region));
-		etnaviv_de_end(etnaviv);
+		/*
+		 * Clears, and fills of A8R8G8B8 pixels whose brush colour
+		 * is the pixel value, can be deferred when they cover the
+		 * whole destination.
+		 */
+		if (whole && op == PictOpClear &&
+		    etnaviv_pixmap_defer_fill(etnaviv, state.dst.pix, 0, 0,
+					      FALSE))
+			goto done;
+
+		if (whole && state.final_op.brush == BRUSH_SOLID &&
+		    !state.final_op.blend_op &&
+		    (pDst->format == PICT_a8r8g8b8 ||
+		     pDst->format == PICT_x8r8g8b8) &&
+		    etnaviv_pixmap_defer_fill(etnaviv, state.dst.pix,
+					      state.final_op.fg_colour,
+					      state.final_op.fg_colour,
+					      state.final_op.fg_colour >> 24 ==
+					      0xff))
+			goto done;
+
+		etnaviv_composite_queue(etnaviv, &state.final_op,
+					RegionRects(&state.region),
+					RegionNumRects(&state.region));
+
+		/* An opaque result leaves an opaque destination opaque */
+		if (state.final_op.brush == BRUSH_SOLID)
+			opaque = !state.final_op.blend_op &&
+				 state.final_op.fg_colour >> 24 == 0xff;
+		else
+			opaque = op == PictOpSrc && !pMask &&
+				 etnaviv_pict_opaque(pSrc, &src_area);
+
+		if (opaque && etnaviv_pict_alpha_top(pDst->format) &&
+		    (content & CT_OPAQUE ||
+		     (whole && etnaviv_pixmap_private(state.dst.pix))))
+			state.dst.pix->content = CT_OPAQUE;
 
 #ifdef DEBUG_BLEND
 		etnaviv_batch_wait_commit(etnaviv, state.final_op.dst.pixmap);
@@ -1167,15 +2746,142 @@ static int etnaviv_accel_Composite(CARD8 op, PicturePtr pSrc, PicturePtr pMask,
 #endif
 	}
 
-	/* Destroy any temporary pixmap we may have allocated */
+ done:
+	/* Destroy any temporary pixmaps we may have allocated */
 	if (state.pPixTemp)
 		pScreen->DestroyPixmap(state.pPixTemp);
+	if (state.pPixMask)
+		pScreen->DestroyPixmap(state.pPixMask);
 
 	RegionUninit(&state.region);
 
 	return rc;
 }
 
+/*
+ * Fill rectangles with a solid colour.  mi composites each rectangle
+ * with a solid picture in turn; instead, draw them all with the colour
+ * as the brush, blending where the operator needs it.  Src and Clear
+ * are left to mi, which draws them with a single PolyFillRect.  When
+ * blending, rectangles which overlap must each be blended in turn, so
+ * a rectangle overlapping those already in the batch ends the batch,
+ * flushing the PE, and starts another.
+ */
+static Bool etnaviv_accel_CompositeRects(CARD8 op, PicturePtr pDst,
+	xRenderColor *pColor, int nRect, xRectangle *pRects)
+{
+	ScreenPtr pScreen = pDst->pDrawable->pScreen;
+	struct etnaviv *etnaviv = etnaviv_get_screen_priv(pScreen);
+	struct etnaviv_composite_state state;
+	const BoxRec *hint = NULL, *ext;
+	RegionPtr clip;
+	BoxRec box[VIVANTE_MAX_2D_RECTS], pending;
+	struct etnaviv_de_op *fill = &state.final_op;
+	unsigned int n = 0;
+	Bool batched = FALSE;
+	uint32_t colour;
+	uint8_t content;
+
+	if (op == PictOpSrc || op == PictOpClear)
+		return FALSE;
+
+	/* PE1.0 brush colours are pixel values, which we can not blend */
+	if (!VIV_FEATURE(etnaviv->conn, chipMinorFeatures0, 2DPE20))
+		return FALSE;
+
+	ValidatePicture(pDst);
+	clip = pDst->pCompositeClip;
+	if (!RegionNotEmpty(clip))
+		return TRUE;
+
+	ext = RegionExtents(clip);
+
+	if (!etnaviv_composite_dst_init(etnaviv, op, pDst, &state))
+		return FALSE;
+
+	content = state.dst.pix->content;
+	if (!etnaviv_map_gpu(etnaviv, state.dst.pix, GPU_ACCESS_RW))
+		return FALSE;
+
+	/* Render colours are premultiplied, as a solid picture's are */
+	colour = (pColor->alpha >> 8) << 24 | (pColor->red >> 8) << 16 |
+		 (pColor->green >> 8) << 8 | pColor->blue >> 8;
+
+	fill->dst = INIT_BLIT_PIX(state.dst.pix, state.dst.format,
+				  state.dst.offset);
+	fill->src = INIT_BLIT_NULL;
+	fill->blend_op = etnaviv_blend_replaces(&state.final_blend, colour) ?
+			 NULL : &state.final_blend;
+	fill->clip = ext;
+	fill->src_origin_mode = SRC_ORIGIN_NONE;
+	fill->rop = 0xf0;
+	fill->cmd = VIVS_DE_DEST_CONFIG_COMMAND_BIT_BLT;
+	fill->brush = BRUSH_SOLID;
+	fill->fg_colour = colour;
+
+	etnaviv_batch_start(etnaviv, fill);
+
+	for (; nRect; nRect--, pRects++) {
+		struct region_clip_iter it;
+		BoxRec rect;
+
+		rect.x1 = max_t(int, pRects->x + pDst->pDrawable->x, ext->x1);
+		rect.y1 = max_t(int, pRects->y + pDst->pDrawable->y, ext->y1);
+		rect.x2 = min_t(int, pRects->x + pDst->pDrawable->x +
+				     pRects->width, ext->x2);
+		rect.y2 = min_t(int, pRects->y + pDst->pDrawable->y +
+				     pRects->height, ext->y2);
+		if (rect.x1 >= rect.x2 || rect.y1 >= rect.y2)
+			continue;
+
+		if (batched && fill->blend_op) {
+			BoxRec overlap;
+
+			/*
+			 * The PE must write the batch's rectangles out
+			 * before this one blends with them.
+			 */
+			if (!__box_intersect(&overlap, &pending, &rect)) {
+				if (n)
+					etnaviv_de_op(etnaviv, fill, box, n);
+				etnaviv_de_end(etnaviv);
+				etnaviv_batch_start(etnaviv, fill);
+				batched = FALSE;
+				n = 0;
+			}
+		}
+
+		if (!batched) {
+			pending = rect;
+			batched = TRUE;
+		} else {
+			pending.x1 = min_t(int, pending.x1, rect.x1);
+			pending.y1 = min_t(int, pending.y1, rect.y1);
+			pending.x2 = max_t(int, pending.x2, rect.x2);
+			pending.y2 = max_t(int, pending.y2, rect.y2);
+		}
+
+		hint = region_clip_iter_init(&it, clip, &rect, hint);
+		while (region_clip_iter_next(&it, &box[n])) {
+			if (++n >= ARRAY_SIZE(box)) {
+				etnaviv_de_op(etnaviv, fill, box, n);
+				n = 0;
+			}
+		}
+	}
+
+	if (n)
+		etnaviv_de_op(etnaviv, fill, box, n);
+	etnaviv_de_end(etnaviv);
+
+	/* An opaque fill leaves an opaque destination opaque */
+	if (!fill->blend_op && colour >> 24 == 0xff && content & CT_OPAQUE &&
+	    etnaviv_pict_alpha_top(pDst->format))
+		state.dst.pix->content = CT_OPAQUE;
+
+	return TRUE;
+}
+
 static Bool etnaviv_accel_Glyphs(CARD8 final_op, PicturePtr pSrc,
 	PicturePtr pDst, PictFormatPtr maskFormat, INT16 xSrc, INT16 ySrc,
 	int nlist, GlyphListPtr list, GlyphPtr *glyphs)
@@ -1232,7 +2938,7 @@ static Bool etnaviv_accel_Glyphs(CARD8 final_op, PicturePtr pSrc,
 	op.src_origin_mode = SRC_ORIGIN_NONE;
 	op.rop = 0xcc;
 	op.cmd = VIVS_DE_DEST_CONFIG_COMMAND_BIT_BLT;
-	op.brush = FALSE;
+	op.brush = BRUSH_NONE;
 
 	pCurrent = NULL;
 	for (grp = gr; grp < gr + n; grp++) {
@@ -1240,12 +2946,13 @@ static Bool etnaviv_accel_Glyphs(CARD8 final_op, PicturePtr pSrc,
 			PixmapPtr pPix = drawable_pixmap(grp->picture->pDrawable);
 			struct etnaviv_pixmap *v = etnaviv_get_pixmap_priv(pPix);
 
-			if (!etnaviv_map_gpu(etnaviv, v, GPU_ACCESS_RO))
-				goto destroy_picture;
-
+			/* Mapping may draw, so end the previous batch first */
 			if (pCurrent)
 				etnaviv_de_end(etnaviv);
 
+			if (!etnaviv_map_gpu(etnaviv, v, GPU_ACCESS_RO))
+				goto destroy_picture;
+
 			prefetch(grp);
 
 			op.src = INIT_BLIT_PIX(v, v->pict_format, ZERO_OFFSET);
@@ -1294,6 +3001,340 @@ destroy_gr:
 	return FALSE;
 }
 
+/*
+ * Trapezoids and triangles.  pixman rasterizes them into an A8 mask
+ * covering only their bounds, held in cached memory.  The GPU copies
+ * this into a mask pixmap through a userptr mapping, and composites
+ * from there, so the CPU never has to touch the destination.  The mask
+ * pixmap is a render target, which needs A8 target support.
+ */
+struct etnaviv_raster {
+	pixman_image_t *image;
+	void *mem;
+	size_t size;
+	unsigned pitch;
+	BoxRec bounds;
+};
+
+static Bool etnaviv_raster_init(struct etnaviv_raster *r,
+	DrawablePtr pDrawable, const BoxRec *bounds)
+{
+	size_t align = maxt(VIVANTE_ALIGN_MASK, getpagesize());
+	int width, height;
+
+	/* Nothing outside the drawable can be affected */
+	r->bounds.x1 = max_t(int, bounds->x1, 0);
+	r->bounds.y1 = max_t(int, bounds->y1, 0);
+	r->bounds.x2 = min_t(int, bounds->x2, pDrawable->width);
+	r->bounds.y2 = min_t(int, bounds->y2, pDrawable->height);
+	r->image = NULL;
+
+	if (r->bounds.x1 >= r->bounds.x2 || r->bounds.y1 >= r->bounds.y2)
+		return TRUE;
+
+	width = r->bounds.x2 - r->bounds.x1;
+	height = r->bounds.y2 - r->bounds.y1;
+
+	r->pitch = ALIGN(width, 16);
+	r->size = ALIGN(r->pitch * height, align);
+
+	if (posix_memalign(&r->mem, align, r->size))
+		return FALSE;
+
+	memset(r->mem, 0, r->size);
+
+	r->image = pixman_image_create_bits(PIXMAN_a8, width, height,
+					    r->mem, r->pitch);
+	if (!r->image) {
+		free(r->mem);
+		return FALSE;
+	}
+
+	return TRUE;
+}
+
+/*
+ * Hand the rasterized mask to the GPU.  The memory is freed once the
+ * GPU has finished with it, whether or not this succeeds.
+ */
+static PicturePtr etnaviv_raster_mask(ScreenPtr pScreen,
+	struct etnaviv_raster *r)
+{
+	struct etnaviv *etnaviv = etnaviv_get_screen_priv(pScreen);
+	struct etnaviv_usermem_node *unode;
+	struct etnaviv_pixmap *vMask;
+	struct etnaviv_de_op op;
+	PictFormatPtr format;
+	PixmapPtr pMaskPixmap;
+	PicturePtr pMask;
+	struct etna_bo *usr;
+	int width, height, error;
+	BoxRec box;
+
+	pixman_image_unref(r->image);
+
+	width = r->bounds.x2 - r->bounds.x1;
+	height = r->bounds.y2 - r->bounds.y1;
+
+	format = PictureMatchFormat(pScreen, 8, PICT_a8);
+	if (!format)
+		goto free_mem;
+
+	unode = calloc(1, sizeof(*unode));
+	if (!unode)
+		goto free_mem;
+
+	usr = etna_bo_from_usermem_prot(etnaviv->conn, r->mem, r->size,
+					PROT_READ);
+	if (!usr) {
+		xf86DrvMsg(etnaviv->scrnIndex, X_ERROR,
+			   "etnaviv: %s: etna_bo_from_usermem_prot(ptr=%p, size=%zu) failed: %s\n",
+			   __FUNCTION__, r->mem, r->size, strerror(errno));
+		free(unode);
+		goto free_mem;
+	}
+
+	unode->bo = usr;
+	unode->mem = r->mem;
+
+	pMaskPixmap = pScreen->CreatePixmap(pScreen, width, height, 8,
+					    CREATE_PIXMAP_USAGE_GPU);
+	if (!pMaskPixmap)
+		goto free_unode;
+
+	pMask = CreatePicture(0, &pMaskPixmap->drawable, format, 0, 0,
+			      serverClient, &error);
+
+	/* Drop our reference to the mask pixmap */
+	pScreen->DestroyPixmap(pMaskPixmap);
+
+	if (!pMask)
+		goto free_unode;
+
+	vMask = etnaviv_get_pixmap_priv(pMaskPixmap);
+	if (!etnaviv_map_gpu(etnaviv, vMask, GPU_ACCESS_RW)) {
+		FreePicture(pMask, 0);
+		goto free_unode;
+	}
+
+	box_init(&box, 0, 0, width, height);
+
+	op.src = INIT_BLIT_BO(usr, r->pitch, etnaviv_pict_format(PICT_a8),
+			      ZERO_OFFSET);
+	op.dst = INIT_BLIT_PIX(vMask, etnaviv_set_format(vMask, pMask),
+			       ZERO_OFFSET);
+	op.blend_op = NULL;
+	op.clip = &box;
+	op.src_origin_mode = SRC_ORIGIN_RELATIVE;
+	op.rop = 0xcc;
+	op.cmd = VIVS_DE_DEST_CONFIG_COMMAND_BIT_BLT;
+	op.brush = BRUSH_NONE;
+
+	etnaviv_batch_start(etnaviv, &op);
+	etnaviv_de_op(etnaviv, &op, &box, 1);
+	etnaviv_de_end(etnaviv);
+
+	/* Free the memory once the copy has completed */
+	etnaviv_add_freemem(etnaviv, unode);
+
+	return pMask;
+
+free_unode:
+	etna_bo_del(etnaviv->conn, usr, NULL);
+	free(unode);
+free_mem:
+	free(r->mem);
+	return NULL;
+}
+
+static Bool etnaviv_raster_supported(ScreenPtr pScreen)
+{
+	struct etnaviv *etnaviv = etnaviv_get_screen_priv(pScreen);
+
+	return VIV_FEATURE(etnaviv->conn, chipMinorFeatures0, 2D_A8_TARGET);
+}
+
+/*
+ * Composite through the rasterized mask.  The source is positioned as
+ * mi does, relative to the first point of the shapes.
+ */
+static Bool etnaviv_raster_composite(CARD8 op, PicturePtr pSrc,
+	PicturePtr pDst, INT16 xSrc, INT16 ySrc, int xDst, int yDst,
+	struct etnaviv_raster *r)
+{
+	PicturePtr pMask;
+
+	pMask = etnaviv_raster_mask(pDst->pDrawable->pScreen, r);
+	if (!pMask)
+		return FALSE;
+
+	CompositePicture(op, pSrc, pMask, pDst,
+			 xSrc + r->bounds.x1 - xDst, ySrc + r->bounds.y1 - yDst,
+			 0, 0, r->bounds.x1, r->bounds.y1,
+			 r->bounds.x2 - r->bounds.x1,
+			 r->bounds.y2 - r->bounds.y1);
+
+	FreePicture(pMask, 0);
+
+	return TRUE;
+}
+
+/* Add the rasterized mask to an A8 picture */
+static Bool etnaviv_raster_add(PicturePtr pPicture, struct etnaviv_raster *r)
+{
+	PicturePtr pMask;
+
+	pMask = etnaviv_raster_mask(pPicture->pDrawable->pScreen, r);
+	if (!pMask)
+		return FALSE;
+
+	CompositePicture(PictOpAdd, pMask, NULL, pPicture, 0, 0, 0, 0,
+			 r->bounds.x1, r->bounds.y1,
+			 r->bounds.x2 - r->bounds.x1,
+			 r->bounds.y2 - r->bounds.y1);
+
+	FreePicture(pMask, 0);
+
+	return TRUE;
+}
+
+static void etnaviv_triangle_bounds(int ntri, const xTriangle *tris,
+	int x_off, int y_off, BoxPtr bounds)
+{
+	xFixed x1, y1, x2, y2;
+	int i;
+
+	x1 = x2 = tris[0].p1.x;
+	y1 = y2 = tris[0].p1.y;
+	for (i = 0; i < ntri; i++) {
+		x1 = mint(x1, mint(tris[i].p1.x,
+				   mint(tris[i].p2.x, tris[i].p3.x)));
+		y1 = mint(y1, mint(tris[i].p1.y,
+				   mint(tris[i].p2.y, tris[i].p3.y)));
+		x2 = maxt(x2, maxt(tris[i].p1.x,
+				   maxt(tris[i].p2.x, tris[i].p3.x)));
+		y2 = maxt(y2, maxt(tris[i].p1.y,
+				   maxt(tris[i].p2.y, tris[i].p3.y)));
+	}
+
+	bounds->x1 = pixman_fixed_to_int(pixman_fixed_floor(x1)) + x_off;
+	bounds->y1 = pixman_fixed_to_int(pixman_fixed_floor(y1)) + y_off;
+	bounds->x2 = pixman_fixed_to_int(pixman_fixed_ceil(x2)) + x_off;
+	bounds->y2 = pixman_fixed_to_int(pixman_fixed_ceil(y2)) + y_off;
+}
+
+static Bool etnaviv_accel_Trapezoids(CARD8 op, PicturePtr pSrc,
+	PicturePtr pDst, PictFormatPtr maskFormat, INT16 xSrc, INT16 ySrc,
+	int ntrap, xTrapezoid *traps)
+{
+	struct etnaviv_raster r;
+	BoxRec bounds;
+
+	if (!maskFormat || maskFormat->format != PICT_a8 || ntrap == 0 ||
+	    !etnaviv_raster_supported(pDst->pDrawable->pScreen))
+		return FALSE;
+
+	miTrapezoidBounds(ntrap, traps, &bounds);
+	if (!etnaviv_raster_init(&r, pDst->pDrawable, &bounds))
+		return FALSE;
+	if (!r.image)
+		return TRUE;
+
+	pixman_add_trapezoids(r.image, -r.bounds.x1, -r.bounds.y1, ntrap,
+			      (pixman_trapezoid_t *)traps);
+
+	return etnaviv_raster_composite(op, pSrc, pDst, xSrc, ySrc,
+					traps[0].left.p1.x >> 16,
+					traps[0].left.p1.y >> 16, &r);
+}
+
+static Bool etnaviv_accel_Triangles(CARD8 op, PicturePtr pSrc,
+	PicturePtr pDst, PictFormatPtr maskFormat, INT16 xSrc, INT16 ySrc,
+	int ntri, xTriangle *tris)
+{
+	struct etnaviv_raster r;
+	BoxRec bounds;
+
+	if (!maskFormat || maskFormat->format != PICT_a8 || ntri == 0 ||
+	    !etnaviv_raster_supported(pDst->pDrawable->pScreen))
+		return FALSE;
+
+	etnaviv_triangle_bounds(ntri, tris, 0, 0, &bounds);
+	if (!etnaviv_raster_init(&r, pDst->pDrawable, &bounds))
+		return FALSE;
+	if (!r.image)
+		return TRUE;
+
+	pixman_add_triangles(r.image, -r.bounds.x1, -r.bounds.y1, ntri,
+			     (pixman_triangle_t *)tris);
+
+	return etnaviv_raster_composite(op, pSrc, pDst, xSrc, ySrc,
+					tris[0].p1.x >> 16,
+					tris[0].p1.y >> 16, &r);
+}
+
+static Bool etnaviv_accel_AddTraps(PicturePtr pPicture, INT16 x_off,
+	INT16 y_off, int ntrap, xTrap *traps)
+{
+	xFixed x1, y1, x2, y2;
+	struct etnaviv_raster r;
+	BoxRec bounds;
+	int i;
+
+	if (pPicture->format != PICT_a8 || ntrap == 0 ||
+	    !etnaviv_raster_supported(pPicture->pDrawable->pScreen))
+		return FALSE;
+
+	x1 = mint(traps[0].top.l, traps[0].bot.l);
+	x2 = maxt(traps[0].top.r, traps[0].bot.r);
+	y1 = traps[0].top.y;
+	y2 = traps[0].bot.y;
+	for (i = 1; i < ntrap; i++) {
+		x1 = mint(x1, mint(traps[i].top.l, traps[i].bot.l));
+		x2 = maxt(x2, maxt(traps[i].top.r, traps[i].bot.r));
+		y1 = mint(y1, traps[i].top.y);
+		y2 = maxt(y2, traps[i].bot.y);
+	}
+
+	bounds.x1 = pixman_fixed_to_int(pixman_fixed_floor(x1)) + x_off;
+	bounds.y1 = pixman_fixed_to_int(pixman_fixed_floor(y1)) + y_off;
+	bounds.x2 = pixman_fixed_to_int(pixman_fixed_ceil(x2)) + x_off;
+	bounds.y2 = pixman_fixed_to_int(pixman_fixed_ceil(y2)) + y_off;
+
+	if (!etnaviv_raster_init(&r, pPicture->pDrawable, &bounds))
+		return FALSE;
+	if (!r.image)
+		return TRUE;
+
+	pixman_add_traps(r.image, x_off - r.bounds.x1, y_off - r.bounds.y1,
+			 ntrap, (pixman_trap_t *)traps);
+
+	return etnaviv_raster_add(pPicture, &r);
+}
+
+static Bool etnaviv_accel_AddTriangles(PicturePtr pPicture, INT16 x_off,
+	INT16 y_off, int ntri, xTriangle *tris)
+{
+	struct etnaviv_raster r;
+	BoxRec bounds;
+
+	if (pPicture->format != PICT_a8 || ntri == 0 ||
+	    !etnaviv_raster_supported(pPicture->pDrawable->pScreen))
+		return FALSE;
+
+	etnaviv_triangle_bounds(ntri, tris, x_off, y_off, &bounds);
+	if (!etnaviv_raster_init(&r, pPicture->pDrawable, &bounds))
+		return FALSE;
+	if (!r.image)
+		return TRUE;
+
+	pixman_add_triangles(r.image, x_off - r.bounds.x1,
+			     y_off - r.bounds.y1, ntri,
+			     (pixman_triangle_t *)tris);
+
+	return etnaviv_raster_add(pPicture, &r);
+}
+
 static void etnaviv_accel_glyph_upload(ScreenPtr pScreen, PicturePtr pDst,
 	GlyphPtr pGlyph, PicturePtr pSrc, unsigned x, unsigned y)
 {
@@ -1373,7 +3414,7 @@ static void etnaviv_accel_glyph_upload(ScreenPtr pScreen, PicturePtr pDst,
 	op.src_origin_mode = SRC_ORIGIN_RELATIVE;
 	op.rop = 0xcc;
 	op.cmd = VIVS_DE_DEST_CONFIG_COMMAND_BIT_BLT;
-	op.brush = FALSE;
+	op.brush = BRUSH_NONE;
 
 	etnaviv_batch_start(etnaviv, &op);
 	etnaviv_de_op(etnaviv, &op, &box, 1);
@@ -1399,6 +3440,16 @@ etnaviv_Composite(CARD8 op, PicturePtr pSrc, PicturePtr pMask, PicturePtr pDst,
 			  xMask, yMask, xDst, yDst, width, height);
 }
 
+static void etnaviv_CompositeRects(CARD8 op, PicturePtr pDst,
+	xRenderColor *pColor, int nRect, xRectangle *pRects)
+{
+	struct etnaviv *etnaviv = etnaviv_get_screen_priv(pDst->pDrawable->pScreen);
+
+	if (etnaviv->force_fallback ||
+	    !etnaviv_accel_CompositeRects(op, pDst, pColor, nRect, pRects))
+		etnaviv->CompositeRects(op, pDst, pColor, nRect, pRects);
+}
+
 static void etnaviv_Glyphs(CARD8 op, PicturePtr pSrc, PicturePtr pDst,
 	PictFormatPtr maskFormat, INT16 xSrc, INT16 ySrc, int nlist,
 	GlyphListPtr list, GlyphPtr * glyphs)
@@ -1412,6 +3463,52 @@ static void etnaviv_Glyphs(CARD8 op, PicturePtr pSrc, PicturePtr pDst,
 			       xSrc, ySrc, nlist, list, glyphs);
 }
 
+static void etnaviv_Trapezoids(CARD8 op, PicturePtr pSrc, PicturePtr pDst,
+	PictFormatPtr maskFormat, INT16 xSrc, INT16 ySrc, int ntrap,
+	xTrapezoid *traps)
+{
+	struct etnaviv *etnaviv = etnaviv_get_screen_priv(pDst->pDrawable->pScreen);
+
+	if (etnaviv->force_fallback ||
+	    !etnaviv_accel_Trapezoids(op, pSrc, pDst, maskFormat,
+				      xSrc, ySrc, ntrap, traps))
+		unaccel_Trapezoids(op, pSrc, pDst, maskFormat,
+				   xSrc, ySrc, ntrap, traps);
+}
+
+static void etnaviv_Triangles(CARD8 op, PicturePtr pSrc, PicturePtr pDst,
+	PictFormatPtr maskFormat, INT16 xSrc, INT16 ySrc, int ntri,
+	xTriangle *tris)
+{
+	struct etnaviv *etnaviv = etnaviv_get_screen_priv(pDst->pDrawable->pScreen);
+
+	if (etnaviv->force_fallback ||
+	    !etnaviv_accel_Triangles(op, pSrc, pDst, maskFormat,
+				     xSrc, ySrc, ntri, tris))
+		unaccel_Triangles(op, pSrc, pDst, maskFormat,
+				  xSrc, ySrc, ntri, tris);
+}
+
+static void etnaviv_AddTraps(PicturePtr pPicture, INT16 x_off, INT16 y_off,
+	int ntrap, xTrap *traps)
+{
+	struct etnaviv *etnaviv = etnaviv_get_screen_priv(pPicture->pDrawable->pScreen);
+
+	if (etnaviv->force_fallback ||
+	    !etnaviv_accel_AddTraps(pPicture, x_off, y_off, ntrap, traps))
+		unaccel_AddTraps(pPicture, x_off, y_off, ntrap, traps);
+}
+
+static void etnaviv_AddTriangles(PicturePtr pPicture, INT16 x_off,
+	INT16 y_off, int ntri, xTriangle *tris)
+{
+	struct etnaviv *etnaviv = etnaviv_get_screen_priv(pPicture->pDrawable->pScreen);
+
+	if (etnaviv->force_fallback ||
+	    !etnaviv_accel_AddTriangles(pPicture, x_off, y_off, ntri, tris))
+		unaccel_AddTriangles(pPicture, x_off, y_off, ntri, tris);
+}
+
 static void etnaviv_UnrealizeGlyph(ScreenPtr pScreen, GlyphPtr glyph)
 {
 	struct etnaviv *etnaviv = etnaviv_get_screen_priv(pScreen);
@@ -1452,7 +3549,7 @@ static Bool etnaviv_CreateScreenResources(ScreenPtr pScreen)
 
 		ret = glyph_cache_init(pScreen, etnaviv_accel_glyph_upload,
 				       glyph_formats, num,
-				       /* CREATE_PIXMAP_USAGE_TILE | */
+				       CREATE_PIXMAP_USAGE_TILE |
 				       CREATE_PIXMAP_USAGE_GPU);
 	}
 	return ret;
@@ -1462,6 +3559,10 @@ void etnaviv_render_screen_init(ScreenPtr pScreen)
 {
 	struct etnaviv *etnaviv = etnaviv_get_screen_priv(pScreen);
 	PictureScreenPtr ps = GetPictureScreenIfSet(pScreen);
+	unsigned i;
+
+	for (i = 0; i < ARRAY_SIZE(etnaviv_render_kernel); i++)
+		etnaviv_filter_kernel(etnaviv_render_kernel[i], i);
 
 	if (!etnaviv->force_fallback) {
 		etnaviv->CreateScreenResources = pScreen->CreateScreenResources;
@@ -1470,18 +3571,20 @@ void etnaviv_render_screen_init(ScreenPtr pScreen)
 
 	etnaviv->Composite = ps->Composite;
 	ps->Composite = etnaviv_Composite;
+	etnaviv->CompositeRects = ps->CompositeRects;
+	ps->CompositeRects = etnaviv_CompositeRects;
 	etnaviv->Glyphs = ps->Glyphs;
 	ps->Glyphs = etnaviv_Glyphs;
 	etnaviv->UnrealizeGlyph = ps->UnrealizeGlyph;
 	ps->UnrealizeGlyph = etnaviv_UnrealizeGlyph;
 	etnaviv->Triangles = ps->Triangles;
-	ps->Triangles = unaccel_Triangles;
+	ps->Triangles = etnaviv_Triangles;
 	etnaviv->Trapezoids = ps->Trapezoids;
-	ps->Trapezoids = unaccel_Trapezoids;
+	ps->Trapezoids = etnaviv_Trapezoids;
 	etnaviv->AddTriangles = ps->AddTriangles;
-	ps->AddTriangles = unaccel_AddTriangles;
+	ps->AddTriangles = etnaviv_AddTriangles;
 	etnaviv->AddTraps = ps->AddTraps;
-	ps->AddTraps = unaccel_AddTraps;
+	ps->AddTraps = etnaviv_AddTraps;
 }
 
 void etnaviv_render_close_screen(ScreenPtr pScreen)
@@ -1489,8 +3592,12 @@ void etnaviv_render_close_screen(ScreenPtr pScreen)
 	struct etnaviv *etnaviv = etnaviv_get_screen_priv(pScreen);
 	PictureScreenPtr ps = GetPictureScreenIfSet(pScreen);
 
+	etnaviv_gradient_cache_free(pScreen);
+	etnaviv_convert_cache_free(pScreen);
+
 	/* Restore the Pointers */
 	ps->Composite = etnaviv->Composite;
+	ps->CompositeRects = etnaviv->CompositeRects;
 	ps->Glyphs = etnaviv->Glyphs;
 	ps->UnrealizeGlyph = etnaviv->UnrealizeGlyph;
 	ps->Triangles = etnaviv->Triangles;
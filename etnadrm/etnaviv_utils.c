@@ -11,6 +11,8 @@
 #include <errno.h>
 #include <stdarg.h>
 #include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
 #include <unistd.h>
 
 #ifdef HAVE_DIX_CONFIG_H
@@ -21,6 +23,7 @@
 #include "xf86.h"
 
 #include <armada_bufmgr.h>
+#include "boxutil.h"
 #include "cpu_access.h"
 #include "gal_extension.h"
 #include "pamdump.h"
@@ -83,17 +86,241 @@ void __etnaviv_error(struct etnaviv *etnaviv, const char *fn, const char *w, int
 
 
 /*
- * Unmap a pixmap from the GPU.  Note that we must wait for any outstanding
- * GPU operations to complete before unmapping the pixmap from the GPU.
+ * Import a KMS buffer object into the GPU.  We export the dumb buffer
+ * as a dmabuf and import it into etnaviv once; the resulting etna_bo
+ * remains attached to the pixmap until the pixmap is destroyed.  This
+ * avoids repeatedly building and tearing down a usermem mapping (and
+ * the associated MMU flushes) each time the CPU touches the buffer.
  */
-static void etnaviv_unmap_gpu(struct etnaviv *etnaviv, struct etnaviv_pixmap *vPix)
+struct etna_bo *etnaviv_import_armada_bo(struct etnaviv *etnaviv,
+	struct drm_armada_bo *bo)
 {
-#ifdef DEBUG_MAP
-	dbg("Unmapping vPix %p bo %p\n", vPix, vPix->bo);
-#endif
-	etna_bo_del(etnaviv->conn, vPix->etna_bo, NULL);
-	vPix->etna_bo = NULL;
-	vPix->info = 0;
+	struct etna_bo *etna_bo;
+	int fd;
+
+	if (drm_armada_bo_to_fd(bo, &fd)) {
+		xf86DrvMsg(etnaviv->scrnIndex, X_ERROR,
+			   "etnaviv: drm_armada_bo_to_fd(handle=%u) failed: %s\n",
+			   bo->handle, strerror(errno));
+		return NULL;
+	}
+
+	etna_bo = etna_bo_from_dmabuf(etnaviv->conn, fd,
+				      PROT_READ | PROT_WRITE);
+	if (!etna_bo)
+		xf86DrvMsg(etnaviv->scrnIndex, X_ERROR,
+			   "etnaviv: etna_bo_from_dmabuf(handle=%u, size=%zu) failed\n",
+			   bo->handle, bo->size);
+
+	/* The etna_bo holds its own reference to the underlying object */
+	close(fd);
+
+	return etna_bo;
+}
+
+/*
+ * Damage can not see clients writing shared memory pixmaps.  fb places
+ * the pixels of the pixmaps it allocates immediately after the pixmap,
+ * so a pixmap whose pixels are elsewhere may be written behind our back.
+ */
+Bool etnaviv_pixmap_external(PixmapPtr pixmap)
+{
+	char *base = (char *)pixmap + pixmap->drawable.pScreen->totalPixmapSize;
+	char *ptr = pixmap->devPrivate.ptr;
+
+	return ptr < base || ptr >= base + 8;
+}
+
+/*
+ * Pixmaps which are used by both the CPU and GPU are given a system
+ * memory copy once the CPU use outweighs the GPU use.  The score is
+ * incremented for each GPU use and decremented for each CPU use; the
+ * system copy is created when it falls to ETNAVIV_SCORE_SYS.
+ */
+#define ETNAVIV_SCORE_MAX	8
+#define ETNAVIV_SCORE_SYS	-4
+
+static void etnaviv_sys_damage_destroy(DamagePtr damage, void *closure)
+{
+	struct etnaviv_pixmap *vPix = closure;
+
+	vPix->damage = NULL;
+}
+
+/*
+ * Attribute the drawing since the last change of ownership to the
+ * side which was writing the pixmap.  Damage is reported after each
+ * operation, so this does not include the operation in progress.
+ */
+static void etnaviv_sys_fold(struct etnaviv_pixmap *vPix)
+{
+	RegionPtr region;
+
+	if (!vPix->damage)
+		return;
+
+	region = DamageRegion(vPix->damage);
+	if (!RegionNotEmpty(region))
+		return;
+
+	if (vPix->state & ST_CPU_W)
+		RegionUnion(&vPix->cpu_damage, &vPix->cpu_damage, region);
+	else
+		RegionUnion(&vPix->gpu_damage, &vPix->gpu_damage, region);
+
+	DamageEmpty(vPix->damage);
+}
+
+static void etnaviv_sys_copy(struct etnaviv_pixmap *vPix, char *dst,
+	const char *src, RegionPtr region)
+{
+	const BoxRec *box = RegionRects(region);
+	unsigned n = RegionNumRects(region);
+	unsigned pitch = vPix->pitch;
+
+	for (; n; n--, box++) {
+		size_t offset = box->y1 * pitch + box->x1 * vPix->cpp;
+		size_t len = (box->x2 - box->x1) * vPix->cpp;
+		int y;
+
+		for (y = box->y1; y < box->y2; y++, offset += pitch)
+			memcpy(dst + offset, src + offset, len);
+	}
+}
+
+/* Copy the areas written by the CPU to the GPU copy */
+static void etnaviv_sys_upload(struct etnaviv *etnaviv,
+	struct etnaviv_pixmap *vPix)
+{
+	struct etna_bo *etna_bo = vPix->etna_bo;
+
+	if (!RegionNotEmpty(&vPix->cpu_damage))
+		return;
+
+	if (vPix->state & ST_GPU_RW)
+		etnaviv_batch_wait_commit(etnaviv, vPix);
+
+	etna_bo_cpu_prep(etna_bo, NULL, DRM_ETNA_PREP_WRITE);
+	etnaviv_sys_copy(vPix, etna_bo_map(etna_bo), vPix->sys_ptr,
+			 &vPix->cpu_damage);
+	etna_bo_cpu_fini(etna_bo);
+
+	RegionEmpty(&vPix->cpu_damage);
+}
+
+/* Copy the areas written by the GPU to the system copy */
+static void etnaviv_sys_download(struct etnaviv *etnaviv,
+	struct etnaviv_pixmap *vPix)
+{
+	struct etna_bo *etna_bo = vPix->etna_bo;
+
+	if (!RegionNotEmpty(&vPix->gpu_damage))
+		return;
+
+	if (vPix->state & ST_GPU_W)
+		etnaviv_batch_wait_commit(etnaviv, vPix);
+
+	etna_bo_cpu_prep(etna_bo, NULL, DRM_ETNA_PREP_READ);
+	etnaviv_sys_copy(vPix, vPix->sys_ptr, etna_bo_map(etna_bo),
+			 &vPix->gpu_damage);
+	etna_bo_cpu_fini(etna_bo);
+
+	RegionEmpty(&vPix->gpu_damage);
+}
+
+/*
+ * Create the system copy of a pixmap, and start tracking damage to it.
+ * Only private linear pixmaps which nothing else can write qualify.
+ */
+static Bool etnaviv_sys_alloc(struct etnaviv *etnaviv, PixmapPtr pixmap,
+	struct etnaviv_pixmap *vPix, int access)
+{
+	struct etna_bo *etna_bo = vPix->etna_bo;
+	DamagePtr damage;
+	size_t size;
+	void *ptr;
+
+	if (!etna_bo || vPix->shared || vPix->bo || vPix->name ||
+	    vPix->format.tile || vPix->state & ST_DMABUF)
+		return FALSE;
+
+	size = vPix->pitch * vPix->height;
+	ptr = malloc(size);
+	if (!ptr)
+		return FALSE;
+
+	damage = DamageCreate(NULL, etnaviv_sys_damage_destroy,
+			      DamageReportNone, TRUE,
+			      pixmap->drawable.pScreen, vPix);
+	if (!damage) {
+		free(ptr);
+		return FALSE;
+	}
+
+	DamageRegister(&pixmap->drawable, damage);
+	DamageSetReportAfterOp(damage, TRUE);
+
+	if (vPix->state & ST_GPU_W)
+		etnaviv_batch_wait_commit(etnaviv, vPix);
+
+	etna_bo_cpu_prep(etna_bo, NULL, DRM_ETNA_PREP_READ);
+	memcpy(ptr, etna_bo_map(etna_bo), size);
+	etna_bo_cpu_fini(etna_bo);
+
+	vPix->cpp = pixmap->drawable.bitsPerPixel / 8;
+	vPix->sys_ptr = ptr;
+	vPix->damage = damage;
+	RegionNull(&vPix->gpu_damage);
+
+	/*
+	 * The damage was registered part way through the current
+	 * operation, so it will not see what the CPU is about to write.
+	 */
+	if (access == CPU_ACCESS_RW) {
+		BoxRec box;
+
+		box_init(&box, 0, 0, vPix->width, vPix->height);
+		RegionInit(&vPix->cpu_damage, &box, 1);
+	} else {
+		RegionNull(&vPix->cpu_damage);
+	}
+
+	return TRUE;
+}
+
+/*
+ * Release the system copy of a pixmap.  If sync is set, the GPU copy
+ * is first brought up to date, as it is about to become the only copy.
+ */
+void etnaviv_pixmap_free_sys(PixmapPtr pixmap, Bool sync)
+{
+	struct etnaviv_pixmap *vPix = etnaviv_get_pixmap_priv(pixmap);
+
+	if (!vPix || !vPix->sys_ptr)
+		return;
+
+	if (sync) {
+		struct etnaviv *etnaviv;
+
+		etnaviv = etnaviv_get_screen_priv(pixmap->drawable.pScreen);
+		etnaviv_sys_fold(vPix);
+		etnaviv_sys_upload(etnaviv, vPix);
+		vPix->state &= ~ST_CPU_RW;
+	}
+
+	if (vPix->damage) {
+		DamagePtr damage = vPix->damage;
+
+		vPix->damage = NULL;
+		etnaviv_DamageUnregister(&pixmap->drawable, damage);
+		DamageDestroy(damage);
+	}
+
+	RegionUninit(&vPix->cpu_damage);
+	RegionUninit(&vPix->gpu_damage);
+	free(vPix->sys_ptr);
+	vPix->sys_ptr = NULL;
+	vPix->migratable = FALSE;
 }
 
 /*
@@ -116,6 +343,20 @@ Bool etnaviv_map_gpu(struct etnaviv *etnaviv, struct etnaviv_pixmap *vPix,
 	}
 #endif
 
+	if (vPix->migratable && vPix->score < ETNAVIV_SCORE_MAX)
+		vPix->score++;
+
+	etnaviv_pixmap_realise(etnaviv, vPix);
+
+	/*
+	 * Any expanded copy of this pixmap as a tile is about to go stale,
+	 * as is what we know of its contents.
+	 */
+	if (access == GPU_ACCESS_RW) {
+		vPix->strip_valid = FALSE;
+		vPix->content = 0;
+	}
+
 	if (access == GPU_ACCESS_RO) {
 		state = ST_GPU_R;
 		mask = ST_CPU_W | ST_GPU_R;
@@ -135,28 +376,36 @@ Bool etnaviv_map_gpu(struct etnaviv *etnaviv, struct etnaviv_pixmap *vPix,
 
 	/*
 	 * If there is an etna bo, and there's a CPU use against this
-	 * pixmap, finish that first.
+	 * pixmap, finish that first.  For tiled pixmaps, the CPU has
+	 * been using the linear shadow, which must be copied back if
+	 * it was written.  Similarly, pixmaps with a system copy need
+	 * the areas written by the CPU copying to the GPU.
 	 */
-	if (vPix->state & ST_CPU_RW && vPix->etna_bo && !vPix->bo)
-		etna_bo_cpu_fini(vPix->etna_bo);
+	if (vPix->sys_ptr) {
+		etnaviv_sys_fold(vPix);
+		etnaviv_sys_upload(etnaviv, vPix);
+	} else if (vPix->state & ST_CPU_RW) {
+		if (vPix->format.tile) {
+			/* Without a shadow, the CPU had no access */
+			if (vPix->linear_bo) {
+				etna_bo_cpu_fini(vPix->linear_bo);
+				if (vPix->state & ST_CPU_W)
+					etnaviv_pixmap_retile(etnaviv, vPix);
+			}
+		} else if (vPix->etna_bo && !vPix->bo) {
+			etna_bo_cpu_fini(vPix->etna_bo);
+		}
+	}
 
 	/*
-	 * If we have a shmem bo from KMS, map it to an etna_bo.  This
-	 * gives us etna_bo's for everything except the dumb KMS buffers.
+	 * If we have a bo from KMS which has not yet been imported into
+	 * the GPU, do so now.  The mapping persists for the lifetime of
+	 * the bo, so this only happens on first GPU use.
 	 */
 	if (vPix->bo && !vPix->etna_bo) {
-		struct drm_armada_bo *bo = vPix->bo;
-		struct etna_bo *etna_bo;
-
-		etna_bo = etna_bo_from_usermem(etnaviv->conn, bo->ptr,
-					       bo->size);
-		if (!etna_bo) {
-			xf86DrvMsg(etnaviv->scrnIndex, X_ERROR,
-				   "etnaviv: etna_bo_from_usermem(ptr=%p, size=%zu) failed\n", bo->ptr, bo->size);
+		vPix->etna_bo = etnaviv_import_armada_bo(etnaviv, vPix->bo);
+		if (!vPix->etna_bo)
 			return FALSE;
-		}
-
-		vPix->etna_bo = etna_bo;
 	}
 
 	vPix->state = (vPix->state & ~ST_CPU_RW) | state;
@@ -194,18 +443,137 @@ void finish_cpu_drawable(DrawablePtr pDrawable, int access)
 	}
 }
 
+/*
+ * Once the CPU has had to read a pixmap after GPU use this many
+ * times, move it to cached memory.
+ */
+#define ETNAVIV_CACHED_READS	4
+
+static void etnaviv_note_cpu_read(struct etnaviv *etnaviv,
+	struct etnaviv_pixmap *vPix)
+{
+	/* Only private, linear, etnaviv-allocated pixmaps can be moved */
+	if (vPix->cached || vPix->shared || vPix->bo || vPix->name ||
+	    vPix->format.tile || vPix->state & ST_DMABUF)
+		return;
+
+	if (++vPix->cpu_reads < ETNAVIV_CACHED_READS)
+		return;
+
+	if (!etnaviv_src_format_valid(etnaviv, vPix->format) ||
+	    !etnaviv_dst_format_valid(etnaviv, vPix->format))
+		return;
+
+	/*
+	 * Moving the pixmap waits for the GPU to finish with it.  If the
+	 * GPU is still using it, leave the move for a later read rather
+	 * than stall one which may not have needed to wait.
+	 */
+	if (etna_bo_cpu_prep(vPix->etna_bo, NULL, DRM_ETNA_PREP_WRITE |
+			     DRM_ETNA_PREP_NOSYNC))
+		return;
+	etna_bo_cpu_fini(vPix->etna_bo);
+
+	if (!etnaviv_pixmap_set_cached(etnaviv, vPix))
+		vPix->cpu_reads = 0;
+}
+
+/*
+ * Prepare an etna bo for CPU access.  A read-only preparation is
+ * finished before the bo is prepared again if the CPU now wants to
+ * write, so each preparation has its own finish.
+ */
+static void etnaviv_cpu_prep(struct etnaviv_pixmap *vPix,
+	struct etna_bo *etna_bo, int access)
+{
+	uint32_t op;
+
+	if (access == CPU_ACCESS_RW) {
+		if (vPix->state & ST_CPU_W)
+			return;
+		if (vPix->state & ST_CPU_R)
+			etna_bo_cpu_fini(etna_bo);
+		op = DRM_ETNA_PREP_READ | DRM_ETNA_PREP_WRITE;
+	} else {
+		if (vPix->state & ST_CPU_R)
+			return;
+		op = DRM_ETNA_PREP_READ;
+	}
+
+	etna_bo_cpu_prep(etna_bo, NULL, op);
+}
+
 /*
  * Prepare a bo for CPU access.  If the GPU has been accessing the
- * pixmap data, we need to unmap the buffer from the GPU to ensure
- * that our view is up to date.
+ * pixmap data, we need to wait for it to finish to ensure that our
+ * view is up to date.  KMS buffers are write-combined, so there is
+ * no need to drop the GPU mapping.
  */
 void prepare_cpu_drawable(DrawablePtr pDrawable, int access)
 {
 	PixmapPtr pixmap = drawable_pixmap(pDrawable);
 	struct etnaviv_pixmap *vPix = etnaviv_get_pixmap_priv(pixmap);
+	struct etnaviv *etnaviv = etnaviv_get_screen_priv(pDrawable->pScreen);
+
+	/* Draw any collected spans before the CPU looks at anything */
+	if (etnaviv->span.n)
+		etnaviv_span_flush(etnaviv);
+	if (etnaviv->composite.n)
+		etnaviv_composite_flush(etnaviv);
 
 	if (vPix) {
-		struct etnaviv *etnaviv = etnaviv_get_screen_priv(pDrawable->pScreen);
+		etnaviv_pixmap_realise(etnaviv, vPix);
+
+		if (access == CPU_ACCESS_RW) {
+			vPix->strip_valid = FALSE;
+			vPix->content = 0;
+		}
+
+		if (vPix->migratable) {
+			if (vPix->score > -ETNAVIV_SCORE_MAX)
+				vPix->score--;
+			if (!vPix->sys_ptr && !(vPix->state & ST_CPU_RW) &&
+			    vPix->score <= ETNAVIV_SCORE_SYS &&
+			    !etnaviv_sys_alloc(etnaviv, pixmap, vPix, access))
+				vPix->migratable = FALSE;
+		}
+
+		/*
+		 * Pixmaps with a system copy: bring the areas written by
+		 * the GPU up to date, and give the CPU the system copy.
+		 * The GPU may continue to read its own copy meanwhile.
+		 */
+		if (vPix->sys_ptr) {
+			etnaviv_sys_fold(vPix);
+			etnaviv_sys_download(etnaviv, vPix);
+
+			vPix->state &= ~ST_GPU_W;
+			pixmap->devPrivate.ptr = vPix->sys_ptr;
+			goto out;
+		}
+
+		if (access == CPU_ACCESS_RO && vPix->state & ST_GPU_RW &&
+		    !(vPix->state & ST_CPU_RW))
+			etnaviv_note_cpu_read(etnaviv, vPix);
+
+		/*
+		 * The CPU can not access tiled pixmaps directly, but via
+		 * a linear shadow.  If the GPU has written the pixmap since
+		 * the CPU last accessed it, have the GPU update the shadow.
+		 * This waits for all preceding GPU operations.  Without a
+		 * shadow, leave the GPU state alone so that one allocated
+		 * later is still updated.
+		 */
+		if (vPix->format.tile) {
+			if (!etnaviv_pixmap_alloc_shadow(etnaviv, vPix)) {
+				xf86DrvMsg(etnaviv->scrnIndex, X_ERROR,
+					   "etnaviv: failed to allocate linear shadow for %dx%d pixmap\n",
+					   vPix->width, vPix->height);
+				goto out;
+			}
+			if (vPix->state & ST_GPU_W)
+				etnaviv_pixmap_detile(etnaviv, vPix);
+		}
 
 		/*
 		 * If the CPU is going to write to the pixmap, then we must
@@ -218,10 +586,6 @@ void prepare_cpu_drawable(DrawablePtr pDrawable, int access)
 
 			/* The GPU is no longer using this pixmap. */
 			vPix->state &= ~ST_GPU_RW;
-
-			/* Unmap this bo from the GPU */
-			if (vPix->bo && vPix->etna_bo)
-				etnaviv_unmap_gpu(etnaviv, vPix);
 		}
 
 		if (!(vPix->state & ST_DMABUF)) {
@@ -231,11 +595,18 @@ void prepare_cpu_drawable(DrawablePtr pDrawable, int access)
 				dbg("Pixmap %p bo %p to %p\n", pixmap, vPix->bo,
 				    pixmap->devPrivate.ptr);
 #endif
+			} else if (vPix->format.tile) {
+				struct etna_bo *etna_bo = vPix->linear_bo;
+
+				etnaviv_cpu_prep(vPix, etna_bo, access);
+				pixmap->devPrivate.ptr = vPix->linear_mem;
+				if (!vPix->linear_mem)
+					pixmap->devPrivate.ptr =
+						etna_bo_map(etna_bo);
 			} else if (vPix->etna_bo) {
 				struct etna_bo *etna_bo = vPix->etna_bo;
 
-				if (!(vPix->state & ST_CPU_RW))
-					etna_bo_cpu_prep(etna_bo, NULL, DRM_ETNA_PREP_WRITE);
+				etnaviv_cpu_prep(vPix, etna_bo, access);
 
 				pixmap->devPrivate.ptr = etna_bo_map(etna_bo);
 #ifdef DEBUG_MAP
@@ -244,6 +615,7 @@ void prepare_cpu_drawable(DrawablePtr pDrawable, int access)
 #endif
 			}
 		}
+ out:
 #ifdef DEBUG_CHECK_DRAWABLE_USE
 		vPix->in_use++;
 #endif
@@ -290,8 +662,8 @@ static void dump_pix(struct etnaviv *etnaviv, struct etnaviv_pixmap *vPix,
 	const uint32_t *ptr;
 	char n[80];
 
-	if (state & ST_DMABUF) {
-		/* Can't dump ST_DMABUF pixmaps */
+	if (state & ST_DMABUF || vPix->format.tile) {
+		/* Can't dump ST_DMABUF or tiled pixmaps */
 		return;
 	} else if (vPix->bo) {
 		ptr = vPix->bo->ptr;
@@ -301,18 +673,13 @@ static void dump_pix(struct etnaviv *etnaviv, struct etnaviv_pixmap *vPix,
 	}
 
 	if (state & ST_GPU_W)
-		etnaviv_unmap_gpu(etnaviv, vPix);
+		etnaviv_batch_wait_commit(etnaviv, vPix);
 
 	vsprintf(n, fmt, ap);
 
 	dump_pam(ptr, vPix->pitch, alpha, x1, y1, x2, y2,
 		 "/tmp/X.%04u.%s-%u.%u.%u.%u.pam",
 		 idx++, n, x1, y1, x2, y2);
-
-	if (state & ST_GPU_W) {
-		vPix->state &= ~ST_GPU_RW;
-		etnaviv_map_gpu(etnaviv, vPix, GPU_ACCESS_RW);
-	}
 }
 
 void dump_Drawable(DrawablePtr pDraw, const char *fmt, ...)
@@ -9,6 +9,8 @@
 
 #include "utils.h"
 
+struct drm_armada_bo;
+struct etna_bo;
 struct etnaviv;
 struct etnaviv_pixmap;
 
@@ -21,8 +23,12 @@ const char *etnaviv_strerror(int err);
 #define etnaviv_error(v,w,e) __etnaviv_error(v,__func__,w,e)
 void __etnaviv_error(struct etnaviv *, const char *, const char *, int);
 
+struct etna_bo *etnaviv_import_armada_bo(struct etnaviv *etnaviv,
+	struct drm_armada_bo *bo);
 Bool etnaviv_map_gpu(struct etnaviv *etnaviv, struct etnaviv_pixmap *vPix,
 	enum gpu_access access);
+void etnaviv_pixmap_free_sys(PixmapPtr pixmap, Bool sync);
+Bool etnaviv_pixmap_external(PixmapPtr pixmap);
 
 Bool etnaviv_src_format_valid(struct etnaviv *, struct etnaviv_format fmt);
 Bool etnaviv_dst_format_valid(struct etnaviv *, struct etnaviv_format fmt);
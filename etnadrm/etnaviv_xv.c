@@ -132,11 +132,6 @@ static const struct xv_image_format etnaviv_image_formats[] = {
 	},
 };
 
-#define KERNEL_ROWS	17
-#define KERNEL_INDICES	9
-#define KERNEL_SIZE	(KERNEL_ROWS * KERNEL_INDICES)
-#define KERNEL_STATE_SZ	((KERNEL_SIZE + 1) / 2)
-
 static uint32_t xv_filter_kernel[KERNEL_STATE_SZ];
 
 enum {
@@ -344,7 +339,7 @@ static Bool etnaviv_realloc_stage1(ScrnInfoPtr pScrn,
 	 */
 	priv->stage1_bo = etna_bo_new(etnaviv->conn, size,
 				      DRM_ETNA_GEM_TYPE_BMP |
-				      DRM_ETNA_GEM_CACHE_WBACK);
+				      DRM_ETNA_GEM_CACHE_WCOMBINE);
 	if (!priv->stage1_bo) {
 		xf86DrvMsg(pScrn->scrnIndex, X_ERROR,
 			   "etnaviv Xv: etna_bo_new(size=%zu) failed\n", size);
@@ -554,6 +549,9 @@ static int etnaviv_PutImage(ScrnInfoPtr pScrn,
 	op.src_offsets = priv->offsets;
 	box_init(&op.src_bounds, xoff >> 16, 0, width, height);
 
+	/* The filter blits are emitted directly, so draw anything queued */
+	etnaviv_composite_flush(etnaviv);
+
 	etna_set_state_multi(etnaviv->ctx, VIVS_DE_FILTER_KERNEL(0), KERNEL_STATE_SZ,
 			     xv_filter_kernel);
 
@@ -701,84 +699,6 @@ static int etnaviv_QueryImageAttributes(ScrnInfoPtr pScrn, int id,
 	return ret;
 }
 
-static inline float sinc(float x)
-{
-	return x != 0.0 ? sinf(x) / x : 1.0;
-}
-
-/*
- * Some interesting observations of the kernel.  According to the etnaviv
- * rnndb files:
- *  - there are 128 states which hold the kernel.
- *  - each entry contains 9 coefficients (one for each filter tap).
- *  - the entries are indexed by 5 bits from the fractional coordinate
- *    (which makes 32 entries.)
- *
- * As the kernel table is symmetrical around the centre of the fractional
- * coordinate, only half of the entries need to be stored.  In other words,
- * these pairs of indices should be the same:
- *
- *  00=31 01=30 02=29 03=28 04=27 05=26 06=25 07=24
- *  08=23 09=22 10=21 11=20 12=19 13=18 14=17 15=16
- *
- * This means that there are only 16 entries.  However, etnaviv
- * documentation says 17 are required.  What's the additional entry?
- *
- * The next issue is that the filter code always produces zero for the
- * ninth filter tap.  If this is always zero, what's the point of having
- * hardware deal with nine filter taps?  This makes no sense to me.
- */
-static void etnaviv_init_filter_kernel(void)
-{
-	unsigned row, idx, i;
-	int16_t kernel_val[KERNEL_STATE_SZ * 2];
-	float row_ofs = 0.5;
-	float radius = 4.0;
-
-	/* Compute lanczos filter kernel */
-	for (row = i = 0; row < KERNEL_ROWS; row++) {
-		float kernel[KERNEL_INDICES] = { 0.0 };
-		float sum = 0.0;
-
-		for (idx = 0; idx < KERNEL_INDICES; idx++) {
-			float x = idx - 4.0 + row_ofs;
-
-			if (fabs(x) <= radius)
-				kernel[idx] = sinc(M_PI * x) *
-					      sinc(M_PI * x / radius);
-
-			sum += kernel[idx];
-		}
-
-		/* normalise the row */
-		if (sum)
-			for (idx = 0; idx < KERNEL_INDICES; idx++)
-				kernel[idx] /= sum;
-
-		/* convert to 1.14 format */
-		for (idx = 0; idx < KERNEL_INDICES; idx++) {
-			int val = kernel[idx] * (float)(1 << 14);
-
-			if (val < -0x8000)
-				val = -0x8000;
-			else if (val > 0x7fff)
-				val = 0x7fff;
-
-			kernel_val[i++] = val;
-		}
-
-		row_ofs -= 1.0 / ((KERNEL_ROWS - 1) * 2);
-	}
-
-	kernel_val[KERNEL_SIZE] = 0;
-
-	/* Now convert the kernel values into state values */
-	for (i = 0; i < KERNEL_STATE_SZ * 2; i += 2)
-		xv_filter_kernel[i / 2] =
-			VIVS_DE_FILTER_KERNEL_COEFFICIENT0(kernel_val[i]) |
-			VIVS_DE_FILTER_KERNEL_COEFFICIENT1(kernel_val[i + 1]);
-}
-
 static Bool etnaviv_xv_CloseScreen(CLOSE_SCREEN_ARGS_DECL)
 {
 	ScrnInfoPtr pScrn = xf86ScreenToScrn(pScreen);
@@ -818,7 +738,7 @@ XF86VideoAdaptorPtr etnaviv_xv_init(ScreenPtr pScreen, unsigned int *caps)
 	}
 #endif
 
-	etnaviv_init_filter_kernel();
+	etnaviv_filter_kernel(xv_filter_kernel, ETNAVIV_FILTER_LANCZOS);
 
 	etnaviv_xv_attributes[attr_pipe].max_value =
 		XF86_CRTC_CONFIG_PTR(pScrn)->num_crtc - 1;
@@ -470,7 +470,7 @@ static Bool armada_drm_ScreenInit(SCREEN_INIT_ARGS_DECL)
 	pScreen->CloseScreen = armada_drm_CloseScreen;
 
 	if (arm->accel) {
-		if (!arm->accel_ops->screen_init(pScreen, NULL)) {
+		if (!arm->accel_ops->screen_init(pScreen, arm->bufmgr)) {
 			xf86DrvMsg(pScrn->scrnIndex, X_WARNING,
 				   "[drm] Vivante initialization failed, running unaccelerated\n");
 			arm->accel = FALSE;